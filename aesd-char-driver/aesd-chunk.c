@@ -0,0 +1,218 @@
+/**
+ * @file aesd-chunk.c
+ * @brief Fixed-size chunk chains holding the writes of the AESD char driver
+ *
+ * Chunks come from a mempool backed by a dedicated slab cache in the kernel,
+ * from malloc() in userspace so the chain logic can be tested there.
+ *
+ * @author Harinarayanan Gajapathy
+ * @date 2023-03-02
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#else
+#include <stdlib.h>
+
+#define container_of(ptr, type, member) \
+    ((type *) ((char *) (ptr) - offsetof(type, member)))
+#endif
+
+#include "aesd-chunk.h"
+
+#ifdef __KERNEL__
+static struct kmem_cache *chunk_cache;
+static mempool_t *chunk_pool;
+
+/**
+* Creates the slab cache and the mempool the chunks are allocated from
+* @return 0 on success or -ENOMEM
+*/
+int aesd_chunk_pool_create(void)
+{
+    chunk_cache = kmem_cache_create("aesd_chunk", AESD_CHUNK_SIZE, 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (chunk_cache == NULL)
+        return -ENOMEM;
+
+    chunk_pool = mempool_create_slab_pool(AESD_CHUNK_POOL_MIN, chunk_cache);
+    if (chunk_pool == NULL) {
+        kmem_cache_destroy(chunk_cache);
+        chunk_cache = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/**
+* Destroys the mempool and the slab cache, every chunk must have been freed
+*/
+void aesd_chunk_pool_destroy(void)
+{
+    mempool_destroy(chunk_pool);
+    kmem_cache_destroy(chunk_cache);
+    chunk_pool = NULL;
+    chunk_cache = NULL;
+}
+
+static struct aesd_chunk *chunk_alloc(void)
+{
+    return mempool_alloc(chunk_pool, GFP_KERNEL);
+}
+
+static void chunk_free(struct aesd_chunk *chunk)
+{
+    mempool_free(chunk, chunk_pool);
+}
+#else
+int aesd_chunk_pool_create(void)
+{
+    return 0;
+}
+
+void aesd_chunk_pool_destroy(void)
+{
+}
+
+static struct aesd_chunk *chunk_alloc(void)
+{
+    return malloc(AESD_CHUNK_SIZE);
+}
+
+static void chunk_free(struct aesd_chunk *chunk)
+{
+    free(chunk);
+}
+#endif
+
+/**
+* Initializes @param chain to an empty chain without any chunk
+*/
+void aesd_chunk_chain_init(struct aesd_chunk_chain *chain)
+{
+    chain->head = NULL;
+    chain->tail = NULL;
+    chain->size = 0;
+    chain->last = 0;
+}
+
+/**
+* Makes room at the end of @param chain, linking a new chunk once the last one is full.
+* Nothing already in the chain is moved.
+* @param avail is set to the number of bytes that may be written at the returned location, at
+*      most AESD_CHUNK_DATA_SIZE
+* @return where to write the next bytes, to be committed with aesd_chunk_chain_commit(), or
+* NULL if no chunk could be allocated
+*/
+char *aesd_chunk_chain_reserve(struct aesd_chunk_chain *chain, size_t *avail)
+{
+    struct aesd_chunk *chunk;
+
+    if (chain->tail == NULL || chain->tail->len == AESD_CHUNK_DATA_SIZE) {
+        chunk = chunk_alloc();
+        if (chunk == NULL)
+            return NULL;
+
+        chunk->next = NULL;
+        chunk->len = 0;
+        if (chain->tail == NULL)
+            chain->head = chunk;
+        else
+            chain->tail->next = chunk;
+        chain->tail = chunk;
+    }
+
+    *avail = AESD_CHUNK_DATA_SIZE - chain->tail->len;
+
+    return chain->tail->data + chain->tail->len;
+}
+
+/**
+* Adds the @param n bytes written at the location returned by aesd_chunk_chain_reserve() to
+* @param chain, @param n being at most the room it reported
+*/
+void aesd_chunk_chain_commit(struct aesd_chunk_chain *chain, size_t n)
+{
+    if (n == 0)
+        return;
+
+    chain->tail->len += n;
+    chain->size += n;
+    chain->last = chain->tail->data[chain->tail->len - 1];
+}
+
+static void chunks_free(struct aesd_chunk *chunk)
+{
+    struct aesd_chunk *next;
+
+    while (chunk != NULL) {
+        next = chunk->next;
+        chunk_free(chunk);
+        chunk = next;
+    }
+}
+
+/**
+* Frees every chunk of @param chain and leaves it empty
+*/
+void aesd_chunk_chain_free(struct aesd_chunk_chain *chain)
+{
+    chunks_free(chain->head);
+    aesd_chunk_chain_init(chain);
+}
+
+/**
+* @param buffptr the data of the first chunk of a write, see aesd_chunk_chain_data()
+* @param offset the byte of the write to look for, below its size, set to its offset in the
+*      returned chunk
+* @return the chunk holding byte @param offset of the write, its next ones holding the rest
+* from offset 0
+*/
+const struct aesd_chunk *aesd_chunk_seek(const char *buffptr, size_t *offset)
+{
+    const struct aesd_chunk *chunk = container_of(buffptr, struct aesd_chunk, data[0]);
+
+    while (*offset >= chunk->len && chunk->next != NULL) {
+        *offset -= chunk->len;
+        chunk = chunk->next;
+    }
+
+    return chunk;
+}
+
+/**
+* @param buffptr the data of the first chunk of a write, see aesd_chunk_chain_data()
+* @param offset the byte of the write to look for, below its size
+* @param avail is set to the number of bytes of the write stored contiguously from the returned
+*      location, the rest being in the next chunks
+* @return the location of byte @param offset of the write
+*/
+const char *aesd_chunk_find(const char *buffptr, size_t offset, size_t *avail)
+{
+    const struct aesd_chunk *chunk = aesd_chunk_seek(buffptr, &offset);
+
+    *avail = chunk->len - offset;
+
+    return chunk->data + offset;
+}
+
+/**
+* Frees every chunk of the write whose data starts at @param buffptr
+*/
+void aesd_chunk_free(const char *buffptr)
+{
+    chunks_free(container_of(buffptr, struct aesd_chunk, data[0]));
+}
+
+/**
+* Callback freeing a write from the rcu member of its first chunk, for call_rcu() or call_srcu()
+*/
+void aesd_chunk_free_rcu(struct rcu_head *head)
+{
+    chunks_free(container_of(head, struct aesd_chunk, rcu));
+}
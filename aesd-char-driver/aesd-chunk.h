@@ -0,0 +1,106 @@
+/*
+ * aesd-chunk.h
+ *
+ *  Created on: March 2nd, 2023
+ *      Author: Harinarayanan Gajapathy
+ */
+
+#ifndef AESD_CHUNK_H
+#define AESD_CHUNK_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/stddef.h>
+#else
+#include <stddef.h> // size_t, offsetof
+#include <stdint.h> // uintx_t
+#include <stdbool.h>
+
+/* stands in for the kernel's, unused outside of it */
+struct rcu_head
+{
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+#endif
+
+/* size of a chunk, header included, as allocated from the chunk cache */
+#define AESD_CHUNK_SIZE         512
+/* chunks the mempool keeps in reserve for writes under memory pressure */
+#define AESD_CHUNK_POOL_MIN     16
+
+struct aesd_chunk
+{
+    /**
+     * Next chunk of the same write, NULL for the last one
+     */
+    struct aesd_chunk *next;
+    /**
+     * Used to free the chain from its first chunk once no reader may be in it
+     */
+    struct rcu_head rcu;
+    /**
+     * Number of bytes of data used
+     */
+    size_t len;
+    char data[];
+};
+
+#define AESD_CHUNK_DATA_SIZE    (AESD_CHUNK_SIZE - offsetof(struct aesd_chunk, data))
+
+/**
+ * A write being received, appended to chunk by chunk so that no byte is copied
+ * twice. Once complete its data is referenced by the buffptr of an aesd_buffer_entry,
+ * the data of the first chunk.
+ */
+struct aesd_chunk_chain
+{
+    struct aesd_chunk *head;
+    struct aesd_chunk *tail;
+    /**
+     * Number of bytes in all chunks
+     */
+    size_t size;
+    /**
+     * Last byte committed, the tail may have been reserved without getting any
+     */
+    char last;
+};
+
+extern int aesd_chunk_pool_create(void);
+
+extern void aesd_chunk_pool_destroy(void);
+
+extern void aesd_chunk_chain_init(struct aesd_chunk_chain *chain);
+
+extern char *aesd_chunk_chain_reserve(struct aesd_chunk_chain *chain, size_t *avail);
+
+extern void aesd_chunk_chain_commit(struct aesd_chunk_chain *chain, size_t n);
+
+extern void aesd_chunk_chain_free(struct aesd_chunk_chain *chain);
+
+extern const struct aesd_chunk *aesd_chunk_seek(const char *buffptr, size_t *offset);
+
+extern const char *aesd_chunk_find(const char *buffptr, size_t offset, size_t *avail);
+
+extern void aesd_chunk_free(const char *buffptr);
+
+extern void aesd_chunk_free_rcu(struct rcu_head *head);
+
+/**
+ * @return the last byte of a non-empty @param chain
+ */
+static inline char aesd_chunk_chain_last(const struct aesd_chunk_chain *chain)
+{
+    return chain->last;
+}
+
+/**
+ * @return the buffptr of a complete write held in @param chain, see aesd_chunk_find()
+ */
+static inline const char *aesd_chunk_chain_data(const struct aesd_chunk_chain *chain)
+{
+    return chain->head->data;
+}
+
+#endif /* AESD_CHUNK_H */
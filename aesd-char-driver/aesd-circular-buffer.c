@@ -10,9 +10,24 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/compiler.h>
+#include <linux/preempt.h>
+#include <asm/barrier.h>
+#include <asm/processor.h>
 #else
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+
+/* the kernel primitives the sequence count is built on */
+#define READ_ONCE(x)        __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val)  __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+#define smp_rmb()           __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()           __atomic_thread_fence(__ATOMIC_RELEASE)
+#define cpu_relax()         do { } while (0)
+#define preempt_disable()   do { } while (0)
+#define preempt_enable()    do { } while (0)
 #endif
 
 #include "aesd-circular-buffer.h"
@@ -30,35 +45,71 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    uint8_t index = 0;
+    uint32_t lo, hi, mid, count, out_offs, mask;
+    size_t base, size;
     struct aesd_buffer_entry *entry = NULL;
 
     if (buffer == NULL || entry_offset_byte_rtn == NULL)
         return NULL;
 
-    index = buffer->out_offs;
+    /* lockless readers may race aesd_circular_buffer_add_entry(), work on one
+     * snapshot of the fields and keep every index within the slots whatever
+     * it holds, aesd_circular_buffer_read_retry() tells whether it was torn */
+    count = READ_ONCE(buffer->count);
+    size = READ_ONCE(buffer->size);
+    out_offs = READ_ONCE(buffer->out_offs);
+    base = READ_ONCE(buffer->next_offs) - size;
+    mask = buffer->mask;
+
+    if (count == 0 || char_offset >= size)
+        return NULL;
 
-    do {
-        if (buffer->entry[index].size > char_offset) {
-            *entry_offset_byte_rtn = char_offset;
-            entry = &buffer->entry[index];
-            break;
-        } else {
-            char_offset -= buffer->entry[index].size;
-        }
+    /* the offs of the entries rebased on the oldest one increase from
+     * out_offs on, look for the last entry starting at or before
+     * char_offset; it holds char_offset since that is below the total size */
+    lo = 0;
+    hi = (count - 1 < mask) ? count - 1 : mask;
+    while (lo < hi) {
+        mid = lo + ((hi - lo + 1) / 2);
+        if (READ_ONCE(buffer->entry[(out_offs + mid) & mask].offs) - base <= char_offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
 
-        index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    } while (index != buffer->in_offs);
+    entry = &buffer->entry[(out_offs + lo) & mask];
+    *entry_offset_byte_rtn = char_offset - (READ_ONCE(entry->offs) - base);
 
     return entry;
 }
 
+/**
+* Removes the oldest entry of a non-empty @param buffer.
+* @return the buffptr of the removed entry
+*/
+static const char *remove_oldest(struct aesd_circular_buffer *buffer)
+{
+    const char *removed_entry = buffer->entry[buffer->out_offs].buffptr;
+
+    /* with more slots than entries kept the oldest entry is not the
+     * slot about to be written, empty it so no slot outlives its entry */
+    buffer->size -= buffer->entry[buffer->out_offs].size;
+    memset(&buffer->entry[buffer->out_offs], 0, sizeof(struct aesd_buffer_entry));
+    buffer->out_offs = (buffer->out_offs + 1) & buffer->mask;
+    buffer->count--;
+    buffer->full = false;
+
+    return removed_entry;
+}
+
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
-* new start location.
-* Any necessary locking must be handled by the caller
+* new start location. The byte limit is left to aesd_circular_buffer_trim_entry().
+* Any necessary locking must be handled by the caller, only one writer may add an entry at a time.
+* Readers need not lock, see aesd_circular_buffer_read_begin().
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+* Lockless readers may still be reading the replaced entry when this returns.
 */
 const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
@@ -67,22 +118,155 @@ const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
     if (buffer == NULL || add_entry == NULL)
         return NULL;
 
-    if (buffer->full) {
-        replaced_entry = buffer->entry[buffer->in_offs].buffptr;
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    }
+    /* readers spin while seq is odd, the writer must not be preempted
+     * meanwhile even though it holds a sleeping lock */
+    preempt_disable();
+    WRITE_ONCE(buffer->seq, buffer->seq + 1);
+    smp_wmb();
+
+    if (buffer->full)
+        replaced_entry = remove_oldest(buffer);
+
+    buffer->entry[buffer->in_offs] = *add_entry;
+    buffer->entry[buffer->in_offs].offs = buffer->next_offs;
+    buffer->next_offs += add_entry->size;
+    buffer->size += add_entry->size;
+    buffer->in_offs = (buffer->in_offs + 1) & buffer->mask;
+    buffer->count++;
+    buffer->full = (buffer->count == buffer->capacity) ? true : false;
 
-    buffer->entry[buffer->in_offs++] = *add_entry;
-    buffer->in_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    buffer->full = (buffer->in_offs == buffer->out_offs) ? true : false;
+    smp_wmb();
+    WRITE_ONCE(buffer->seq, buffer->seq + 1);
+    preempt_enable();
 
     return replaced_entry;
 }
 
 /**
-* Initializes the circular buffer described by @param buffer to an empty struct
+* Removes the oldest entry of @param buffer if the entries hold more than the byte limit given at
+* initialization. Call it after aesd_circular_buffer_add_entry() until it returns NULL to bring the
+* buffer back under the limit, a large entry may push out several small ones. The newest entry is
+* never removed, even if it exceeds the limit on its own.
+* Any necessary locking must be handled by the caller, as for aesd_circular_buffer_add_entry().
+* @return the buffptr of the removed entry, whose memory the caller manages, or NULL if the buffer
+* is within its byte limit
+*/
+const char *aesd_circular_buffer_trim_entry(struct aesd_circular_buffer *buffer)
+{
+    const char *removed_entry;
+
+    if (buffer == NULL || buffer->max_bytes == 0 || buffer->size <= buffer->max_bytes ||
+        buffer->count <= 1)
+        return NULL;
+
+    /* not preempted while seq is odd, see aesd_circular_buffer_add_entry() */
+    preempt_disable();
+    WRITE_ONCE(buffer->seq, buffer->seq + 1);
+    smp_wmb();
+
+    removed_entry = remove_oldest(buffer);
+
+    smp_wmb();
+    WRITE_ONCE(buffer->seq, buffer->seq + 1);
+    preempt_enable();
+
+    return removed_entry;
+}
+
+/**
+* @param buffer the buffer to look into.  Any necessary locking must be performed by caller.
+* @param n the entry to return, 0 being the oldest one
+* @return the n-th oldest entry of @param buffer, or NULL if it holds n entries or fewer
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            uint32_t n)
+{
+    if (buffer == NULL || n >= buffer->count)
+        return NULL;
+
+    return &buffer->entry[(buffer->out_offs + n) & buffer->mask];
+}
+
+/**
+* Starts a lookup in @param buffer without the lock serializing its writers, spinning while a
+* writer, which cannot be preempted meanwhile, changes the buffer. The lookup is valid
+* only if aesd_circular_buffer_read_retry() then returns false, otherwise an entry was added
+* meanwhile and the lookup must be started over:
+*
+* do {
+*      seq = aesd_circular_buffer_read_begin(&buffer);
+*      entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, fpos, &offset);
+*      if (entry != NULL)
+*          copy = *entry;
+* } while (aesd_circular_buffer_read_retry(&buffer, seq));
+*
+* The lookup functions stay within the entry array whatever they read, only the copied entry
+* may be used once the lookup is over. The memory it references must be kept alive by the
+* caller until the reader is done with it, since a writer may replace the entry at any time.
+* @return the sequence count to pass to aesd_circular_buffer_read_retry()
+*/
+uint32_t aesd_circular_buffer_read_begin(const struct aesd_circular_buffer *buffer)
+{
+    uint32_t seq;
+
+    while ((seq = READ_ONCE(buffer->seq)) & 1)
+        cpu_relax();
+    smp_rmb();
+
+    return seq;
+}
+
+/**
+* @param buffer the buffer looked into
+* @param seq the value returned by aesd_circular_buffer_read_begin()
+* @return true if an entry was added since aesd_circular_buffer_read_begin(), making the lookup invalid
+*/
+bool aesd_circular_buffer_read_retry(const struct aesd_circular_buffer *buffer, uint32_t seq)
+{
+    smp_rmb();
+
+    return READ_ONCE(buffer->seq) != seq;
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct holding the
+* AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED most recent entries
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
+    aesd_circular_buffer_init_capacity(buffer, NULL, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, 0);
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct holding at most
+* the @param capacity most recent entries, and only as many of them as fit in @param max_bytes
+* bytes, see aesd_circular_buffer_trim_entry(). A @param max_bytes of 0 does not limit the bytes.
+* @param entries an array of @param capacity entries which must outlive the buffer, or NULL to use
+* the AESD_CIRCULAR_BUFFER_INLINE_SLOTS slots of the buffer itself
+* @return 0 on success or -EINVAL if @param capacity is not a power of two with @param entries,
+* or does not fit in the inline slots without
+*/
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *entries, uint32_t capacity, size_t max_bytes)
+{
+    if (buffer == NULL || capacity == 0)
+        return -EINVAL;
+    if (entries == NULL && capacity > AESD_CIRCULAR_BUFFER_INLINE_SLOTS)
+        return -EINVAL;
+    if (entries != NULL && (capacity & (capacity - 1)) != 0)
+        return -EINVAL;
+
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    if (entries == NULL) {
+        buffer->entry = buffer->inline_entry;
+        buffer->mask = AESD_CIRCULAR_BUFFER_INLINE_SLOTS - 1;
+    } else {
+        memset(entries,0,sizeof(struct aesd_buffer_entry) * capacity);
+        buffer->entry = entries;
+        buffer->mask = capacity - 1;
+    }
+    buffer->capacity = capacity;
+    buffer->max_bytes = max_bytes;
+
+    return 0;
 }
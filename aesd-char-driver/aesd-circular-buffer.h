@@ -17,6 +17,9 @@
 #endif
 
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+/* slots of a buffer set up without caller storage, the power of two
+ * holding AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries */
+#define AESD_CIRCULAR_BUFFER_INLINE_SLOTS 16
 
 struct aesd_buffer_entry
 {
@@ -28,27 +31,69 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Set by aesd_circular_buffer_add_entry(): bytes added to the buffer before
+     * this entry, wrapping around. Subtracting the offs of the oldest entry
+     * gives the position of the entry.
+     */
+    size_t offs;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations,
+     * mask + 1 slots long. Slots not holding an entry are zeroed.
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry *entry;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Number of entries stored
+     */
+    uint32_t count;
+    /**
+     * Entries kept before the oldest one is replaced, at most mask + 1
+     */
+    uint32_t capacity;
+    /**
+     * Number of slots minus one, the slots being a power of two so that an
+     * offset wraps around with a mask instead of a division
+     */
+    uint32_t mask;
+    /**
+     * Number of bytes stored in all entries
+     */
+    size_t size;
+    /**
+     * offs of the next entry added
+     */
+    size_t next_offs;
+    /**
+     * Sequence count, odd while aesd_circular_buffer_add_entry() changes the buffer.
+     * Lets readers look up entries without the lock serializing the writers, see
+     * aesd_circular_buffer_read_begin()
+     */
+    uint32_t seq;
+    /**
+     * Bytes the entries may hold before the oldest ones are trimmed, 0 for no limit
+     */
+    size_t max_bytes;
+    /**
+     * Slots of a buffer set up without caller storage
+     */
+    struct aesd_buffer_entry inline_entry[AESD_CIRCULAR_BUFFER_INLINE_SLOTS];
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
@@ -58,14 +103,46 @@ extern const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *b
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *entries, uint32_t capacity, size_t max_bytes);
+
+extern const char *aesd_circular_buffer_trim_entry(struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            uint32_t n);
+
+extern uint32_t aesd_circular_buffer_read_begin(const struct aesd_circular_buffer *buffer);
+
+extern bool aesd_circular_buffer_read_retry(const struct aesd_circular_buffer *buffer, uint32_t seq);
+
+/**
+ * @param buffer the buffer holding @param entry
+ * @param entry an entry returned by one of the functions above
+ * @return the position of the first byte of @param entry if all buffer strings were concatenated
+ * end to end
+ */
+static inline size_t aesd_circular_buffer_entry_fpos(const struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entry)
+{
+    return entry->offs - (buffer->next_offs - buffer->size);
+}
+
+/**
+ * @return the number of bytes stored in @param buffer
+ */
+static inline size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->size;
+}
+
 /**
- * Create a for loop to iterate over each member of the circular buffer.
+ * Create a for loop to iterate over each slot of the circular buffer, empty ones included.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +151,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<=(buffer)->mask; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
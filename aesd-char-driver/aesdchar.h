@@ -23,14 +23,19 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+#include <linux/srcu.h>
+
 #include "aesd-circular-buffer.h"
+#include "aesd-chunk.h"
 
 struct aesd_dev
 {
     struct cdev cdev;                   /* Char device structure */
-    struct mutex lock;                  /* Mutex */
+    struct mutex lock;                  /* Mutex serializing writers */
+    struct srcu_struct srcu;            /* Readers of evicted writes */
     struct aesd_circular_buffer cb;     /* Circular buffer structure */
-    struct aesd_buffer_entry entry;     /* Working buffer */
+    struct aesd_chunk_chain chain;      /* Write being received */
+    struct aesd_buffer_entry *entries;  /* Slots of cb when history is set */
 };
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -29,8 +29,26 @@ int aesd_minor =   0;
 MODULE_AUTHOR("Harinarayanan Gajapathy");
 MODULE_LICENSE("Dual BSD/GPL");
 
+/* number of writes kept, a power of two, 0 keeps the default 10 */
+static unsigned int history = 0;
+module_param(history, uint, 0444);
+MODULE_PARM_DESC(history, "Writes kept, a power of two (default 10)");
+
+/* bytes the writes kept may hold, 0 for no limit */
+static unsigned long max_bytes = 0;
+module_param(max_bytes, ulong, 0444);
+MODULE_PARM_DESC(max_bytes, "Bytes the writes kept may hold, the oldest are dropped past it (default no limit)");
+
 struct aesd_dev aesd_device;
 
+/* free a write once no reader may still be copying from it */
+static void aesd_write_free(struct aesd_dev *dev, const char *buffptr)
+{
+	struct aesd_chunk *chunk = container_of(buffptr, struct aesd_chunk, data[0]);
+
+	call_srcu(&dev->srcu, &chunk->rcu, aesd_chunk_free_rcu);
+}
+
 int aesd_open(struct inode *inode, struct file *filp)
 {
 	struct aesd_dev *dev = NULL;
@@ -56,8 +74,11 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
 				loff_t *f_pos)
 {
 	ssize_t retval = 0;
-	size_t entry_offset = 0;
-	struct aesd_buffer_entry *entry = NULL;
+	size_t entry_offset = 0, len, avail, uncopied, done = 0;
+	const struct aesd_chunk *chunk;
+	uint32_t seq;
+	int idx;
+	struct aesd_buffer_entry *entry = NULL, copy;
 	struct aesd_dev *dev = NULL;
 
 	PDEBUG("read %zu bytes with offset %lld\n", count, *f_pos);
@@ -69,21 +90,41 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
 
 	dev = filp->private_data;
 
-	if (mutex_lock_interruptible(&dev->lock) != 0) {
-		PDEBUG("failed to acquire mutex\n");
-		return -ERESTARTSYS;
-	}
+	/* readers do not take the writers' mutex, SRCU keeps the write being
+	 * copied alive should it be evicted, even while copy_to_user() faults */
+	idx = srcu_read_lock(&dev->srcu);
 
-	entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->cb, *f_pos, &entry_offset);
+	do {
+		seq = aesd_circular_buffer_read_begin(&dev->cb);
+		entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->cb, *f_pos, &entry_offset);
+		if (entry != NULL)
+			copy = *entry;
+	} while (aesd_circular_buffer_read_retry(&dev->cb, seq));
+
+	/* the rest of the write, chunk by chunk from the one holding f_pos */
 	if (entry != NULL) {
-		retval = copy_to_user(buf, (entry->buffptr + entry_offset), (entry->size - entry_offset));
-		retval = (entry->size - entry_offset) - retval;
-		*f_pos += retval;
+		len = min(count, copy.size - entry_offset);
+		chunk = aesd_chunk_seek(copy.buffptr, &entry_offset);
+		while (done < len && chunk != NULL) {
+			avail = min(chunk->len - entry_offset, len - done);
+			uncopied = copy_to_user(buf + done, chunk->data + entry_offset, avail);
+			done += avail - uncopied;
+			if (uncopied != 0)
+				break;
+			chunk = chunk->next;
+			entry_offset = 0;
+		}
+		if (done == 0 && len != 0) {
+			retval = -EFAULT;
+		} else {
+			retval = done;
+			*f_pos += retval;
+		}
 	}
 
-	PDEBUG("aesd_read returns %ld\n", retval);
+	srcu_read_unlock(&dev->srcu, idx);
 
-	mutex_unlock(&dev->lock);
+	PDEBUG("aesd_read returns %ld\n", retval);
 
 	return retval;
 }
@@ -91,8 +132,11 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
 ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
 				loff_t *f_pos)
 {
-	ssize_t retval = -ENOMEM;
+	ssize_t retval = 0;
+	size_t avail, n, uncopied, done = 0;
+	char *p = NULL;
 	const char *rtnptr = NULL;
+	struct aesd_buffer_entry entry;
 	struct aesd_dev *dev = NULL;
 
 	PDEBUG("write %zu bytes with offset %lld\n", count, *f_pos);
@@ -109,45 +153,56 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
 		return -ERESTARTSYS;
 	}
 
-	if (dev->entry.size == 0) {
-		dev->entry.buffptr = (char *) kzalloc(count, GFP_KERNEL);
-	} else {
-		dev->entry.buffptr = (char *) krealloc(dev->entry.buffptr, \
-								dev->entry.size + count, GFP_KERNEL);
-	}
+	/* append to the write being received, a chunk at a time, without
+	 * moving what it already holds */
+	while (done < count) {
+		p = aesd_chunk_chain_reserve(&dev->chain, &avail);
+		if (p == NULL) {
+			PDEBUG("failed to allocate memory\n");
+			break;
+		}
 
-	if (dev->entry.buffptr == NULL) {
-		PDEBUG("failed to allocate memory\n");
-		retval = -ENOMEM;
-	} else {
 		/* copy_from_user - returns number of bytes that could not be copied.
 		* On success, this will be zero. */
-		retval = copy_from_user((void *) dev->entry.buffptr + dev->entry.size, buf, count);
+		n = min(avail, count - done);
+		uncopied = copy_from_user(p, buf + done, n);
+		aesd_chunk_chain_commit(&dev->chain, n - uncopied);
+		done += n - uncopied;
+		if (uncopied != 0)
+			break;
+	}
+	PDEBUG("copied %zu bytes from userspace to kernel space, total size %zu\n", \
+				done, dev->chain.size);
 
-		retval = count - retval;
-		dev->entry.size += retval;
-		PDEBUG("copied %ld bytes from userspace to kernel space, total size %ld\n", \
-					retval, dev->entry.size);
+	if (dev->chain.size != 0 && aesd_chunk_chain_last(&dev->chain) == '\n') {
+		entry.buffptr = aesd_chunk_chain_data(&dev->chain);
+		entry.size = dev->chain.size;
+		rtnptr = aesd_circular_buffer_add_entry(&dev->cb, &entry);
+		if (rtnptr != NULL)
+			aesd_write_free(dev, rtnptr);
 
-		if (dev->entry.buffptr[(dev->entry.size - 1)] == '\n') {
-			rtnptr = aesd_circular_buffer_add_entry(&dev->cb, &dev->entry);
-			if (rtnptr != NULL)
-				kfree(rtnptr);
+		/* drop as many of the oldest writes as max_bytes requires */
+		while ((rtnptr = aesd_circular_buffer_trim_entry(&dev->cb)) != NULL)
+			aesd_write_free(dev, rtnptr);
 
-			dev->entry.buffptr = NULL;
-			dev->entry.size = 0;
-		}
+		aesd_chunk_chain_init(&dev->chain);
 	}
 
 	mutex_unlock(&dev->lock);
 
+	if (done == 0 && count != 0)
+		retval = (p == NULL) ? -ENOMEM : -EFAULT;
+	else
+		retval = done;
+
 	return retval;
 }
 
 static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, unsigned int write_cmd_offset)
 {
 	long retval = 0;
-	int index = 0;
+	size_t size = 0, pos = 0;
+	uint32_t seq;
 	struct aesd_buffer_entry *entry = NULL;
 	struct aesd_dev *dev = NULL;
 
@@ -160,28 +215,22 @@ static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, u
 
 	dev = filp->private_data;
 
-	if (mutex_lock_interruptible(&dev->lock) != 0) {
-		PDEBUG("failed to acquire mutex\n");
-		return -ERESTARTSYS;
-	}
-
-	AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->cb, index) {
-		/* index will give the total number of commands in circular buffer */
-	}
+	/* write_cmd counts from the oldest write kept, not from slot 0 */
+	do {
+		seq = aesd_circular_buffer_read_begin(&dev->cb);
+		entry = aesd_circular_buffer_get_entry(&dev->cb, write_cmd);
+		if (entry != NULL) {
+			size = entry->size;
+			pos = aesd_circular_buffer_entry_fpos(&dev->cb, entry);
+		}
+	} while (aesd_circular_buffer_read_retry(&dev->cb, seq));
 
-	if (write_cmd > index ||
-		write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ||
-		write_cmd_offset >= dev->cb.entry[write_cmd].size) {
+	if (entry == NULL || write_cmd_offset >= size) {
 		retval = -EINVAL;
 	} else {
-		for (index = 0; index < write_cmd; index++)
-			filp->f_pos += dev->cb.entry[index].size;
-
-		filp->f_pos += write_cmd_offset;
+		filp->f_pos = pos + write_cmd_offset;
 	}
 
-	mutex_unlock(&dev->lock);
-
 	return retval;
 }
 
@@ -223,10 +272,9 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
 {
 	loff_t newpos;
-	loff_t size = 0;
-	int index = 0;
+	size_t size;
+	uint32_t seq;
 	struct aesd_dev *dev = NULL;
-	struct aesd_buffer_entry *entry = NULL;
 
 	PDEBUG("llseek\n");
 
@@ -237,19 +285,13 @@ loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
 
 	dev = filp->private_data;
 
-	if (mutex_lock_interruptible(&dev->lock) != 0) {
-		PDEBUG("failed to acquire mutex\n");
-		return -ERESTARTSYS;
-	}
-
-	/* calculate size */
-	AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->cb, index)
-		size += entry->size;
+	do {
+		seq = aesd_circular_buffer_read_begin(&dev->cb);
+		size = aesd_circular_buffer_size(&dev->cb);
+	} while (aesd_circular_buffer_read_retry(&dev->cb, seq));
 
 	newpos = fixed_size_llseek(filp, off, whence, size);
 
-	mutex_unlock(&dev->lock);
-
 	return newpos;
 }
 
@@ -295,13 +337,48 @@ int aesd_init_module(void)
 	memset(&aesd_device,0,sizeof(struct aesd_dev));
 
 	mutex_init(&aesd_device.lock);
-	aesd_circular_buffer_init(&aesd_device.cb);
+	aesd_chunk_chain_init(&aesd_device.chain);
 
-	result = aesd_setup_cdev(&aesd_device);
-	if (result) {
-		unregister_chrdev_region(dev, 1);
+	result = aesd_chunk_pool_create();
+	if (result)
+		goto err_region;
+
+	result = init_srcu_struct(&aesd_device.srcu);
+	if (result)
+		goto err_pool;
+
+	if (history == 0) {
+		aesd_circular_buffer_init_capacity(&aesd_device.cb, NULL,
+						AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, max_bytes);
+	} else {
+		aesd_device.entries = kcalloc(history, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+		if (aesd_device.entries == NULL) {
+			result = -ENOMEM;
+			goto err_srcu;
+		}
+		result = aesd_circular_buffer_init_capacity(&aesd_device.cb,
+							aesd_device.entries, history, max_bytes);
+		if (result) {
+			printk(KERN_WARNING "history %u is not a power of two\n", history);
+			goto err_entries;
+		}
 	}
 
+	result = aesd_setup_cdev(&aesd_device);
+	if (result)
+		goto err_entries;
+
+	return 0;
+
+err_entries:
+	kfree(aesd_device.entries);
+err_srcu:
+	cleanup_srcu_struct(&aesd_device.srcu);
+err_pool:
+	aesd_chunk_pool_destroy();
+err_region:
+	unregister_chrdev_region(dev, 1);
+
 	return result;
 }
 
@@ -309,7 +386,7 @@ void aesd_cleanup_module(void)
 {
 	dev_t devno = MKDEV(aesd_major, aesd_minor);
 	struct aesd_buffer_entry *entry = NULL;
-	int index = 0;
+	unsigned int index = 0;
 
 	PDEBUG("cleanup_module\n");
 
@@ -317,10 +394,17 @@ void aesd_cleanup_module(void)
 
 	AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.cb, index) {
 		if (entry->buffptr != NULL) {
-			PDEBUG("bufferptr - %s, size %ld\n", entry->buffptr, entry->size);
-			kfree(entry->buffptr);
+			PDEBUG("freeing write of size %ld\n", entry->size);
+			aesd_chunk_free(entry->buffptr);
 		}
 	}
+	aesd_chunk_chain_free(&aesd_device.chain);
+	kfree(aesd_device.entries);
+
+	/* evicted writes still waiting for their grace period */
+	srcu_barrier(&aesd_device.srcu);
+	cleanup_srcu_struct(&aesd_device.srcu);
+	aesd_chunk_pool_destroy();
 
 	cdev_del(&aesd_device.cdev);
 	unregister_chrdev_region(devno, 1);
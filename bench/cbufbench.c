@@ -0,0 +1,210 @@
+/**
+ * @file    cbufbench.c
+ *
+ * @brief   Micro-benchmark of the aesd-char-driver circular buffer.
+ *
+ * Fills circular buffers of the default 10 entries and of power-of-two
+ * capacities from 16 to 65536 with fixed-length writes, then times
+ * aesd_circular_buffer_add_entry() on the full buffer, each add
+ * replacing the oldest entry, and
+ * aesd_circular_buffer_find_entry_offset_for_fpos() at random offsets,
+ * a binary search over the entry offsets, next to a linear walk from the
+ * oldest entry as the lookup used to do. The linear walk runs -f divided
+ * by the capacity times, the binary search -f times.
+ *
+ * Usage: cbufbench [-a adds] [-f finds] [-s write size]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define MIN_CAPACITY    16
+#define MAX_CAPACITY    65536
+#define MIN_FINDS       256
+
+/* keeps the compiler from dropping the calls being timed */
+static volatile size_t sink;
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* the lookup before the buffer kept its entry offsets */
+static struct aesd_buffer_entry *find_linear(struct aesd_circular_buffer *buffer,
+                                             size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    uint32_t n;
+    struct aesd_buffer_entry *entry;
+
+    for (n = 0; n < buffer->count; n++) {
+        entry = aesd_circular_buffer_get_entry(buffer, n);
+        if (entry->size > char_offset) {
+            *entry_offset_byte_rtn = char_offset;
+            return entry;
+        }
+        char_offset -= entry->size;
+    }
+
+    return NULL;
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+
+    return x;
+}
+
+/**
+ * @brief Time adds and finds on an initialized buffer and print a row.
+ *
+ * @param buffer empty buffer
+ * @param label capacity column
+ * @param nadds adds to time
+ * @param nfinds lookups, divided by the capacity for the linear walk
+ * @param entry entry added over and over, writes are not copied
+ * @return int 0 on success or -1 if a find missed
+ */
+static int bench(struct aesd_circular_buffer *buffer, const char *label,
+                 long nadds, long nfinds, const struct aesd_buffer_entry *entry)
+{
+    long i, nlinear;
+    size_t total, off, sum = 0;
+    uint64_t rnd = 88172645463325252ULL;
+    double t0, add_s, find_s, linear_s;
+    struct aesd_buffer_entry *found;
+
+    /* fill it first so every timed add replaces the oldest entry */
+    for (i = 0; i < (long) buffer->capacity; i++)
+        aesd_circular_buffer_add_entry(buffer, entry);
+
+    t0 = now_s();
+    for (i = 0; i < nadds; i++)
+        sum += (size_t) aesd_circular_buffer_add_entry(buffer, entry);
+    add_s = now_s() - t0;
+
+    total = (size_t) buffer->capacity * entry->size;
+
+    t0 = now_s();
+    for (i = 0; i < nfinds; i++) {
+        found = aesd_circular_buffer_find_entry_offset_for_fpos(buffer,
+                        xorshift64(&rnd) % total, &off);
+        if (found == NULL)
+            return -1;
+        sum += off;
+    }
+    find_s = now_s() - t0;
+
+    nlinear = nfinds / buffer->capacity;
+    if (nlinear < MIN_FINDS)
+        nlinear = MIN_FINDS;
+
+    t0 = now_s();
+    for (i = 0; i < nlinear; i++) {
+        found = find_linear(buffer, xorshift64(&rnd) % total, &off);
+        if (found == NULL)
+            return -1;
+        sum += off;
+    }
+    linear_s = now_s() - t0;
+
+    sink = sum;
+
+    printf("%-12s %12.1f %12.1f %12.1f\n", label,
+           (add_s * 1e9) / nadds, (find_s * 1e9) / nfinds, (linear_s * 1e9) / nlinear);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    long nadds = 1L << 24, nfinds = 1L << 24, wsize = 64;
+    uint32_t capacity;
+    char label[16];
+    char *write;
+    struct aesd_buffer_entry entry, *entries;
+    struct aesd_circular_buffer buffer;
+
+    while ((opt = getopt(argc, argv, "a:f:s:")) != -1) {
+        switch (opt) {
+        case 'a': nadds = atol(optarg); break;
+        case 'f': nfinds = atol(optarg); break;
+        case 's': wsize = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-a adds] [-f finds] [-s write size]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (nadds < 1 || nfinds < 1 || wsize < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    write = malloc(wsize);
+    entries = calloc(MAX_CAPACITY, sizeof(struct aesd_buffer_entry));
+    if (write == NULL || entries == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(write, 'x', wsize);
+    write[wsize - 1] = '\n';
+    entry.buffptr = write;
+    entry.size = wsize;
+
+    printf("%-12s %12s %12s %12s\n", "capacity", "add ns", "find ns", "linear ns");
+
+    aesd_circular_buffer_init(&buffer);
+    snprintf(label, sizeof(label), "%d (default)", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    if (bench(&buffer, label, nadds, nfinds, &entry) != 0)
+        goto error;
+
+    for (capacity = MIN_CAPACITY; capacity <= MAX_CAPACITY; capacity <<= 1) {
+        if (aesd_circular_buffer_init_capacity(&buffer, entries, capacity, 0) != 0)
+            goto error;
+        snprintf(label, sizeof(label), "%u", capacity);
+        if (bench(&buffer, label, nadds, nfinds, &entry) != 0)
+            goto error;
+    }
+
+    free(entries);
+    free(write);
+
+    return 0;
+
+error:
+    fprintf(stderr, "circular buffer lookup failed\n");
+    free(entries);
+    free(write);
+
+    return 1;
+}
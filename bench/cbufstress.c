@@ -0,0 +1,307 @@
+/**
+ * @file    cbufstress.c
+ *
+ * @brief   Reader/writer stress test and benchmark of the aesd-char-driver
+ *          circular buffer.
+ *
+ * One writer adds entries to a circular buffer for -d milliseconds while
+ * -r readers look up random positions in it and copy the entry found,
+ * either without a lock, retrying when an add overlapped the lookup the
+ * way aesd_read() does, or holding the writer's mutex the way it used
+ * to. Every write spells out its own number and length, so a reader
+ * checks each copy against the position it asked for and the run fails
+ * on the first torn lookup.
+ *
+ * Writes are never freed while the test runs, the driver relies on SRCU
+ * for that, so the writer stops once -w writes are made.
+ *
+ * Usage: cbufstress [-m lockless|mutex|both] [-r readers] [-d ms] [-c capacity]
+ *                   [-w max writes] [-i ns between writes]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define MAX_READERS     64
+#define WRITE_SLOT      64      /* longest write */
+#define HDR_LEN         9       /* "%08x " */
+
+struct reader {
+    pthread_t tid;
+    unsigned int id;
+    unsigned long reads;
+    unsigned long retries;
+    unsigned long misses;       /* position past the end by then */
+    int failed;
+};
+
+static struct aesd_circular_buffer buffer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int lockless;
+static atomic_int running;
+static char *arena;
+static long max_writes, interval_ns;
+static unsigned long nwrites;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+
+    return x;
+}
+
+static size_t write_len(unsigned long n)
+{
+    return HDR_LEN + 1 + (n % (WRITE_SLOT - HDR_LEN));
+}
+
+static void *writer_func(void *arg)
+{
+    unsigned long n;
+    uint64_t until;
+    char *w;
+    const char *replaced;
+    struct aesd_buffer_entry entry;
+
+    (void) arg;
+
+    for (n = 0; n < (unsigned long) max_writes && atomic_load(&running); n++) {
+        w = arena + (n * WRITE_SLOT);
+        entry.buffptr = w;
+        entry.size = write_len(n);
+        snprintf(w, WRITE_SLOT, "%08lx ", n);
+        memset(w + HDR_LEN, 'a' + (n % 26), entry.size - HDR_LEN - 1);
+        w[entry.size - 1] = '\n';
+
+        pthread_mutex_lock(&lock);
+        replaced = aesd_circular_buffer_add_entry(&buffer, &entry);
+        pthread_mutex_unlock(&lock);
+        (void) replaced;
+
+        until = now_ns() + interval_ns;
+        while (interval_ns > 0 && now_ns() < until)
+            ;
+    }
+    nwrites = n;
+
+    return NULL;
+}
+
+/**
+ * @brief Check a copied entry against the write it should be.
+ *
+ * @return int 0 if it is consistent, -1 otherwise
+ */
+static int check(const struct aesd_buffer_entry *copy, size_t offset)
+{
+    unsigned long n;
+    size_t i;
+
+    if (copy->buffptr < arena || copy->size < HDR_LEN + 1 || offset >= copy->size)
+        return -1;
+
+    n = (copy->buffptr - arena) / WRITE_SLOT;
+    if (copy->buffptr != arena + (n * WRITE_SLOT) || copy->size != write_len(n) ||
+        strtoul(copy->buffptr, NULL, 16) != n || copy->buffptr[copy->size - 1] != '\n')
+        return -1;
+
+    for (i = HDR_LEN; i < copy->size - 1; i++) {
+        if (copy->buffptr[i] != 'a' + (n % 26))
+            return -1;
+    }
+
+    return 0;
+}
+
+static void *reader_func(void *arg)
+{
+    struct reader *r = arg;
+    uint32_t seq;
+    size_t size, fpos, offset = 0;
+    uint64_t rnd = 88172645463325252ULL + r->id;
+    struct aesd_buffer_entry *entry, copy;
+    char out[WRITE_SLOT];
+
+    while (atomic_load(&running)) {
+        if (lockless) {
+            for (;;) {
+                seq = aesd_circular_buffer_read_begin(&buffer);
+                size = aesd_circular_buffer_size(&buffer);
+                fpos = size ? (xorshift64(&rnd) % size) : 0;
+                entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, fpos, &offset);
+                if (entry != NULL) {
+                    copy = *entry;
+                    /* must agree with the position asked for */
+                    if (aesd_circular_buffer_entry_fpos(&buffer, entry) + offset != fpos)
+                        copy.size = 0;
+                }
+                if (!aesd_circular_buffer_read_retry(&buffer, seq))
+                    break;
+                r->retries++;
+            }
+        } else {
+            pthread_mutex_lock(&lock);
+            size = aesd_circular_buffer_size(&buffer);
+            fpos = size ? (xorshift64(&rnd) % size) : 0;
+            entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, fpos, &offset);
+            if (entry != NULL) {
+                copy = *entry;
+                if (aesd_circular_buffer_entry_fpos(&buffer, entry) + offset != fpos)
+                    copy.size = 0;
+            }
+            pthread_mutex_unlock(&lock);
+        }
+
+        if (entry == NULL) {
+            r->misses++;
+            continue;
+        }
+
+        if (check(&copy, offset) != 0) {
+            r->failed = 1;
+            atomic_store(&running, 0);
+            break;
+        }
+        memcpy(out, copy.buffptr + offset, copy.size - offset);
+        r->reads++;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief One timed run with a fresh buffer.
+ *
+ * @return int 0 on success or -1 if a reader saw an inconsistent entry
+ */
+static int run(int use_lockless, int nreaders, long duration_ms, struct aesd_buffer_entry *entries,
+               uint32_t capacity)
+{
+    int i, failed = 0;
+    unsigned long reads = 0, retries = 0, misses = 0;
+    uint64_t t0, elapsed;
+    pthread_t writer;
+    struct reader readers[MAX_READERS];
+
+    if (aesd_circular_buffer_init_capacity(&buffer, entries, capacity, 0) != 0)
+        return -1;
+
+    lockless = use_lockless;
+    atomic_store(&running, 1);
+    memset(readers, 0, sizeof(readers));
+
+    t0 = now_ns();
+    pthread_create(&writer, NULL, writer_func, NULL);
+    for (i = 0; i < nreaders; i++) {
+        readers[i].id = i;
+        pthread_create(&readers[i].tid, NULL, reader_func, &readers[i]);
+    }
+
+    while (atomic_load(&running) && now_ns() - t0 < (uint64_t) duration_ms * 1000000)
+        usleep(1000);
+    atomic_store(&running, 0);
+
+    pthread_join(writer, NULL);
+    for (i = 0; i < nreaders; i++) {
+        pthread_join(readers[i].tid, NULL);
+        reads += readers[i].reads;
+        retries += readers[i].retries;
+        misses += readers[i].misses;
+        failed |= readers[i].failed;
+    }
+    elapsed = now_ns() - t0;
+
+    printf("%-9s %7d %10lu %12.0f %10lu %10lu %s\n", use_lockless ? "lockless" : "mutex",
+           nreaders, nwrites, reads / (elapsed / 1e9), retries, misses, failed ? "FAILED" : "ok");
+
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, rc = 0, nreaders = 4;
+    long duration_ms = 1000, capacity = 1024;
+    const char *mode = "both";
+    struct aesd_buffer_entry *entries;
+
+    max_writes = 1L << 20;
+    interval_ns = 1000;
+
+    while ((opt = getopt(argc, argv, "m:r:d:c:w:i:")) != -1) {
+        switch (opt) {
+        case 'm': mode = optarg; break;
+        case 'r': nreaders = atoi(optarg); break;
+        case 'd': duration_ms = atol(optarg); break;
+        case 'c': capacity = atol(optarg); break;
+        case 'w': max_writes = atol(optarg); break;
+        case 'i': interval_ns = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-m lockless|mutex|both] [-r readers] [-d ms] [-c capacity]\n"
+                    "       [-w max writes] [-i ns between writes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (nreaders < 1 || nreaders > MAX_READERS || duration_ms < 1 || capacity < 1 ||
+        capacity > (1L << 24) || (capacity & (capacity - 1)) != 0 || max_writes < 1 || interval_ns < 0 ||
+        (strcmp(mode, "lockless") != 0 && strcmp(mode, "mutex") != 0 && strcmp(mode, "both") != 0)) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    arena = malloc((size_t) max_writes * WRITE_SLOT);
+    entries = calloc(capacity, sizeof(struct aesd_buffer_entry));
+    if (arena == NULL || entries == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("%-9s %7s %10s %12s %10s %10s\n", "mode", "readers", "writes", "reads/s", "retries",
+           "misses");
+
+    if (strcmp(mode, "mutex") != 0 && run(1, nreaders, duration_ms, entries, capacity) != 0)
+        rc = 1;
+    if (strcmp(mode, "lockless") != 0 && run(0, nreaders, duration_ms, entries, capacity) != 0)
+        rc = 1;
+
+    if (rc != 0)
+        fprintf(stderr, "a lookup returned an inconsistent entry\n");
+
+    free(entries);
+    free(arena);
+
+    return rc;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file    commitbench.c
+ *
+ * @brief   Concurrent writers appending packets to a file, one write() per
+ *          packet under the writers' mutex vs. the group committer.
+ *
+ * With -y every direct write and every batch is followed by fdatasync().
+ *
+ * Usage: commitbench [-f file] [-n packets] [-s packet size] [-g max batch]
+ *                    [-l max wait us] [-y]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "tail.h"
+
+#define MAX_WRITERS     256
+
+/* globals of aesdsocket.c used by the modules under test */
+const char *log_file = "/var/tmp/commitbench";
+volatile sig_atomic_t caught_signal = 0;
+size_t echo_block_len = ECHO_BLOCK_LEN;
+
+static int sync_writes = 0;
+
+int write_packet(int log_file_fd, const char *pkt, size_t len, pthread_mutex_t *mutex)
+{
+    ssize_t rc;
+
+    pthread_mutex_lock(mutex);
+    rc = write(log_file_fd, pkt, len);
+    if (rc > 0)
+        tail_append(pkt, rc);
+    pthread_mutex_unlock(mutex);
+
+    if (sync_writes && fdatasync(log_file_fd) != 0)
+        return -1;
+
+    return (rc == len) ? 0 : -1;
+}
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int fd;
+static size_t per_writer, pkt_len;
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void *writer(void *arg)
+{
+    size_t i;
+    char *pkt;
+
+    pkt = malloc(pkt_len);
+    if (pkt == NULL)
+        return NULL;
+    memset(pkt, 'a' + (int) (long) arg % 26, pkt_len - 1);
+    pkt[pkt_len - 1] = '\n';
+
+    for (i = 0; i < per_writer; i++)
+        if (commit_write(fd, pkt, pkt_len, &mutex) != 0)
+            break;
+
+    free(pkt);
+
+    return NULL;
+}
+
+static double run(int nwriters, size_t total)
+{
+    int i;
+    double t0;
+    pthread_t tids[MAX_WRITERS];
+
+    if (ftruncate(fd, 0) != 0)
+        return 0;
+
+    per_writer = total / nwriters;
+
+    t0 = now_s();
+    for (i = 0; i < nwriters; i++)
+        pthread_create(&tids[i], NULL, writer, (void *) (long) i);
+    for (i = 0; i < nwriters; i++)
+        pthread_join(tids[i], NULL);
+
+    return (per_writer * nwriters) / (now_s() - t0);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, w;
+    size_t total = 200000, batch = COMMIT_MAX_BATCH;
+    long wait_us = 50;
+    double direct;
+
+    pkt_len = 64;
+
+    while ((opt = getopt(argc, argv, "f:n:s:g:l:y")) != -1) {
+        switch (opt) {
+        case 'f': log_file = optarg; break;
+        case 'n': total = strtoul(optarg, NULL, 0); break;
+        case 's': pkt_len = strtoul(optarg, NULL, 0); break;
+        case 'g': batch = strtoul(optarg, NULL, 0); break;
+        case 'l': wait_us = atol(optarg); break;
+        case 'y': sync_writes = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-f file] [-n packets] [-s packet size] [-g max batch] "
+                    "[-l max wait us] [-y]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    fd = open(log_file, (O_CREAT | O_TRUNC | O_APPEND | O_RDWR), 0644);
+    if (fd == -1 || pkt_len < 1 || tail_init(TAIL_LOG_LEN) != 0) {
+        perror(log_file);
+        return 1;
+    }
+
+    printf("%8s %14s %14s %14s\n", "writers", "direct pkt/s", "group pkt/s", "group+wait");
+
+    for (w = 1; w <= MAX_WRITERS; w *= 4) {
+        direct = run(w, total);
+        printf("%8d %14.0f", w, direct);
+
+        commit_start(&mutex, batch, 0, sync_writes);
+        printf(" %14.0f", run(w, total));
+        commit_stop();
+
+        commit_start(&mutex, batch, wait_us, sync_writes);
+        printf(" %14.0f\n", run(w, total));
+        commit_stop();
+    }
+
+    close(fd);
+    unlink(log_file);
+    tail_cleanup();
+
+    return 0;
+}
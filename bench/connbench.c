@@ -0,0 +1,203 @@
+/**
+ * @file    connbench.c
+ *
+ * @brief   Connection-rate benchmark for aesdsocket.
+ *
+ * Every client thread repeatedly connects to the server, sends a single
+ * packet, half-closes the socket and reads the echo until the server
+ * closes the connection. The time from connect() to the final recv() is
+ * recorded as the connection latency.
+ *
+ * Usage: connbench [-h host] [-p port] [-c clients] [-n connections] [-s size]
+ *
+ * The echo grows with the log, so compare server modes against a freshly
+ * started server each time (see run-connbench.sh).
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#define MAX_BUF_LEN     65536
+
+struct client {
+    pthread_t tid;
+    struct sockaddr_in sa;
+    const char *pkt;
+    size_t pkt_len;
+    int nconn;
+    double *lat;        /* per connection latency, in microseconds */
+    int failed;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Run a single connect/send/echo cycle.
+ *
+ * @param c client
+ * @return int 0 on success or -1 on failure
+ */
+static int one_connection(struct client *c)
+{
+    int fd;
+    ssize_t rc;
+    size_t off = 0;
+    char buf[MAX_BUF_LEN];
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *) &c->sa, sizeof(c->sa)) != 0)
+        goto error;
+
+    while (off != c->pkt_len) {
+        rc = send(fd, c->pkt + off, c->pkt_len - off, MSG_NOSIGNAL);
+        if (rc == -1)
+            goto error;
+        off += rc;
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    while ((rc = recv(fd, buf, sizeof(buf), 0)) > 0)
+        ;
+    if (rc == -1)
+        goto error;
+
+    close(fd);
+    return 0;
+
+error:
+    close(fd);
+    return -1;
+}
+
+static void *client_func(void *thread_param)
+{
+    int i;
+    double t0;
+    struct client *c = (struct client *) thread_param;
+
+    for (i = 0; i < c->nconn; i++) {
+        t0 = now_us();
+        if (one_connection(c) != 0) {
+            c->failed++;
+            c->lat[i] = -1;
+            continue;
+        }
+        c->lat[i] = now_us() - t0;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, j, opt, n = 0, failed = 0;
+    int nclients = 8, nconn = 1000;
+    size_t size = 32;
+    const char *host = "127.0.0.1";
+    int port = 9000;
+    struct client *clients;
+    double *lat, t0, elapsed;
+    char *pkt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:n:s:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': nclients = atoi(optarg); break;
+        case 'n': nconn = atoi(optarg); break;
+        case 's': size = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-c clients] [-n connections] [-s size]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (nclients < 1 || nconn < nclients || size < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    pkt = malloc(size);
+    clients = calloc(nclients, sizeof(struct client));
+    lat = calloc(nconn, sizeof(double));
+    if (pkt == NULL || clients == NULL || lat == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(pkt, 'a', size - 1);
+    pkt[size - 1] = '\n';
+
+    t0 = now_us();
+    for (i = 0; i < nclients; i++) {
+        clients[i].sa.sin_family = AF_INET;
+        clients[i].sa.sin_port = htons(port);
+        inet_pton(AF_INET, host, &clients[i].sa.sin_addr);
+        clients[i].pkt = pkt;
+        clients[i].pkt_len = size;
+        clients[i].nconn = nconn / nclients + (i < (nconn % nclients));
+        clients[i].lat = lat + n;
+        n += clients[i].nconn;
+        pthread_create(&clients[i].tid, NULL, client_func, &clients[i]);
+    }
+
+    for (i = 0; i < nclients; i++) {
+        pthread_join(clients[i].tid, NULL);
+        failed += clients[i].failed;
+    }
+    elapsed = now_us() - t0;
+
+    /* drop failed connections before computing percentiles */
+    for (i = 0, j = 0; i < nconn; i++)
+        if (lat[i] >= 0)
+            lat[j++] = lat[i];
+    qsort(lat, j, sizeof(double), cmp_double);
+
+    printf("connections %d failed %d clients %d size %zu\n", nconn, failed, nclients, size);
+    printf("conn/s %.0f\n", j / (elapsed / 1e6));
+    if (j > 0)
+        printf("latency us p50 %.0f p99 %.0f max %.0f\n",
+               lat[j / 2], lat[(j * 99) / 100], lat[j - 1]);
+
+    free(lat);
+    free(clients);
+    free(pkt);
+
+    return failed ? 1 : 0;
+}
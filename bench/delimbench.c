@@ -0,0 +1,138 @@
+/**
+ * @file    delimbench.c
+ *
+ * @brief   Micro-benchmark of the delimiter search implementations.
+ *
+ * Finds every '\n' of a buffer made of fixed-length lines with strchr(),
+ * memchr() and each delim_scan() implementation supported by the CPU.
+ *
+ * Usage: delimbench [-s buffer size] [-r rounds]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "delim.h"
+
+#define MAX_DELIMS      32
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static size_t count_strchr(const char *buf, size_t len)
+{
+    size_t n = 0;
+    const char *p = buf;
+
+    while ((p = strchr(p, '\n')) != NULL) {
+        n++;
+        p++;
+    }
+
+    return n;
+}
+
+static size_t count_memchr(const char *buf, size_t len)
+{
+    size_t n = 0;
+    const char *p = buf, *end = buf + len;
+
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        n++;
+        p++;
+    }
+
+    return n;
+}
+
+static size_t count_delim_scan(const char *buf, size_t len)
+{
+    size_t n = 0, off = 0, scanned;
+    size_t pos[MAX_DELIMS];
+
+    while (off < len) {
+        n += delim_scan(buf + off, len - off, '\n', pos, MAX_DELIMS, &scanned);
+        off += scanned;
+    }
+
+    return n;
+}
+
+static void run(const char *name, size_t (*count)(const char *, size_t),
+                const char *buf, size_t len, int rounds)
+{
+    int i;
+    size_t n = 0;
+    double t0, t;
+
+    t0 = now_s();
+    for (i = 0; i < rounds; i++)
+        n += count(buf, len);
+    t = now_s() - t0;
+
+    printf(" %8s %7.2f GB/s (%zu)", name, ((double) len * rounds / t) / 1e9, n / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, rounds = 20;
+    size_t size = 16 << 20, line, i;
+    char *buf;
+
+    while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+        switch (opt) {
+        case 's': size = strtoul(optarg, NULL, 0); break;
+        case 'r': rounds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-s buffer size] [-r rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    buf = malloc(size + 1);
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    for (line = 4; line <= 65536; line *= 4) {
+        for (i = 0; i < size; i++)
+            buf[i] = ((i % line) == (line - 1)) ? '\n' : 'a';
+        buf[size] = '\0';       /* for strchr() */
+
+        printf("line %6zu:", line);
+        run("strchr", count_strchr, buf, size, rounds);
+        run("memchr", count_memchr, buf, size, rounds);
+        if (delim_set_impl(DELIM_IMPL_GENERIC) == 0)
+            run("generic", count_delim_scan, buf, size, rounds);
+        if (delim_set_impl(DELIM_IMPL_SSE2) == 0)
+            run("sse2", count_delim_scan, buf, size, rounds);
+        if (delim_set_impl(DELIM_IMPL_AVX2) == 0)
+            run("avx2", count_delim_scan, buf, size, rounds);
+        printf("\n");
+    }
+
+    free(buf);
+
+    return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file    echobench.c
+ *
+ * @brief   Echo latency of aesdsocket as a function of the log size.
+ *
+ * Grows the log to each history size with one large filler packet, then
+ * times a number of single-packet connections, each of which gets the
+ * whole history echoed back. Start every run against an empty log.
+ *
+ * With -s the timed packets are sent by one subscribed connection
+ * instead, which only gets back the bytes just appended.
+ *
+ * Usage: echobench [-h host] [-p port] [-r rounds] [-m max history] [-s]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define MAX_BUF_LEN     65536
+#define SUBSCRIBE_CMD   "AESDSOCKET_SUBSCRIBE\n"
+
+static struct sockaddr_in sa;
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Send one packet and read the echo until the server closes.
+ *
+ * @return ssize_t number of bytes echoed, or -1 on failure
+ */
+static ssize_t transact(const char *pkt, size_t len)
+{
+    int fd;
+    ssize_t rc, total = 0;
+    size_t off = 0;
+    char buf[MAX_BUF_LEN];
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0)
+        goto error;
+
+    while (off != len) {
+        rc = send(fd, pkt + off, len - off, MSG_NOSIGNAL);
+        if (rc == -1)
+            goto error;
+        off += rc;
+    }
+    shutdown(fd, SHUT_WR);
+
+    while ((rc = recv(fd, buf, sizeof(buf), 0)) > 0)
+        total += rc;
+    if (rc == -1)
+        goto error;
+
+    close(fd);
+    return total;
+
+error:
+    close(fd);
+    return -1;
+}
+
+/**
+ * @brief Receive exactly len bytes.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int recv_len(int fd, size_t len)
+{
+    ssize_t rc;
+    char buf[MAX_BUF_LEN];
+
+    while (len != 0) {
+        rc = recv(fd, buf, (len < sizeof(buf)) ? len : sizeof(buf), 0);
+        if (rc <= 0)
+            return -1;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Open a subscribed connection and skip the history.
+ *
+ * @return int socket, or -1 on failure
+ */
+static int subscribe(size_t history)
+{
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+        send(fd, SUBSCRIBE_CMD, strlen(SUBSCRIBE_CMD), MSG_NOSIGNAL) == -1 ||
+        recv_len(fd, history) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, rounds = 50, sub = 0, fd;
+    const char *host = "127.0.0.1";
+    int port = 9000;
+    size_t max = 1 << 20, history = 0, target;
+    ssize_t rc;
+    char *filler;
+    double *lat, t0, sum;
+
+    while ((opt = getopt(argc, argv, "h:p:r:m:s")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 'm': max = strtoul(optarg, NULL, 0); break;
+        case 's': sub = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-r rounds] [-m max history] [-s]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, host, &sa.sin_addr);
+
+    filler = malloc(max);
+    lat = calloc(rounds, sizeof(double));
+    if (filler == NULL || lat == NULL || rounds < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    printf("%10s %12s %12s\n", "history", "avg us", "p99 us");
+
+    for (target = 1024; target <= max; target *= 4) {
+        /* the timed packets below grow the log by 2 bytes each */
+        if (target > history + 2) {
+            memset(filler, 'f', target - history - 1);
+            filler[target - history - 2] = '\n';
+            rc = transact(filler, target - history - 1);
+            if (rc == -1) {
+                perror("filler");
+                return 1;
+            }
+            history = rc;
+        }
+
+        fd = -1;
+        if (sub) {
+            fd = subscribe(history);
+            if (fd == -1) {
+                perror("subscribe");
+                return 1;
+            }
+        }
+
+        sum = 0;
+        for (i = 0; i < rounds; i++) {
+            t0 = now_us();
+            if (sub) {
+                rc = (send(fd, "x\n", 2, MSG_NOSIGNAL) == 2 && recv_len(fd, 2) == 0) ?
+                     (ssize_t) history + 2 : -1;
+            } else {
+                rc = transact("x\n", 2);
+            }
+            lat[i] = now_us() - t0;
+            if (rc == -1) {
+                perror("echo");
+                return 1;
+            }
+            history = rc;
+            sum += lat[i];
+        }
+
+        if (fd != -1)
+            close(fd);
+
+        qsort(lat, rounds, sizeof(double), cmp_double);
+        printf("%10zu %12.0f %12.0f\n", history, sum / rounds, lat[(rounds * 99) / 100]);
+    }
+
+    free(lat);
+    free(filler);
+
+    return 0;
+}
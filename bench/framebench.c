@@ -0,0 +1,158 @@
+/**
+ * @file    framebench.c
+ *
+ * @brief   Micro-benchmark of the aesdsocket packet framer.
+ *
+ * Feeds large packets to the framer in fixed-size chunks, as recv() would
+ * deliver them, and compares it with the previous approach of appending
+ * every chunk to a message buffer and rescanning it from the start with
+ * strchr(). The legacy scan is quadratic in the packet size, so it is
+ * skipped where it would take too long.
+ *
+ * Usage: framebench [-s packet size] [-n packets]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "framer.h"
+
+#define LEGACY_MAX_WORK         4e9     /* bytes rescanned by strchr */
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/**
+ * @brief The receive path before the framer: grow by chunk + 1, append
+ * and rescan every line from the start of the message.
+ *
+ * @return size_t number of packets seen, including duplicates
+ */
+static size_t legacy_feed(const char *stream, size_t total, size_t chunk)
+{
+    char *msg = NULL, *start, *end;
+    size_t msg_size = 0, msg_len = 0, off, rc, seen = 0;
+
+    for (off = 0; off < total; off += rc) {
+        rc = (total - off < chunk) ? (total - off) : chunk;
+
+        if ((msg_size - msg_len) < rc) {
+            msg_size += (rc + 1);
+            msg = (char *) realloc(msg, msg_size);
+            memset(msg + msg_len, 0, msg_size - msg_len);
+        }
+        memcpy(msg + msg_len, stream + off, rc);
+        msg_len += rc;
+
+        start = msg;
+        while ((end = strchr(start, '\n')) != NULL) {
+            seen++;
+            start = end + 1;
+        }
+    }
+
+    free(msg);
+
+    return seen;
+}
+
+static size_t framer_feed(const char *stream, size_t total, size_t chunk)
+{
+    struct framer f;
+    size_t off, rc, avail, len, seen = 0;
+    char *buf;
+
+    framer_init(&f);
+
+    for (off = 0; off < total; off += rc) {
+        rc = (total - off < chunk) ? (total - off) : chunk;
+
+        buf = framer_reserve(&f, rc, &avail);
+        memcpy(buf, stream + off, rc);
+        framer_commit(&f, rc);
+
+        while (framer_next(&f, &len) != NULL)
+            seen++;
+    }
+
+    framer_free(&f);
+
+    return seen;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i;
+    size_t size = 4 << 20, npkt = 2, total, chunk, seen;
+    char *stream;
+    double t0, t;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's': size = strtoul(optarg, NULL, 0); break;
+        case 'n': npkt = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-s packet size] [-n packets]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (size < 1 || npkt < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    total = size * npkt;
+    stream = malloc(total);
+    if (stream == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(stream, 'a', total);
+    for (i = 1; i <= npkt; i++)
+        stream[(i * size) - 1] = '\n';
+
+    printf("%zu packets of %zu bytes\n", npkt, size);
+    printf("%8s %14s %10s %14s %10s\n", "chunk", "framer MB/s", "packets", "legacy MB/s", "packets");
+
+    for (chunk = 1; chunk <= 65536; chunk *= 4) {
+        t0 = now_s();
+        seen = framer_feed(stream, total, chunk);
+        t = now_s() - t0;
+        printf("%8zu %14.1f %10zu", chunk, (total / t) / 1e6, seen);
+
+        if (((double) total / chunk) * (total / 2.0) > LEGACY_MAX_WORK) {
+            printf(" %14s %10s\n", "skipped", "-");
+            continue;
+        }
+
+        t0 = now_s();
+        seen = legacy_feed(stream, total, chunk);
+        t = now_s() - t0;
+        printf(" %14.1f %10zu\n", (total / t) / 1e6, seen);
+    }
+
+    free(stream);
+
+    return 0;
+}
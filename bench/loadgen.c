@@ -0,0 +1,557 @@
+/**
+ * @file    loadgen.c
+ *
+ * @brief   Load generator for aesdsocket.
+ *
+ * A transaction is one aesdsocket exchange: connect, send a packet,
+ * half-close and read the echo until the server closes. Each thread
+ * drives its share of the connection slots from an epoll loop with
+ * non-blocking sockets.
+ *
+ *  - closed loop (default): a slot starts its next transaction as soon
+ *    as the previous one completes;
+ *  - open loop (-r rate): transactions are scheduled at a fixed rate,
+ *    and latency is measured from the scheduled start, so a server
+ *    falling behind is charged for the queueing it causes instead of
+ *    slowing the offered load down (no coordinated omission).
+ *
+ * Packet sizes follow -s: a fixed size "N", uniform "MIN-MAX" or
+ * exponential "exp:MEAN". With -k a percentage of the transactions
+ * sends an AESDCHAR_IOCSEEKTO command instead of a data packet.
+ *
+ * Latencies go to log-linear histograms (HdrHistogram-style, under 1%
+ * error) which are merged over the threads. -P prints the whole
+ * percentile distribution.
+ *
+ * The echo grows with the log, so compare server modes against a freshly
+ * started server each time (see run-loadgen.sh).
+ *
+ * Usage: loadgen [-h host] [-p port] [-t threads] [-c connections]
+ *                [-d seconds] [-n transactions] [-r rate/s] [-s sizes]
+ *                [-k seek %] [-P]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#define MAX_BUF_LEN     65536
+#define MAX_PKT_LEN     (1 << 20)
+#define MAX_EVENTS      64
+#define DRAIN_NS        5000000000ULL   /* wait for in-flight transactions at the end */
+
+/* histogram: 2^HIST_SUB_BITS linear buckets per power of two */
+#define HIST_SUB_BITS   8
+#define HIST_SUB        (1U << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT  36      /* values up to 2^44 ns, about 4.8 hours */
+#define HIST_LEN        (HIST_SUB + (HIST_MAX_SHIFT * (HIST_SUB / 2)))
+#define HIST_TICKS      5       /* printed percentiles per halving distance */
+
+enum dist {
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_EXP,
+};
+
+enum slot_state {
+    SLOT_IDLE,
+    SLOT_CONNECT,
+    SLOT_SEND,
+    SLOT_RECV,
+};
+
+struct hist {
+    uint64_t counts[HIST_LEN];
+    uint64_t total;
+    uint64_t max;
+};
+
+struct slot {
+    int fd;
+    enum slot_state state;
+    uint64_t start;     /* intended start, in ns */
+    const char *pkt;
+    size_t len;
+    size_t off;
+};
+
+struct worker {
+    pthread_t tid;
+    int epfd;
+    int nslots;
+    struct slot *slots;
+    uint64_t interval;  /* ns between starts, 0 for closed loop */
+    uint64_t next;      /* next scheduled start */
+    uint64_t limit;     /* transactions this worker may start */
+    uint64_t started;
+    uint64_t done;
+    uint64_t errors;
+    uint64_t bytes;     /* echoed bytes received */
+    uint64_t rng;
+    char *pkt;          /* MAX_PKT_LEN bytes of payload */
+    char cmd[64];
+    struct hist hist;
+};
+
+static struct sockaddr_in sa;
+static enum dist dist = DIST_FIXED;
+static size_t size_min = 32, size_max = 32;
+static double size_mean = 32;
+static int seek_pct;
+static uint64_t deadline;   /* stop starting transactions, in ns */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+
+    return *s;
+}
+
+static unsigned hist_index(uint64_t v)
+{
+    unsigned shift;
+
+    if (v < HIST_SUB)
+        return v;
+
+    shift = (63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+    if (shift > HIST_MAX_SHIFT)
+        return HIST_LEN - 1;
+
+    /* v >> shift lies in [HIST_SUB / 2, HIST_SUB) */
+    return HIST_SUB + ((shift - 1) * (HIST_SUB / 2)) + ((v >> shift) - (HIST_SUB / 2));
+}
+
+/* highest value counted in a bucket */
+static uint64_t hist_value(unsigned i)
+{
+    unsigned shift;
+
+    if (i < HIST_SUB)
+        return i;
+
+    shift = ((i - HIST_SUB) / (HIST_SUB / 2)) + 1;
+
+    return ((((i - HIST_SUB) % (HIST_SUB / 2)) + (HIST_SUB / 2) + 1) << shift) - 1;
+}
+
+static void hist_record(struct hist *h, uint64_t v)
+{
+    h->counts[hist_index(v)]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src)
+{
+    unsigned i;
+
+    for (i = 0; i < HIST_LEN; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+static uint64_t hist_percentile(const struct hist *h, double p)
+{
+    unsigned i;
+    uint64_t seen = 0, want;
+
+    want = (uint64_t) ceil((p / 100.0) * h->total);
+    if (want == 0)
+        want = 1;
+
+    for (i = 0; i < HIST_LEN; i++) {
+        seen += h->counts[i];
+        if (seen >= want)
+            return (hist_value(i) < h->max) ? hist_value(i) : h->max;
+    }
+
+    return h->max;
+}
+
+/**
+ * @brief Print the percentile distribution like HdrHistogram's
+ * outputPercentileDistribution(), HIST_TICKS percentiles for every
+ * halving of the distance to 100%, values in microseconds.
+ */
+static void hist_print(const struct hist *h)
+{
+    int t;
+    double half, q;
+
+    printf("%12s %14s %14s\n", "Value(us)", "Percentile", "1/(1-Percentile)");
+    for (half = 1.0; (1.0 - half) * h->total < h->total - 1; half /= 2) {
+        for (t = 0; t < HIST_TICKS; t++) {
+            q = 1.0 - half + ((half / 2) * t / HIST_TICKS);
+            printf("%12.3f %14.12f %14.2f\n", hist_percentile(h, q * 100) / 1e3, q, 1.0 / (1.0 - q));
+        }
+    }
+    printf("%12.3f %14.12f\n", h->max / 1e3, 1.0);
+}
+
+static size_t pick_size(struct worker *w)
+{
+    double u;
+    size_t len;
+
+    switch (dist) {
+    case DIST_UNIFORM:
+        return size_min + (xorshift(&w->rng) % (size_max - size_min + 1));
+    case DIST_EXP:
+        u = (xorshift(&w->rng) >> 11) * (1.0 / 9007199254740992.0);
+        len = (size_t) (-log(1.0 - u) * size_mean);
+        return (len < 1) ? 1 : ((len > MAX_PKT_LEN) ? MAX_PKT_LEN : len);
+    default:
+        return size_min;
+    }
+}
+
+static void slot_close(struct worker *w, struct slot *s)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->fd = -1;
+    s->state = SLOT_IDLE;
+}
+
+/**
+ * @brief Start a transaction in an idle slot.
+ *
+ * @param w worker
+ * @param s idle slot
+ * @param start intended start time
+ */
+static void slot_start(struct worker *w, struct slot *s, uint64_t start)
+{
+    struct epoll_event ev;
+
+    w->started++;
+    s->start = start;
+    s->off = 0;
+
+    if (seek_pct > 0 && (int) (xorshift(&w->rng) % 100) < seek_pct) {
+        s->len = snprintf(w->cmd, sizeof(w->cmd), "AESDCHAR_IOCSEEKTO:%u,%u\n",
+                          (unsigned) (xorshift(&w->rng) % 10), 0U);
+        s->pkt = w->cmd;
+    } else {
+        s->len = pick_size(w);
+        /* the payload ends in '\n' wherever it is cut */
+        s->pkt = w->pkt + (MAX_PKT_LEN - s->len);
+    }
+
+    s->fd = socket(AF_INET, (SOCK_STREAM | SOCK_NONBLOCK), 0);
+    if (s->fd == -1)
+        goto error;
+
+    if (connect(s->fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 && errno != EINPROGRESS) {
+        close(s->fd);
+        goto error;
+    }
+
+    s->state = SLOT_CONNECT;
+    ev.events = (EPOLLIN | EPOLLOUT);
+    ev.data.ptr = s;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, s->fd, &ev) != 0) {
+        slot_close(w, s);
+        goto error;
+    }
+
+    return;
+
+error:
+    s->fd = -1;
+    s->state = SLOT_IDLE;
+    w->errors++;
+    w->done++;
+}
+
+/**
+ * @brief Advance a transaction on a socket event.
+ *
+ * @param w worker
+ * @param s busy slot
+ */
+static void slot_run(struct worker *w, struct slot *s)
+{
+    ssize_t rc;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct epoll_event ev;
+    char buf[MAX_BUF_LEN];
+
+    if (s->state == SLOT_CONNECT) {
+        if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+            goto error;
+        s->state = SLOT_SEND;
+    }
+
+    if (s->state == SLOT_SEND) {
+        while (s->off != s->len) {
+            rc = send(s->fd, s->pkt + s->off, s->len - s->off, MSG_NOSIGNAL);
+            if (rc == -1) {
+                if (errno == EAGAIN)
+                    return;
+                goto error;
+            }
+            s->off += rc;
+        }
+
+        shutdown(s->fd, SHUT_WR);
+        s->state = SLOT_RECV;
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+    }
+
+    while ((rc = recv(s->fd, buf, sizeof(buf), 0)) > 0)
+        w->bytes += rc;
+    if (rc == -1) {
+        if (errno == EAGAIN)
+            return;
+        goto error;
+    }
+
+    hist_record(&w->hist, now_ns() - s->start);
+    w->done++;
+    slot_close(w, s);
+    return;
+
+error:
+    w->errors++;
+    w->done++;
+    slot_close(w, s);
+}
+
+static void *worker_func(void *thread_param)
+{
+    int i, n, timeout;
+    uint64_t now, stop = 0;
+    struct worker *w = (struct worker *) thread_param;
+    struct epoll_event events[MAX_EVENTS];
+
+    w->next = now_ns();
+
+    for (;;) {
+        now = now_ns();
+
+        /* start whatever is due in the idle slots */
+        for (i = 0; i < w->nslots; i++) {
+            if (now >= deadline || w->started == w->limit)
+                break;
+            if (w->slots[i].state != SLOT_IDLE)
+                continue;
+            if (w->interval == 0) {
+                slot_start(w, &w->slots[i], now);
+            } else if (w->next <= now) {
+                slot_start(w, &w->slots[i], w->next);
+                w->next += w->interval;
+            }
+        }
+
+        if (now >= deadline || w->started == w->limit) {
+            if (w->done == w->started)
+                break;
+            if (stop == 0)
+                stop = now + DRAIN_NS;
+            else if (now >= stop)
+                break;
+        }
+
+        timeout = 100;
+        if (w->interval != 0 && w->next > now && (w->next - now) / 1000000 < (uint64_t) timeout)
+            timeout = (w->next - now) / 1000000;
+
+        n = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        for (i = 0; i < n; i++)
+            slot_run(w, (struct slot *) events[i].data.ptr);
+    }
+
+    /* whatever is still in flight counts as failed */
+    for (i = 0; i < w->nslots; i++) {
+        if (w->slots[i].state != SLOT_IDLE) {
+            slot_close(w, &w->slots[i]);
+            w->errors++;
+            w->done++;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Parse a size distribution: "N", "MIN-MAX" or "exp:MEAN".
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int parse_sizes(const char *arg)
+{
+    char *end;
+
+    if (strncmp(arg, "exp:", 4) == 0) {
+        dist = DIST_EXP;
+        size_mean = strtod(arg + 4, &end);
+        return (*end == '\0' && size_mean >= 1) ? 0 : -1;
+    }
+
+    size_min = size_max = strtoul(arg, &end, 0);
+    if (*end == '-') {
+        dist = DIST_UNIFORM;
+        size_max = strtoul(end + 1, &end, 0);
+    }
+
+    return (*end == '\0' && size_min >= 1 && size_min <= size_max && size_max <= MAX_PKT_LEN) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, j, opt, nthreads = 4, nconns = 32, print = 0;
+    double seconds = 10, rate = 0;
+    uint64_t ntxn = 0, done = 0, errors = 0, bytes = 0, t0;
+    const char *host = "127.0.0.1";
+    int port = 9000;
+    struct worker *workers, *w;
+    struct hist *all;
+    double elapsed;
+
+    while ((opt = getopt(argc, argv, "h:p:t:c:d:n:r:s:k:P")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'c': nconns = atoi(optarg); break;
+        case 'd': seconds = atof(optarg); break;
+        case 'n': ntxn = strtoull(optarg, NULL, 0); break;
+        case 'r': rate = atof(optarg); break;
+        case 's':
+            if (parse_sizes(optarg) != 0) {
+                fprintf(stderr, "invalid size distribution %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'k': seek_pct = atoi(optarg); break;
+        case 'P': print = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-t threads] [-c connections]\n"
+                    "       [-d seconds] [-n transactions] [-r rate/s] [-s N|MIN-MAX|exp:MEAN]\n"
+                    "       [-k seek %%] [-P]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (nthreads < 1 || nconns < nthreads || seconds <= 0 || rate < 0 ||
+        seek_pct < 0 || seek_pct > 100) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &sa.sin_addr) != 1) {
+        fprintf(stderr, "invalid host %s\n", host);
+        return 1;
+    }
+
+    workers = calloc(nthreads, sizeof(struct worker));
+    all = calloc(1, sizeof(struct hist));
+    if (workers == NULL || all == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    t0 = now_ns();
+    deadline = t0 + (uint64_t) (seconds * 1e9);
+
+    for (i = 0; i < nthreads; i++) {
+        w = &workers[i];
+        w->nslots = nconns / nthreads + (i < (nconns % nthreads));
+        w->slots = calloc(w->nslots, sizeof(struct slot));
+        w->pkt = malloc(MAX_PKT_LEN);
+        w->epfd = epoll_create1(0);
+        if (w->slots == NULL || w->pkt == NULL || w->epfd == -1) {
+            perror("worker");
+            return 1;
+        }
+        for (j = 0; j < w->nslots; j++)
+            w->slots[j].fd = -1;
+        memset(w->pkt, 'a', MAX_PKT_LEN - 1);
+        w->pkt[MAX_PKT_LEN - 1] = '\n';
+        w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        w->interval = (rate > 0) ? (uint64_t) ((1e9 * nthreads) / rate) : 0;
+        w->limit = (ntxn > 0) ? (ntxn / nthreads + ((uint64_t) i < (ntxn % nthreads))) : UINT64_MAX;
+
+        if (pthread_create(&w->tid, NULL, worker_func, w) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        hist_merge(all, &workers[i].hist);
+        done += workers[i].done;
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+        close(workers[i].epfd);
+        free(workers[i].slots);
+        free(workers[i].pkt);
+    }
+    elapsed = (now_ns() - t0) / 1e9;
+
+    printf("%s loop, threads %d, connections %d", (rate > 0) ? "open" : "closed", nthreads, nconns);
+    if (rate > 0)
+        printf(", offered %.0f txn/s", rate);
+    printf("\ntransactions %" PRIu64 " errors %" PRIu64 " in %.2f s\n", done, errors, elapsed);
+    printf("throughput %.0f txn/s, echo %.1f MB/s\n", (done - errors) / elapsed, bytes / elapsed / 1e6);
+
+    if (all->total > 0) {
+        printf("latency us p50 %.0f p90 %.0f p99 %.0f p99.9 %.0f p99.99 %.0f max %.0f\n",
+               hist_percentile(all, 50) / 1e3, hist_percentile(all, 90) / 1e3,
+               hist_percentile(all, 99) / 1e3, hist_percentile(all, 99.9) / 1e3,
+               hist_percentile(all, 99.99) / 1e3, all->max / 1e3);
+        if (print)
+            hist_print(all);
+    }
+
+    free(all);
+    free(workers);
+
+    return 0;
+}
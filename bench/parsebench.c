@@ -0,0 +1,129 @@
+/**
+ * @file    parsebench.c
+ *
+ * @brief   Per-line cost of recognizing AESDCHAR_IOCSEEKTO:X,Y, the former
+ *          regcomp()/regexec()/sscanf() per packet vs. command_parse().
+ *
+ * Usage: parsebench [-n lines] [-s seek command every n lines]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <regex.h>
+
+#include "command.h"
+
+#define NLINES          4
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/**
+ * @brief The parser aesdsocket used to run for every packet.
+ */
+static int parse_regex(const char *pkt, size_t len, uint32_t *args)
+{
+    int rc;
+    regex_t preg;
+    regmatch_t pmatch;
+    char *pattern = "(AESDCHAR_IOCSEEKTO).*";
+
+    if ((rc = regcomp(&preg, pattern, REG_EXTENDED)) != 0)
+        return -1;
+
+    pmatch.rm_so = 0;
+    pmatch.rm_eo = len;
+    if ((rc = regexec(&preg, pkt, 1, &pmatch, REG_STARTEND)) == 0)
+        sscanf(pkt, "AESDCHAR_IOCSEEKTO:%u,%u", &args[0], &args[1]);
+
+    regfree(&preg);
+
+    return (rc == 0) ? 1 : 0;
+}
+
+static int parse_table(const char *pkt, size_t len, uint32_t *args)
+{
+    struct command cmd;
+
+    if (command_parse(pkt, len, &cmd) != CMD_SEEKTO)
+        return 0;
+    args[0] = cmd.args[0];
+    args[1] = cmd.args[1];
+
+    return 1;
+}
+
+static void run(const char *name, int (*parse)(const char *, size_t, uint32_t *),
+                const char **lines, long n, long every)
+{
+    long i, hits = 0;
+    uint32_t args[2], sum = 0;
+    const char *pkt;
+    double t0, t;
+
+    t0 = now_s();
+    for (i = 0; i < n; i++) {
+        pkt = (every > 0 && (i % every) == 0) ? lines[0] : lines[1 + (i % (NLINES - 1))];
+        if (parse(pkt, strlen(pkt), args) == 1) {
+            hits++;
+            sum += args[0] + args[1];
+        }
+    }
+    t = now_s() - t0;
+
+    printf("%8s %10.1f ns/line %12.0f lines/s (%ld seeks, %u)\n",
+           name, (t * 1e9) / n, n / t, hits, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    long n = 1000000, every = 10;
+    const char *lines[NLINES] = {
+        "AESDCHAR_IOCSEEKTO:2,5\n",
+        "hello world\n",
+        "timestamp: 2023, Mar, 02, 10:00:00\n",
+        "a somewhat longer line of log data sent by one of the clients\n",
+    };
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n': n = atol(optarg); break;
+        case 's': every = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n lines] [-s seek command every n lines]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (n < 1) {
+        fprintf(stderr, "invalid number of lines\n");
+        return 1;
+    }
+
+    run("regex", parse_regex, lines, n / 10, every);
+    run("table", parse_table, lines, n, every);
+
+    return 0;
+}
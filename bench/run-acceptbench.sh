@@ -0,0 +1,31 @@
+#!/bin/bash
+# Accept-rate scaling of the SO_REUSEPORT mode: for 1..N event loops,
+# each pinned to a CPU with its own listener, run connbench against a
+# freshly started server. The shared-listener epoll mode with the same
+# number of loops is run alongside for comparison.
+#
+# Usage: ./run-acceptbench.sh [max loops, default nproc] [connbench arguments]
+
+cd `dirname $0`
+
+server=../server/aesdsocket
+log=/var/tmp/aesdsocketdata
+max=${1:-`nproc`}
+shift
+
+make -s connbench || exit 1
+
+for n in `seq 1 ${max}`; do
+    for mode in epoll reuseport; do
+        rm -f ${log}
+        ${server} -m ${mode} -t ${n} -k 1024 &
+        pid=$!
+        sleep 1
+
+        echo "== mode ${mode} loops ${n}"
+        ./connbench "$@"
+
+        kill -INT ${pid}
+        wait ${pid}
+    done
+done
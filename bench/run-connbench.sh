@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compare connections/sec and latency percentiles of the aesdsocket
+# server modes. Every mode runs against a freshly started server so the
+# echoed log has the same size in each run.
+#
+# Usage: ./run-connbench.sh [connbench arguments]
+
+cd `dirname $0`
+
+server=../server/aesdsocket
+log=/var/tmp/aesdsocketdata
+
+make -s connbench || exit 1
+
+for mode in thread epoll pool uring; do
+    rm -f ${log}
+    ${server} -m ${mode} &
+    pid=$!
+    sleep 1
+
+    echo "== mode ${mode}"
+    ./connbench "$@"
+
+    kill -INT ${pid}
+    wait ${pid}
+done
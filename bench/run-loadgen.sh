@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compare throughput and latency percentiles of the aesdsocket server
+# modes under loadgen. Every mode runs against a freshly started server
+# so the echoed log grows the same way in each run.
+#
+# Usage: ./run-loadgen.sh [loadgen arguments]
+
+cd `dirname $0`
+
+server=../server/aesdsocket
+log=/var/tmp/aesdsocketdata
+
+make -s loadgen || exit 1
+
+for mode in thread epoll pool uring reuseport; do
+    rm -f ${log}
+    ${server} -m ${mode} -k 1024 &
+    pid=$!
+    sleep 1
+
+    echo "== mode ${mode}"
+    ./loadgen "$@"
+
+    kill -INT ${pid}
+    wait ${pid}
+done
@@ -0,0 +1,22 @@
+#!/bin/bash
+# Measure how long each aesdsocket server mode takes to shut down with
+# many connections open, some of them in the middle of an exchange.
+#
+# Usage: ./run-shutbench.sh [shutbench arguments]
+
+cd `dirname $0`
+
+server=../server/aesdsocket
+log=/var/tmp/aesdsocketdata
+
+make -s shutbench || exit 1
+
+for mode in thread epoll pool uring reuseport; do
+    # a pool serves one connection per worker
+    args="-k 2048"
+    [ ${mode} = pool ] && args="${args} -t 2048"
+
+    rm -f ${log}
+    echo "== mode ${mode}"
+    ./shutbench "$@" -- ${server} -m ${mode} ${args}
+done
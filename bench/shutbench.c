@@ -0,0 +1,344 @@
+/**
+ * @file    shutbench.c
+ *
+ * @brief   Shutdown latency benchmark for aesdsocket.
+ *
+ * Starts the server command given after "--", opens -c idle connections
+ * and -w connections that send a packet right before the server gets
+ * SIGTERM, as clients in the middle of an exchange would. It then
+ * reports how long after the signal the server closed the connections
+ * and exited, and how many of the in-flight packets were still echoed.
+ *
+ * The listen backlog of the server must hold the connections being
+ * opened and a pool needs a worker for each, pass it -k and -t
+ * accordingly (see run-shutbench.sh).
+ *
+ * Usage: shutbench [-p port] [-c connections] [-w in-flight] -- server [args]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#define _GNU_SOURCE     /* memmem() */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_BUF_LEN     65536
+#define MAX_EVENTS      64
+#define START_MS        5000    /* how long the server may take to listen */
+#define EXIT_MS         30000   /* how long it may take to exit, then SIGKILL */
+
+struct client {
+    int fd;
+    int inflight;       /* sent a packet right before the signal */
+    char pkt[32];
+    char *echo;         /* what an in-flight client got back */
+    size_t len;
+    uint64_t closed;    /* ns after the signal, 0 while open */
+};
+
+static struct sockaddr_in sa;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static int tcp_connect(void)
+{
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief One complete exchange, which the server only gets to once it
+ * has accepted every connection opened before it.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int probe(void)
+{
+    int fd;
+    char buf[MAX_BUF_LEN];
+    ssize_t rc;
+    struct timeval tv = { .tv_sec = START_MS / 1000 };
+
+    fd = tcp_connect();
+    if (fd == -1)
+        return -1;
+
+    /* a pool without a free worker never gets to it */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (send(fd, "probe\n", 6, MSG_NOSIGNAL) != 6 || shutdown(fd, SHUT_WR) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    while ((rc = recv(fd, buf, sizeof(buf), 0)) > 0)
+        ;
+    close(fd);
+
+    return (rc == 0) ? 0 : -1;
+}
+
+/**
+ * @brief Read what the server sends until it closes the connection.
+ *
+ * @param c client
+ * @param t0 time of the signal
+ */
+static void client_read(struct client *c, uint64_t t0)
+{
+    char buf[MAX_BUF_LEN];
+    char *echo;
+    ssize_t rc;
+
+    for (;;) {
+        rc = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (rc > 0) {
+            if (!c->inflight)
+                continue;
+            echo = realloc(c->echo, c->len + rc);
+            if (echo == NULL)
+                continue;
+            memcpy(echo + c->len, buf, rc);
+            c->echo = echo;
+            c->len += rc;
+            continue;
+        }
+        if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (rc == -1 && errno == EINTR)
+            continue;
+
+        /* EOF or reset, either way the server is done with it */
+        c->closed = now_ns() - t0;
+        if (c->closed == 0)
+            c->closed = 1;
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i, n, opt, status, port = 9000;
+    int nidle = 1000, ninflight = 10, nclients, open_clients, echoed = 0;
+    pid_t pid;
+    uint64_t t0, exited = 0, *lat;
+    struct client *clients, *c;
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct rlimit rl;
+    int epfd;
+
+    while ((opt = getopt(argc, argv, "p:c:w:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'c': nidle = atoi(optarg); break;
+        case 'w': ninflight = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-c connections] [-w in-flight] -- server [args]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    nclients = nidle + ninflight;
+    if (nidle < 0 || ninflight < 0 || nclients < 1 || optind >= argc) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    /* every connection is a descriptor on both sides */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t) nclients + 64) {
+        fprintf(stderr, "%d connections need more than %lu descriptors\n", nclients,
+                (unsigned long) rl.rlim_cur);
+        return 1;
+    }
+
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    clients = calloc(nclients, sizeof(struct client));
+    lat = calloc(nclients, sizeof(uint64_t));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (clients == NULL || lat == NULL || epfd == -1) {
+        perror("setup");
+        return 1;
+    }
+
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(argv[optind], &argv[optind]);
+        perror(argv[optind]);
+        _exit(127);
+    }
+
+    /* wait for the server to listen */
+    t0 = now_ns();
+    while (probe() != 0) {
+        if (now_ns() - t0 > START_MS * 1000000ULL || waitpid(pid, &status, WNOHANG) == pid) {
+            fprintf(stderr, "server did not start\n");
+            kill(pid, SIGKILL);
+            return 1;
+        }
+        usleep(10000);
+    }
+
+    for (i = 0; i < nclients; i++) {
+        c = &clients[i];
+        c->inflight = (i >= nidle);
+        snprintf(c->pkt, sizeof(c->pkt), "inflight %d\n", i - nidle);
+        c->fd = tcp_connect();
+        if (c->fd == -1) {
+            perror("connect");
+            kill(pid, SIGKILL);
+            return 1;
+        }
+
+        ev.events = (EPOLLIN | EPOLLRDHUP);
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) != 0) {
+            perror("epoll_ctl");
+            kill(pid, SIGKILL);
+            return 1;
+        }
+    }
+
+    /* accepted in order, so every connection above is now being served */
+    if (probe() != 0) {
+        fprintf(stderr, "probe failed\n");
+        kill(pid, SIGKILL);
+        return 1;
+    }
+
+    for (i = nidle; i < nclients; i++) {
+        c = &clients[i];
+        if (send(c->fd, c->pkt, strlen(c->pkt), MSG_NOSIGNAL) == -1)
+            perror("send");
+    }
+
+    t0 = now_ns();
+    kill(pid, SIGTERM);
+
+    /* wait for the server to close everything, or to be killed */
+    open_clients = nclients;
+    while (open_clients > 0 && exited == 0) {
+        n = epoll_wait(epfd, events, MAX_EVENTS, 10);
+        for (i = 0; i < n; i++) {
+            c = (struct client *) events[i].data.ptr;
+            client_read(c, t0);
+            if (c->fd == -1)
+                open_clients--;
+        }
+
+        if (waitpid(pid, &status, WNOHANG) == pid)
+            exited = now_ns() - t0;
+        else if (now_ns() - t0 > EXIT_MS * 1000000ULL)
+            break;
+    }
+
+    /* a dead server leaves nothing open */
+    for (i = 0; i < nclients && exited != 0; i++) {
+        if (clients[i].fd != -1)
+            client_read(&clients[i], t0);
+    }
+
+    while (exited == 0) {
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            exited = now_ns() - t0;
+        } else if (now_ns() - t0 > EXIT_MS * 1000000ULL) {
+            fprintf(stderr, "server still running after %d ms, killing it\n", EXIT_MS);
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            exited = now_ns() - t0;
+        } else {
+            usleep(1000);
+        }
+    }
+
+    n = 0;
+    for (i = 0; i < nclients; i++) {
+        c = &clients[i];
+        if (c->closed != 0)
+            lat[n++] = c->closed;
+        if (c->inflight && c->echo != NULL && memmem(c->echo, c->len, c->pkt, strlen(c->pkt)) != NULL)
+            echoed++;
+        if (c->fd != -1)
+            close(c->fd);
+        free(c->echo);
+    }
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+
+    printf("connections %d idle, %d in flight\n", nidle, ninflight);
+    if (n > 0)
+        printf("closed after ms p50 %.1f p99 %.1f max %.1f, %d of %d\n",
+               lat[n / 2] / 1e6, lat[(n * 99) / 100] / 1e6, lat[n - 1] / 1e6, n, nclients);
+    printf("in-flight packets echoed %d/%d\n", echoed, ninflight);
+    printf("server exited after %.1f ms, ", exited / 1e6);
+    if (WIFEXITED(status))
+        printf("status %d\n", WEXITSTATUS(status));
+    else
+        printf("signal %d\n", WTERMSIG(status));
+
+    close(epfd);
+    free(lat);
+    free(clients);
+
+    return 0;
+}
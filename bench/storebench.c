@@ -0,0 +1,204 @@
+/**
+ * @file    storebench.c
+ *
+ * @brief   Concurrent writers appending packets to each log backend
+ *          through storage_apply(), as the server does: the regular file
+ *          and the char device with one write() per packet under the
+ *          writers' mutex, the in-memory log and the memory-mapped file.
+ *
+ * The char device column is skipped if the device does not exist. The
+ * in-memory log flushes to the regular file, and the mapped file syncs,
+ * every -F milliseconds while the writers run.
+ *
+ * Usage: storebench [-f file] [-d device] [-n packets] [-s packet size]
+ *                   [-F flush ms]
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "storage.h"
+#include "command.h"
+#include "memlog.h"
+#include "tail.h"
+
+#define MAX_WRITERS     256
+
+/* globals of aesdsocket.c used by the modules under test */
+const char *log_file;
+volatile sig_atomic_t caught_signal = 0;
+size_t echo_block_len = ECHO_BLOCK_LEN;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct storage_handle *handle;
+static size_t per_writer, pkt_len;
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* write_packet() of aesdsocket.c, without the metrics */
+int write_packet(int log_file_fd, const char *pkt, size_t len, pthread_mutex_t *mutex)
+{
+    ssize_t rc;
+
+    pthread_mutex_lock(mutex);
+    rc = write(log_file_fd, pkt, len);
+    if (rc > 0)
+        tail_append(pkt, rc);
+    pthread_mutex_unlock(mutex);
+
+    return (rc == len) ? 0 : -1;
+}
+
+static void *writer(void *arg)
+{
+    size_t i;
+    char *pkt;
+    off_t rc = 0;
+    struct command cmd = { .id = CMD_NONE };
+
+    pkt = malloc(pkt_len);
+    if (pkt == NULL)
+        return NULL;
+    memset(pkt, 'a' + (int) (long) arg % 26, pkt_len - 1);
+    pkt[pkt_len - 1] = '\n';
+
+    for (i = 0; i < per_writer && rc == 0; i++)
+        rc = storage_apply(handle, pkt, pkt_len, &cmd, &mutex);
+
+    free(pkt);
+
+    return NULL;
+}
+
+static double run(int nwriters, size_t total)
+{
+    int i;
+    double t0;
+    pthread_t tids[MAX_WRITERS];
+
+    per_writer = total / nwriters;
+
+    t0 = now_s();
+    for (i = 0; i < nwriters; i++)
+        pthread_create(&tids[i], NULL, writer, (void *) (long) i);
+    for (i = 0; i < nwriters; i++)
+        pthread_join(tids[i], NULL);
+
+    return (per_writer * nwriters) / (now_s() - t0);
+}
+
+/**
+ * @brief Run the writers against a fresh log of one backend.
+ *
+ * @return double packets per second, or -1 if the backend cannot start
+ */
+static double run_backend(const struct storage_ops *ops, const char *path, int nwriters,
+                          size_t total, long flush_ms)
+{
+    double rate;
+
+    log_file = path;
+    if (ops != &storage_chardev_ops)
+        unlink(log_file);
+
+    if (storage_init(ops, flush_ms) != 0)
+        return -1;
+
+    handle = storage_acquire();
+    rate = (handle != NULL) ? run(nwriters, total) : -1;
+    storage_release(handle);
+    storage_cleanup();
+
+    return rate;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, w;
+    size_t total = 200000;
+    long flush_ms = MEMLOG_FLUSH_MS;
+    const char *file = "/var/tmp/storebench";
+    const char *device = storage_chardev_ops.path;
+    double rate;
+
+    pkt_len = 64;
+
+    while ((opt = getopt(argc, argv, "f:d:n:s:F:")) != -1) {
+        switch (opt) {
+        case 'f': file = optarg; break;
+        case 'd': device = optarg; break;
+        case 'n': total = strtoul(optarg, NULL, 0); break;
+        case 's': pkt_len = strtoul(optarg, NULL, 0); break;
+        case 'F': flush_ms = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-f file] [-d device] [-n packets] [-s packet size] "
+                    "[-F flush ms]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (pkt_len < 1 || tail_init(TAIL_LOG_LEN) != 0) {
+        fprintf(stderr, "invalid packet size or out of memory\n");
+        return 1;
+    }
+
+    printf("%8s %14s %14s %14s %14s\n", "writers", "file pkt/s", "chardev pkt/s",
+           "memory pkt/s", "mmap pkt/s");
+
+    for (w = 1; w <= MAX_WRITERS; w *= 4) {
+        rate = run_backend(&storage_file_ops, file, w, total, flush_ms);
+        if (rate < 0) {
+            perror(file);
+            return 1;
+        }
+        printf("%8d %14.0f", w, rate);
+
+        /* opening would create a regular file in place of a missing device */
+        rate = (access(device, F_OK) == 0) ?
+               run_backend(&storage_chardev_ops, device, w, total, flush_ms) : -1;
+        if (rate < 0)
+            printf(" %14s", "-");
+        else
+            printf(" %14.0f", rate);
+
+        rate = run_backend(&storage_memory_ops, file, w, total, flush_ms);
+        if (rate < 0)
+            return 1;
+        printf(" %14.0f", rate);
+
+        rate = run_backend(&storage_mmap_ops, file, w, total, flush_ms);
+        if (rate < 0)
+            return 1;
+        printf(" %14.0f\n", rate);
+        fflush(stdout);
+    }
+
+    unlink(file);
+    tail_cleanup();
+
+    return 0;
+}
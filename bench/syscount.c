@@ -0,0 +1,177 @@
+/**
+ * @file    syscount.c
+ *
+ * @brief   LD_PRELOAD wrapper counting the file, socket and heap calls
+ *          of a process.
+ *
+ * The counts and the peak RSS are printed to stderr when the process
+ * exits.
+ *
+ * Usage: LD_PRELOAD=./syscount.so ../server/aesdsocket
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#define _GNU_SOURCE     /* RTLD_NEXT */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+enum {
+    CNT_OPEN,
+    CNT_CLOSE,
+    CNT_READ,
+    CNT_PREAD,
+    CNT_WRITE,
+    CNT_RECV,
+    CNT_SEND,
+    CNT_MALLOC,
+    CNT_CALLOC,
+    CNT_REALLOC,
+    CNT_MAX,
+};
+
+static const char *names[CNT_MAX] = {
+    "open", "close", "read", "pread", "write", "recv", "send",
+    "malloc", "calloc", "realloc",
+};
+
+/* glibc's own entry points, dlsym() itself allocates */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_ulong counts[CNT_MAX];
+
+#define NEXT(fn)    static __typeof__(fn) *next_##fn; \
+                    if (next_##fn == NULL) \
+                        next_##fn = (__typeof__(fn) *) dlsym(RTLD_NEXT, #fn)
+
+int open(const char *path, int flags, ...)
+{
+    va_list ap;
+    mode_t mode = 0;
+    NEXT(open);
+
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    atomic_fetch_add(&counts[CNT_OPEN], 1);
+
+    return next_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    va_list ap;
+    mode_t mode = 0;
+    NEXT(open64);
+
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    atomic_fetch_add(&counts[CNT_OPEN], 1);
+
+    return next_open64(path, flags, mode);
+}
+
+int close(int fd)
+{
+    NEXT(close);
+    atomic_fetch_add(&counts[CNT_CLOSE], 1);
+    return next_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    NEXT(read);
+    atomic_fetch_add(&counts[CNT_READ], 1);
+    return next_read(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    NEXT(pread);
+    atomic_fetch_add(&counts[CNT_PREAD], 1);
+    return next_pread(fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset)
+{
+    NEXT(pread64);
+    atomic_fetch_add(&counts[CNT_PREAD], 1);
+    return next_pread64(fd, buf, count, offset);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    NEXT(write);
+    atomic_fetch_add(&counts[CNT_WRITE], 1);
+    return next_write(fd, buf, count);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+    NEXT(recv);
+    atomic_fetch_add(&counts[CNT_RECV], 1);
+    return next_recv(fd, buf, len, flags);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    NEXT(send);
+    atomic_fetch_add(&counts[CNT_SEND], 1);
+    return next_send(fd, buf, len, flags);
+}
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add(&counts[CNT_MALLOC], 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add(&counts[CNT_CALLOC], 1);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&counts[CNT_REALLOC], 1);
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void syscount_report(void)
+{
+    int i;
+    struct rusage ru;
+
+    fprintf(stderr, "syscount:");
+    for (i = 0; i < CNT_MAX; i++)
+        fprintf(stderr, " %s %lu", names[i], atomic_load(&counts[i]));
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        fprintf(stderr, " maxrss %ld KB", ru.ru_maxrss);
+    fprintf(stderr, "\n");
+}
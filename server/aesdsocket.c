@@ -29,34 +29,28 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <regex.h>
-
-#include "aesd_ioctl.h"
+#include <poll.h>
+
+#include "aesdsocket.h"
+#include "reactor.h"
+#include "pool.h"
+#include "uring.h"
+#include "framer.h"
+#include "storage.h"
+#include "tail.h"
+#include "commit.h"
+#include "command.h"
+#include "metrics.h"
+#include "lockstat.h"
+#include "memlog.h"
+#include "shutdown.h"
 #include "queue.h"      /* taken from https://github.com/freebsd/freebsd-src/blob/main/sys/sys/queue.h */
 
-// #define DEBUG    /* un-comment this line to redirect output to stdout */
-#ifdef DEBUG
-#define SYSLOG_OPTIONS          (LOG_PERROR | LOG_NDELAY)
-#else
-#define SYSLOG_OPTIONS          (LOG_NDELAY)
-#endif
-
-#define PORT_NUMBER             9000
-#define MAX_BACKLOG             10
-#define MAX_BUF_LEN             1024
-#define FILE_MODE               0644
-#define NULL_BYTE               1
-#define TIMER_THREAD_PERIOD     10
-
-#define USE_AESD_CHAR_DEVICE    1
-
-#if (USE_AESD_CHAR_DEVICE == 1)
-const char *log_file = "/dev/aesdchar";
-#elif (USE_AESD_CHAR_DEVICE == 0)
-const char *log_file = "/var/tmp/aesdsocketdata";
-#endif
+/* the backend's own path unless -f is given */
+const char *log_file = NULL;
 
 volatile sig_atomic_t caught_signal = 0;
+size_t echo_block_len = ECHO_BLOCK_LEN;
 
 struct node {
     pthread_t tid;
@@ -69,138 +63,240 @@ struct node {
 /**
  * @brief Signal handler
  *
- * @param signo SIGINT or SIGTERM
+ * @param signo SIGINT, SIGTERM or SIGHUP (reopen *log_file)
  */
 static void signal_handler(int signo)
 {
     if (signo == SIGINT || signo == SIGTERM) {
-        caught_signal = 1;
+        shutdown_request();
         syslog(LOG_INFO, "Caught signal, exiting");
+    } else if (signo == SIGHUP) {
+        storage_request_reopen();
+    }
+}
+
+int write_packet(int log_file_fd, const char *pkt, size_t len, pthread_mutex_t *mutex)
+{
+    ssize_t rc;
+    size_t cnt = 0;
+    uint64_t t0;
+
+    while (cnt != len) {
+
+        if (lockstat_lock(mutex, LOCKSTAT_PACKET) != 0) {
+            syslog(LOG_ERR, "failed to lock mutex object before writing data to file");
+            return -1;
+        }
+
+        t0 = metrics_now_ns();
+        rc = write(log_file_fd, &pkt[cnt], len - cnt);
+        metrics_observe_write(metrics_now_ns() - t0);
+        if (rc > 0)
+            tail_append(&pkt[cnt], rc);
+
+        if (lockstat_unlock(mutex) != 0) {
+            syslog(LOG_ERR, "failed to lock mutex object after writing data to file");
+            return -1;
+        }
+
+        if (rc == -1)
+            return -1;
+
+        cnt += rc;
     }
+
+    return 0;
 }
 
 /**
- * @brief Write client packet to *log_file when a new '\n' line
- * character is found in client TCP stream and echo back the
- * packet to client. This function implements locking functions
- * using pthread mutex to synchronize access to *log_file.
+ * @brief Write a client packet to *log_file and echo back the
+ * contents of *log_file to client. This function implements locking
+ * functions using pthread mutex to synchronize access to *log_file.
  *
- * @param msg message from client
+ * @param pkt packet from client, terminated by '\n'
+ * @param len packet length, including the trailing '\n'
+ * @param cmd the packet parsed by command_parse()
  * @param fd client fd to echo data
+ * @param tx echo state of the client
  * @return int 0 on success or -1 on failure
  */
-static int process_msg(char *msg, int fd, pthread_mutex_t *mutex)
+static int process_packet(const char *pkt, size_t len, const struct command *cmd, int fd,
+                          pthread_mutex_t *mutex, struct storage_tx *tx)
 {
     int rc = 0;
-    int log_file_fd, cnt;
-    char *start, *end;
-#if (USE_AESD_CHAR_DEVICE == 0)
-    struct stat statbuf;
-    off_t offset = 0;
-#elif (USE_AESD_CHAR_DEVICE == 1)
-    regex_t preg;
-    char *pattern = "(AESDCHAR_IOCSEEKTO).*";
-    struct aesd_seekto seekto;
-#endif
-    char buf[MAX_BUF_LEN];
-
+    struct storage_handle *h;
+    off_t offset;
 
-    start = end = (char *) msg;
+    h = storage_acquire();
+    if (h == NULL)
+        return -1;
 
-    rc = open(log_file, (O_CREAT | O_APPEND | O_RDWR), FILE_MODE);
-    if (rc == -1) {
-        syslog(LOG_ERR, "failed to open %s", log_file);
-        return rc;
+    /* write packet to log file, or seek for AESDCHAR_IOCSEEKTO:X,Y */
+    offset = storage_apply(h, pkt, len, cmd, mutex);
+    if (offset == -1) {
+        rc = -1;
+        goto exit;
     }
 
-    log_file_fd = rc;
-
-    while ((end = strchr(start, '\n')) != NULL) {
-#if (USE_AESD_CHAR_DEVICE == 1)
-        /* handle AESDCHAR_IOCSEEKTO:X,Y */
-        if ((rc = regcomp(&preg, pattern, REG_EXTENDED)) != 0)
-            goto exit;
+    /* stream *log_file to the client, the socket is blocking */
+    if (storage_send(h, tx, fd, &offset) != 1)
+        rc = -1;
 
-        if ((rc = regexec(&preg, start, 0, 0, 0)) == 0) {
-            syslog(LOG_DEBUG, "found '%s' in %s", pattern, start);
-            sscanf(start, "AESDCHAR_IOCSEEKTO:%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset);
-        }
+exit:
+    storage_release(h);
 
-        regfree(&preg);
+    return rc;
+}
 
-        if (rc != REG_NOMATCH) {
-            rc = ioctl(log_file_fd, AESDCHAR_IOCSEEKTO, &seekto);
-            if (rc != 0)
-                syslog(LOG_ERR, "failed to execute ioctl command for %s", log_file);
-            goto read_device;
-        }
-#endif
-        /* write packet to log file */
-        cnt = 0;
-        while (cnt != ((end - start) + 1)) {
+/**
+ * @brief Turn a blocking client into a subscriber: echo *log_file once,
+ * then push whatever any client appends until the connection fails.
+ * Packets from the subscriber are still logged but not echoed.
+ *
+ * @param connfd client socket
+ * @param mutex serializes writers of *log_file
+ * @param rx framer holding the packets received after the command
+ * @param tx echo state of the client
+ */
+static void serve_subscriber(int connfd, pthread_mutex_t *mutex, struct framer *rx,
+                             struct storage_tx *tx)
+{
+    int peer_closed = 0;
+    ssize_t rc;
+    size_t avail, len;
+    off_t offset = 0;
+    char *buf;
+    const char *pkt;
+    struct storage_handle *h;
+    struct tail_waiter w;
+    struct tail_sub sub;
+    struct command cmd;
+    struct pollfd fds[3];
+
+    if (tail_waiter_add(&w) != 0)
+        return;
+
+    h = storage_acquire();
+    if (h == NULL)
+        goto exit;
 
-            if (pthread_mutex_lock(mutex) != 0) {
-                syslog(LOG_ERR, "failed to lock mutex object before writing data to file");
-                goto exit;
-            }
+    /* the history ends exactly where the pushed bytes start */
+    tx->end = storage_sub_init(h, &sub, &w, mutex);
 
-            rc = write(log_file_fd, &start[cnt], (((end - start) + 1) - cnt));
+    rc = (tx->end == -1) ? -1 : storage_send(h, tx, connfd, &offset);
+    storage_release(h);
+    tx->end = -1;
+    if (rc != 1)
+        goto exit_sub;
 
-            if (pthread_mutex_unlock(mutex) != 0) {
-                syslog(LOG_ERR, "failed to lock mutex object after writing data to file");
-                goto exit;
-            }
+    fds[0].fd = connfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = w.efd;
+    fds[1].events = POLLIN;
+    fds[2].fd = shutdown_fd();
+    fds[2].events = POLLIN;
 
+    while (!caught_signal) {
+        while ((pkt = framer_next(rx, &len)) != NULL) {
+            h = storage_acquire();
+            if (h == NULL)
+                goto exit_sub;
+            command_parse(pkt, len, &cmd);
+            rc = storage_apply(h, pkt, len, &cmd, mutex);
+            storage_release(h);
             if (rc == -1)
-                goto exit;
-
-            cnt += rc;
+                goto exit_sub;
         }
 
-#if (USE_AESD_CHAR_DEVICE == 0)
-        /* read file total size, in bytes */
-        rc = fstat(log_file_fd, &statbuf);
-        if (rc != 0) {
-            syslog(LOG_ERR, "failed to obtain information about %s", log_file);
-            goto exit;
+        if (tail_push(&sub, connfd) != 1)
+            break;
+
+        if (poll(fds, 3, POLL_TIMEOUT_MS) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
         }
 
-        /* read file contents and send to client */
-        memset(buf, 0, MAX_BUF_LEN);
-        cnt = 0;
-        while (cnt != statbuf.st_size) {
+        if (fds[1].revents & POLLIN)
+            tail_waiter_clear(&w);
 
-            rc = pread(log_file_fd, buf, MAX_BUF_LEN, offset);
-            if (rc == -1)
-                goto exit;
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            buf = framer_reserve(rx, MAX_BUF_LEN, &avail);
+            if (buf == NULL) {
+                syslog(LOG_ERR, "failed to allocate memory for msg");
+                break;
+            }
 
-            cnt += rc;
-            offset += rc;
+            rc = recv(connfd, buf, avail, 0);
+            if (rc == -1 && errno != EINTR)
+                break;
+            if (rc == 0)
+                peer_closed = 1;
+            if (rc > 0) {
+                metrics_add(METRIC_BYTES_IN, rc);
+                framer_commit(rx, rc);
+            }
+        }
 
-            rc = send(fd, buf, cnt, 0);
-            if (rc == -1)
-                goto exit;
+        /* a half-closed subscriber keeps following the log */
+        if (peer_closed)
+            fds[0].fd = -1;
+    }
 
-            memset(buf, 0, MAX_BUF_LEN);
+exit_sub:
+    tail_sub_free(&sub);
+exit:
+    tail_waiter_remove(&w);
+}
+
+void serve_client(int connfd, pthread_mutex_t *mutex)
+{
+    ssize_t rc;
+    size_t avail, len;
+    char *buf;
+    const char *pkt;
+    struct framer rx;
+    struct storage_tx tx;
+    struct command cmd;
+    struct shutdown_conn sc;
+
+    framer_init(&rx);
+    storage_tx_init(&tx);
+    shutdown_conn_add(&sc, connfd);
+
+    /* receive straight into the framer and process every complete packet */
+    for (;;) {
+        buf = framer_reserve(&rx, MAX_BUF_LEN, &avail);
+        if (buf == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for msg");
+            break;
         }
-#elif (USE_AESD_CHAR_DEVICE == 1)
-read_device:
-        memset(buf, 0, MAX_BUF_LEN);
-        do {
-            rc = read(log_file_fd, buf, 1);
-            if (rc == -1)
+
+        /* once shutting down, only serve what has already arrived */
+        rc = recv(connfd, buf, avail, caught_signal ? MSG_DONTWAIT : 0);
+        if (rc <= 0)
+            break;
+
+        metrics_add(METRIC_BYTES_IN, rc);
+        framer_commit(&rx, rc);
+
+        while ((pkt = framer_next(&rx, &len)) != NULL) {
+            if (command_parse(pkt, len, &cmd) == CMD_SUBSCRIBE) {
+                serve_subscriber(connfd, mutex, &rx, &tx);
                 goto exit;
-            if (send(fd, buf, rc, 0) == -1)
+            }
+            if (process_packet(pkt, len, &cmd, connfd, mutex, &tx) != 0)
                 goto exit;
-        } while (rc != 0);
-#endif
-        start = end + 1;
+        }
     }
 
 exit:
-    close(log_file_fd);
+    framer_free(&rx);
+    storage_tx_free(&tx);
 
-    return (rc != -1) ? 0 : -1;
+    shutdown_conn_remove(&sc);
+    close(connfd);
+    metrics_add(METRIC_CONN_CLOSED, 1);
 }
 
 /**
@@ -212,43 +308,16 @@ exit:
  */
 void *thread_func(void *thread_param)
 {
-    int rc;
     struct node *n = NULL;
-    char *msg = NULL;
-    int msg_size = 0;       /* total size of *msg */
-    int msg_len = 0;        /* bytes available in *msg */
-    char buf[MAX_BUF_LEN] = {};
 
     if (thread_param == NULL)
         return NULL;
 
     n = (struct node *) thread_param;
 
-    /* save every incoming data to msg buffer and search for '\n' character */
-    while (((rc = recv(n->connfd, buf, MAX_BUF_LEN, 0)) > 0) && caught_signal == 0) {
-        if ((msg_size - msg_len) < rc) {
-            msg_size += (rc + NULL_BYTE);
-
-            msg = (char *) realloc(msg, msg_size);
-            if (msg == NULL) {
-                syslog(LOG_ERR, "failed to allocate memory for msg");
-                break;
-            }
-            memset(msg + msg_len, 0, msg_size - msg_len);
-        }
-
-        memcpy(msg + msg_len, buf, rc);
-        msg_len += rc;
-
-        if (process_msg(msg, n->connfd, n->mutex) != 0)
-            break;
-    }
-
-    if (msg != NULL)
-        free(msg);
+    serve_client(n->connfd, n->mutex);
 
     n->thread_complete_success = 1;
-    close(n->connfd);
 
     return NULL;
 }
@@ -256,7 +325,8 @@ void *thread_func(void *thread_param)
 /**
  * @brief A timerthread function logs timestamp to *log_file every
  * TIMER_THREAD_PERIOD seconds. The sleep routine is based on
- * explanation from Chapter: 11 Time.
+ * explanation from Chapter: 11 Time, polling shutdown_fd() so that a
+ * shutdown does not wait for the period to end.
  *
  * @param thread_param struct node data
  * @return void* returns NULL
@@ -265,15 +335,19 @@ void *timer_thread_func(void *thread_param)
 {
     struct node *n = NULL;
     struct tm *tmp;
-    struct timespec ts;
+    struct timespec ts, now;
+    struct pollfd pfd;
+    long ms;
     time_t t;
     char outstr[MAX_BUF_LEN] = {};
-    int fd;
+    struct storage_handle *h;
 
     if (thread_param == NULL)
         return NULL;
 
     n = (struct node *) thread_param;
+    pfd.fd = shutdown_fd();
+    pfd.events = POLLIN;
 
     while (!caught_signal) {
         if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
@@ -282,9 +356,16 @@ void *timer_thread_func(void *thread_param)
         }
 
         ts.tv_sec += TIMER_THREAD_PERIOD;   /* 10 seconds */
-        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
-            syslog(LOG_ERR, "failed to sleep");
-            break;
+        /* SIGHUP interrupts the sleep, carry on sleeping until the deadline */
+        for (;;) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ms = (ts.tv_sec - now.tv_sec) * 1000 + (ts.tv_nsec - now.tv_nsec) / 1000000;
+            if (ms <= 0 || caught_signal)
+                break;
+            if (poll(&pfd, 1, ms) == -1 && errno != EINTR) {
+                syslog(LOG_ERR, "failed to sleep");
+                goto exit;
+            }
         }
 
         t = time(NULL);
@@ -301,30 +382,22 @@ void *timer_thread_func(void *thread_param)
 
         strftime(outstr, sizeof(outstr), "timestamp: %Y, %b, %d, %H:%M:%S\n", tmp);
 
-        fd = open(log_file, (O_CREAT | O_APPEND | O_RDWR), FILE_MODE);
-        if (fd == -1) {
-            syslog(LOG_ERR, "failed to open %s", log_file);
+        if (caught_signal)
             break;
-        }
 
-        if (pthread_mutex_lock(n->mutex) != 0) {
-            close(fd);
-            syslog(LOG_ERR, "failed to lock mutex object before writing timestamp");
+        h = storage_acquire();
+        if (h == NULL) {
+            syslog(LOG_ERR, "failed to open %s", log_file);
             break;
         }
 
-        if (write(fd, outstr, strlen(outstr)) == -1)
+        if (storage_append(h, outstr, strlen(outstr), n->mutex) == -1)
             syslog(LOG_ERR, "failed to write timestamp to %s", log_file);
 
-        if (pthread_mutex_unlock(n->mutex) != 0) {
-            close(fd);
-            syslog(LOG_ERR, "failed to unlock mutex object after writing timestamp");
-            break;
-        }
-
-        close(fd);
+        storage_release(h);
     }
 
+exit:
     /* we set this flag to make the parent process to join the thread */
     n->thread_complete_success = 1;
 
@@ -336,9 +409,11 @@ void *timer_thread_func(void *thread_param)
  *
  * @param sock file descriptor of listenting socket
  * @param portnum port number to bind
+ * @param backlog length of the queue of pending connections
+ * @param reuseport 1 to share the port with other SO_REUSEPORT sockets
  * @return int 0 on success or -1 on failure
  */
-static int create_listener_socket(int *sock, int portnum)
+static int create_listener_socket(int *sock, int portnum, int backlog, int reuseport)
 {
     int optval = 1;
     struct sockaddr_in sa;
@@ -353,6 +428,11 @@ static int create_listener_socket(int *sock, int portnum)
         return -1;
     }
 
+    if (reuseport && setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) != 0) {
+        syslog(LOG_ERR, "failed to set SO_REUSEPORT: %s", strerror(errno));
+        return -1;
+    }
+
     bzero((char *)&sa, sizeof(sa));
     sa.sin_family = AF_INET;
     sa.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -362,7 +442,7 @@ static int create_listener_socket(int *sock, int portnum)
         return -1;
     }
 
-    if (listen(*sock, MAX_BACKLOG) != 0) {
+    if (listen(*sock, backlog) != 0) {
         syslog(LOG_ERR, "failed to mark socket %d as passive: %s", *sock, strerror(errno));
         return -1;
     }
@@ -374,15 +454,18 @@ static int create_listener_socket(int *sock, int portnum)
  * @brief Initialize & setup resources required to run a simple TCP
  * socket server with multi-threaded support.
  *
- * @param mode 0 - normal process or 1 - daemon
+ * @param opts command-line options
  * @return int 0 on success or -1 on failure
  */
-static int aesdsocket(int *mode)
+static int aesdsocket(struct aesdsocket_opts *opts)
 {
-    int rc = -1;
-    int socket, newfd = -1;
+    int i, rc = -1;
+    int socket = -1, newfd = -1;
+    int *shards = NULL;
+    int nshards = 0;
     struct sockaddr_in addr;
     socklen_t addrlen = sizeof(addr);
+    struct pollfd pfds[2];
     struct node *n = NULL;
     struct node *n_tmp = NULL;
     pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -391,39 +474,149 @@ static int aesdsocket(int *mode)
     SLIST_HEAD(head_s, node) head;
     SLIST_INIT(&head);
 
-    rc = create_listener_socket(&socket, PORT_NUMBER);
+    if (opts->mode == MODE_REUSEPORT) {
+        /* one listener per event loop, all bound to PORT_NUMBER */
+        nshards = (opts->nthreads < 1) ? 1 : opts->nthreads;
+        shards = (int *) malloc(nshards * sizeof(int));
+        if (shards == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for listeners: %s", strerror(errno));
+            nshards = 0;
+            rc = -1;
+            goto error;
+        }
+        for (i = 0; i < nshards; i++)
+            shards[i] = -1;
+
+        for (i = 0; i < nshards; i++) {
+            rc = create_listener_socket(&shards[i], PORT_NUMBER, opts->backlog, 1);
+            if (rc == -1)
+                goto error;
+        }
+    } else {
+        rc = create_listener_socket(&socket, PORT_NUMBER, opts->backlog, 0);
+        if (rc == -1)
+            goto error;
+    }
+
+    if (opts->daemon)
+        daemon(0, 0);
+
+    /* SIGUSR1 logs the writers' mutex statistics of a -DUSE_LOCKSTAT=1 build,
+     * started before any other thread so that all of them inherit SIGUSR1
+     * blocked and leave it to the dumper */
+    rc = lockstat_start(&mutex);
     if (rc == -1)
         goto error;
 
-    if (*mode)
-        daemon(0, 0);
+    /* threads do not survive daemon(), the drain thread comes after it */
+    rc = shutdown_init(opts->drain_ms);
+    if (rc == -1)
+        goto error;
+
+    /* *log_file stays open for the lifetime of the server */
+    rc = storage_init(opts->storage, opts->flush_ms);
+    if (rc == -1)
+        goto error;
+
+    /* newest bytes of *log_file for subscribers */
+    rc = tail_init(TAIL_LOG_LEN);
+    if (rc == -1)
+        goto error;
+
+    /* clients queue their packets for a single committer thread */
+    if (opts->commit_batch > 0) {
+        rc = commit_start(&mutex, opts->commit_batch, opts->commit_wait_us,
+                          opts->commit_sync);
+        if (rc == -1)
+            goto error;
+    }
+
+    /* Prometheus scrapes on a local port or Unix socket */
+    if (opts->metrics != NULL) {
+        rc = metrics_start(opts->metrics);
+        if (rc == -1)
+            goto error;
+    }
 
-#if (USE_AESD_CHAR_DEVICE == 0)
     /* timer thread to write timestamp to *log_file */
-    n = (struct node *) calloc(1, sizeof(struct node));
-    if (n == NULL) {
-        syslog(LOG_ERR, "failed to allocate memory for timer node: %s", strerror(errno));
-        rc = -1;
+    if (opts->storage->timestamps) {
+        n = (struct node *) calloc(1, sizeof(struct node));
+        if (n == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for timer node: %s", strerror(errno));
+            rc = -1;
+            goto error;
+        }
+        n->mutex = &mutex;
+        n->thread_complete_success = 0;
+        rc = pthread_create(&n->tid, NULL, timer_thread_func, n);
+        if (rc != 0) {
+            syslog(LOG_ERR, "failed to create timer thread: %s", strerror(rc));
+            free(n);
+            rc = -1;
+            goto error;
+        }
+        SLIST_INSERT_HEAD(&head, n, nodes);
+    }
+
+    /* the rings read and write *log_file through registered descriptors,
+     * the lockless backends have none */
+    if (opts->mode == MODE_URING && opts->storage->lockless) {
+        syslog(LOG_WARNING, "io_uring needs a log descriptor, using epoll for the %s backend",
+               opts->storage->name);
+        opts->mode = MODE_EPOLL;
+    }
+
+    if (opts->mode == MODE_EPOLL) {
+        rc = reactor_run(socket, opts->nthreads, &mutex);
         goto error;
     }
-    n->mutex = &mutex;
-    n->thread_complete_success = 0;
-    rc = pthread_create(&n->tid, NULL, timer_thread_func, n);
-    if (rc != 0) {
-        syslog(LOG_ERR, "failed to create timer thread: %s", strerror(errno));
+
+    if (opts->mode == MODE_REUSEPORT) {
+        rc = reactor_run_sharded(shards, nshards, &mutex);
         goto error;
     }
-    SLIST_INSERT_HEAD(&head, n, nodes);
-#endif
+
+    if (opts->mode == MODE_URING) {
+        rc = uring_run(socket, opts->nthreads, &mutex);
+        if (rc == -1 && errno == ENOSYS) {
+            syslog(LOG_WARNING, "io_uring is not available, falling back to epoll");
+            rc = reactor_run(socket, opts->nthreads, &mutex);
+        }
+        goto error;
+    }
+
+    if (opts->mode == MODE_POOL) {
+        rc = pool_run(socket, opts->nthreads, opts->qlen, &mutex);
+        goto error;
+    }
+
+    /* a shutdown request wakes the accept loop through shutdown_fd() */
+    pfds[0].fd = socket;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = shutdown_fd();
+    pfds[1].events = POLLIN;
 
     while (!caught_signal) {
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "failed to wait for connections: %s", strerror(errno));
+            rc = -1;
+            break;
+        }
+        if (caught_signal)
+            break;
+
+        addrlen = sizeof(addr);
         newfd = accept(socket, (struct sockaddr *) &addr, &addrlen);
         if (newfd == -1) {
-            rc = -1;
+            if (errno != EINTR && errno != ECONNABORTED)
+                syslog(LOG_ERR, "failed to accept connection: %s", strerror(errno));
             goto reap_threads;
         }
 
         syslog(LOG_INFO, "Accepted connection from %s", inet_ntoa(addr.sin_addr));
+        metrics_add(METRIC_CONN_ACCEPTED, 1);
 
         /* thread per client connection */
         n = (struct node *) calloc(1, sizeof(struct node));
@@ -437,7 +630,10 @@ static int aesdsocket(int *mode)
         n->thread_complete_success = 0;
         rc = pthread_create(&n->tid, NULL, thread_func, n);
         if (rc != 0) {
-            syslog(LOG_ERR, "failed to create client thread: %s", strerror(errno));
+            syslog(LOG_ERR, "failed to create client thread: %s", strerror(rc));
+            close(newfd);
+            free(n);
+            rc = -1;
             goto error;
         }
         SLIST_INSERT_HEAD(&head, n, nodes);
@@ -455,20 +651,37 @@ reap_threads:
     }
 
 error:
+    /* every engine has returned, make sure the blocking threads stop too */
+    if (!caught_signal)
+        shutdown_request();
+
     if (socket != -1) {
         shutdown(socket, SHUT_RDWR);
         close(socket);
     }
 
-    /* delete linked-list */
+    for (i = 0; i < nshards; i++) {
+        if (shards[i] != -1)
+            close(shards[i]);
+    }
+    free(shards);
+
+    /* join every thread still running, the drain deadline bounds the wait */
     n = NULL;
     while (!SLIST_EMPTY(&head)) {
         n = SLIST_FIRST(&head);
         SLIST_REMOVE_HEAD(&head, nodes);
+        pthread_join(n->tid, NULL);
         free(n);
     }
     SLIST_INIT(&head);
 
+    metrics_stop();
+    commit_stop();
+    lockstat_stop();
+    tail_cleanup();
+    storage_cleanup();
+    shutdown_cleanup();
     pthread_mutex_destroy(&mutex);
 
     return rc;
@@ -484,21 +697,103 @@ error:
 int main(int argc, char *argv[])
 {
     int rc, opt;
-    int run_as_daemon = 0;
+    struct aesdsocket_opts opts = {
+        .daemon = 0,
+        .mode = MODE_THREAD,
+        .nthreads = sysconf(_SC_NPROCESSORS_ONLN),
+        .qlen = POOL_QUEUE_LEN,
+        .backlog = MAX_BACKLOG,
+        .commit_batch = 0,
+        .commit_wait_us = COMMIT_MAX_WAIT_US,
+        .commit_sync = 0,
+        .metrics = NULL,
+        .storage = (USE_AESD_CHAR_DEVICE == 1) ? &storage_chardev_ops : &storage_file_ops,
+        .flush_ms = MEMLOG_FLUSH_MS,
+        .drain_ms = SHUTDOWN_DRAIN_MS,
+    };
     struct sigaction sa;
 
     openlog(NULL, SYSLOG_OPTIONS, LOG_USER);
 
     /* parse command-line arguments */
-    while ((opt = getopt(argc, argv, "d")) != -1) {
+    while ((opt = getopt(argc, argv, "dm:t:q:k:b:f:cg:l:yM:B:F:D:")) != -1) {
         switch (opt) {
         case 'd':
-            run_as_daemon = 1;
+            opts.daemon = 1;
             syslog(LOG_INFO, "running %s in daemon mode", argv[0]);
             break;
+        case 'm':
+            if (strcmp(optarg, "thread") == 0) {
+                opts.mode = MODE_THREAD;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                opts.mode = MODE_EPOLL;
+            } else if (strcmp(optarg, "pool") == 0) {
+                opts.mode = MODE_POOL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                opts.mode = MODE_URING;
+            } else if (strcmp(optarg, "reuseport") == 0) {
+                opts.mode = MODE_REUSEPORT;
+            } else {
+                syslog(LOG_ERR, "unknown mode %s, expected thread, epoll, pool, uring or reuseport", optarg);
+                rc = -1;
+                goto exit;
+            }
+            break;
+        case 't':
+            opts.nthreads = atoi(optarg);
+            break;
+        case 'q':
+            opts.qlen = atoi(optarg);
+            break;
+        case 'k':
+            opts.backlog = atoi(optarg);
+            break;
+        case 'b':
+            echo_block_len = strtoul(optarg, NULL, 0);
+            if (echo_block_len == 0) {
+                syslog(LOG_ERR, "invalid echo block size %s", optarg);
+                rc = -1;
+                goto exit;
+            }
+            break;
+        case 'f':
+            log_file = optarg;
+            break;
+        case 'c':
+            storage_disable_zerocopy();
+            break;
+        case 'g':
+            opts.commit_batch = atoi(optarg);
+            break;
+        case 'l':
+            opts.commit_wait_us = atol(optarg);
+            break;
+        case 'y':
+            opts.commit_sync = 1;
+            break;
+        case 'M':
+            opts.metrics = optarg;
+            break;
+        case 'B':
+            opts.storage = storage_find(optarg);
+            if (opts.storage == NULL) {
+                syslog(LOG_ERR, "unknown backend %s, expected chardev, file, memory or mmap", optarg);
+                rc = -1;
+                goto exit;
+            }
+            break;
+        case 'F':
+            opts.flush_ms = atol(optarg);
+            break;
+        case 'D':
+            opts.drain_ms = atol(optarg);
+            break;
         }
     }
 
+    if (log_file == NULL)
+        log_file = opts.storage->path;
+
     /* set-up signal handler for SIGINT & SIGTERM */
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
@@ -516,12 +811,29 @@ int main(int argc, char *argv[])
         goto exit;
     }
 
+    /* SIGHUP must not abort blocking socket calls */
+    sa.sa_flags = SA_RESTART;
+    rc = sigaction(SIGHUP, &sa, NULL);
+    if (rc != 0) {
+        syslog(LOG_ERR, "failed to setup signal handler for SIGHUP");
+        goto exit;
+    }
+
+    /* sendfile() and splice() to a reset client must fail with EPIPE */
+    sa.sa_handler = SIG_IGN;
+    rc = sigaction(SIGPIPE, &sa, NULL);
+    if (rc != 0) {
+        syslog(LOG_ERR, "failed to ignore SIGPIPE");
+        goto exit;
+    }
+
     /* we are all set to run aesdsocket server */
-    rc = aesdsocket(&run_as_daemon);
+    rc = aesdsocket(&opts);
 
 exit:
     syslog(LOG_INFO, "Exiting aesdsocket!");
-    remove(log_file);
+    if (log_file != NULL)
+        remove(log_file);
     closelog();
 
     return rc;
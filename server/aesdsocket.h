@@ -0,0 +1,97 @@
+/**
+ * @file    aesdsocket.h
+ *
+ * @brief   Definitions shared between the aesdsocket server modules.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef AESDSOCKET_H
+#define AESDSOCKET_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "aesd_ioctl.h"
+
+// #define DEBUG    /* un-comment this line to redirect output to stdout */
+#ifdef DEBUG
+#define SYSLOG_OPTIONS          (LOG_PERROR | LOG_NDELAY)
+#else
+#define SYSLOG_OPTIONS          (LOG_NDELAY)
+#endif
+
+#define PORT_NUMBER             9000
+#define MAX_BACKLOG             10      /* default listen() backlog */
+#define MAX_BUF_LEN             1024
+#define FILE_MODE               0644
+#define NULL_BYTE               1
+#define TIMER_THREAD_PERIOD     10
+#define ECHO_BLOCK_LEN          65536   /* default read-back block size */
+#define POLL_TIMEOUT_MS         1000    /* caught_signal is checked this often */
+
+/* build with -DUSE_AESD_CHAR_DEVICE=0 to log to a regular file by
+ * default, -B picks any backend at runtime */
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE    1
+#endif
+
+#define MODE_THREAD             0   /* thread per client connection */
+#define MODE_EPOLL              1   /* edge-triggered epoll event loops */
+#define MODE_POOL               2   /* fixed-size worker thread pool */
+#define MODE_URING              3   /* io_uring rings, epoll if unavailable */
+#define MODE_REUSEPORT          4   /* pinned epoll loops, a listener each */
+
+#define POOL_QUEUE_LEN          64
+
+struct aesdsocket_opts {
+    int daemon;         /* 0 - normal process or 1 - daemon */
+    int mode;           /* one of the MODE_* engines */
+    int nthreads;       /* event-loop threads or pool workers */
+    int backlog;        /* listen() backlog of every listening socket */
+    int qlen;           /* connections waiting for a pool worker */
+    int commit_batch;   /* packets per group commit, 0 to write directly */
+    long commit_wait_us; /* how long a group commit waits to fill */
+    int commit_sync;    /* fdatasync() every group commit */
+    const char *metrics; /* metrics port or Unix socket, NULL for none */
+    const struct storage_ops *storage; /* log backend */
+    long flush_ms;      /* flush period of the memory and mmap backends */
+    long drain_ms;      /* how long connections may finish at shutdown */
+};
+
+extern const char *log_file;
+extern volatile sig_atomic_t caught_signal;
+extern size_t echo_block_len;
+
+/**
+ * @brief Append a single packet to the log file while holding mutex.
+ *
+ * @param log_file_fd descriptor of the opened log file
+ * @param pkt packet to write
+ * @param len packet length, including the trailing '\n'
+ * @param mutex serializes writers of *log_file
+ * @return int 0 on success or -1 on failure
+ */
+int write_packet(int log_file_fd, const char *pkt, size_t len, pthread_mutex_t *mutex);
+
+/**
+ * @brief Serve a blocking client connection until it is closed by the
+ * peer or, once a shutdown is requested, has no received packet left,
+ * then close connfd.
+ *
+ * @param connfd client socket
+ * @param mutex serializes writers of *log_file
+ */
+void serve_client(int connfd, pthread_mutex_t *mutex);
+
+#endif /* AESDSOCKET_H */
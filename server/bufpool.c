@@ -0,0 +1,205 @@
+/**
+ * @file    bufpool.c
+ *
+ * @brief   Pool of power-of-two receive buffers shared by all connections.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+
+#define NCLASSES                (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+#define CLASS_SIZE(c)           (BUFPOOL_MIN_SIZE << (c))
+#define CLASS_SLAB(c)           (CLASS_SIZE(c) <= (BUFPOOL_SLAB_LEN / 4))
+
+/* a free buffer links to the next one through its first bytes */
+struct chunk {
+    struct chunk *next;
+};
+
+struct freelist {
+    struct chunk *head;
+    size_t count;
+};
+
+/* per-thread free lists, flushed to the depot when the thread exits */
+static __thread struct freelist cache[NCLASSES];
+static __thread int cache_registered;
+
+static struct freelist depot[NCLASSES];
+static pthread_mutex_t depot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void list_push(struct freelist *l, struct chunk *c)
+{
+    c->next = l->head;
+    l->head = c;
+    l->count++;
+}
+
+static struct chunk *list_pop(struct freelist *l)
+{
+    struct chunk *c = l->head;
+
+    if (c != NULL) {
+        l->head = c->next;
+        l->count--;
+    }
+
+    return c;
+}
+
+/**
+ * @brief Move up to n buffers of a class from the thread cache to the
+ * depot, freeing heap-backed buffers the depot has no room for.
+ * Call with depot_mutex held.
+ */
+static void depot_put(int cls, size_t n)
+{
+    struct chunk *c;
+
+    while (n-- != 0 && (c = list_pop(&cache[cls])) != NULL) {
+        if (!CLASS_SLAB(cls) && (depot[cls].count + 1) * CLASS_SIZE(cls) > BUFPOOL_DEPOT_BYTES)
+            free(c);
+        else
+            list_push(&depot[cls], c);
+    }
+}
+
+/**
+ * @brief Refill the thread cache of a class from the depot, carving a
+ * new slab or allocating a single buffer if the depot is empty.
+ * Call with depot_mutex held.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int depot_get(int cls)
+{
+    size_t i;
+    char *slab;
+    struct chunk *c;
+
+    for (i = 0; i < (BUFPOOL_CACHE_LEN / 2) && (c = list_pop(&depot[cls])) != NULL; i++)
+        list_push(&cache[cls], c);
+
+    if (cache[cls].count != 0)
+        return 0;
+
+    if (!CLASS_SLAB(cls)) {
+        c = (struct chunk *) malloc(CLASS_SIZE(cls));
+        if (c == NULL)
+            return -1;
+        list_push(&cache[cls], c);
+        return 0;
+    }
+
+    slab = (char *) malloc(BUFPOOL_SLAB_LEN);
+    if (slab == NULL)
+        return -1;
+
+    /* the thread keeps a cache worth of the slab, the depot the rest */
+    for (i = 0; i < BUFPOOL_SLAB_LEN / CLASS_SIZE(cls); i++) {
+        c = (struct chunk *) (slab + (i * CLASS_SIZE(cls)));
+        list_push((i < BUFPOOL_CACHE_LEN / 2) ? &cache[cls] : &depot[cls], c);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Thread exit hook, hands the cached buffers to the depot.
+ */
+static void cache_flush(void *arg)
+{
+    int cls;
+
+    (void) arg;
+
+    pthread_mutex_lock(&depot_mutex);
+    for (cls = 0; cls < NCLASSES; cls++)
+        depot_put(cls, cache[cls].count);
+    pthread_mutex_unlock(&depot_mutex);
+}
+
+static void cache_key_create(void)
+{
+    pthread_key_create(&cache_key, cache_flush);
+}
+
+static void cache_register(void)
+{
+    if (!cache_registered) {
+        /* any non-NULL value makes the key run cache_flush() at exit */
+        pthread_once(&cache_once, cache_key_create);
+        pthread_setspecific(cache_key, cache);
+        cache_registered = 1;
+    }
+}
+
+char *bufpool_alloc(size_t want, size_t *size)
+{
+    int cls = 0;
+    int rc = 0;
+    char *buf;
+
+    if (want > BUFPOOL_MAX_SIZE) {
+        buf = (char *) malloc(want);
+        *size = want;
+        return buf;
+    }
+
+    while (CLASS_SIZE(cls) < want)
+        cls++;
+
+    cache_register();
+
+    if (cache[cls].count == 0) {
+        pthread_mutex_lock(&depot_mutex);
+        rc = depot_get(cls);
+        pthread_mutex_unlock(&depot_mutex);
+        if (rc != 0)
+            return NULL;
+    }
+
+    *size = CLASS_SIZE(cls);
+
+    return (char *) list_pop(&cache[cls]);
+}
+
+void bufpool_free(char *buf, size_t size)
+{
+    int cls = 0;
+
+    if (buf == NULL)
+        return;
+
+    if (size > BUFPOOL_MAX_SIZE) {
+        free(buf);
+        return;
+    }
+
+    while (CLASS_SIZE(cls) < size)
+        cls++;
+
+    cache_register();
+    list_push(&cache[cls], (struct chunk *) buf);
+
+    if (cache[cls].count > BUFPOOL_CACHE_LEN) {
+        pthread_mutex_lock(&depot_mutex);
+        depot_put(cls, BUFPOOL_CACHE_LEN / 2);
+        pthread_mutex_unlock(&depot_mutex);
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * @file    bufpool.h
+ *
+ * @brief   Pool of power-of-two receive buffers shared by all connections.
+ *
+ * Buffers from BUFPOOL_MIN_SIZE to BUFPOOL_MAX_SIZE bytes come in
+ * power-of-two size classes. Released buffers go to a free list of the
+ * releasing thread and are handed out again without touching the heap;
+ * a thread keeps at most BUFPOOL_CACHE_LEN buffers per class and moves
+ * the excess, and everything it holds when it exits, to a global depot
+ * the other threads refill from. Small classes are carved out of
+ * BUFPOOL_SLAB_LEN slabs, which are never returned to the heap.
+ * Requests above BUFPOOL_MAX_SIZE go straight to malloc().
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+#define BUFPOOL_MIN_SHIFT       10
+#define BUFPOOL_MAX_SHIFT       20
+#define BUFPOOL_MIN_SIZE        (1UL << BUFPOOL_MIN_SHIFT)
+#define BUFPOOL_MAX_SIZE        (1UL << BUFPOOL_MAX_SHIFT)
+#define BUFPOOL_SLAB_LEN        (256 * 1024)    /* classes up to a quarter are slab-backed */
+#define BUFPOOL_CACHE_LEN       16      /* buffers per class a thread keeps */
+#define BUFPOOL_DEPOT_BYTES     (8UL << 20)     /* heap-backed bytes per class in the depot */
+
+/**
+ * @brief Get a buffer of at least want bytes.
+ *
+ * @param want minimum size
+ * @param size filled with the actual size, pass it to bufpool_free()
+ * @return char* the buffer, or NULL on failure
+ */
+char *bufpool_alloc(size_t want, size_t *size);
+
+/**
+ * @brief Return a buffer to the pool.
+ *
+ * @param buf buffer from bufpool_alloc(), or NULL
+ * @param size size reported by bufpool_alloc()
+ */
+void bufpool_free(char *buf, size_t size);
+
+#endif /* BUFPOOL_H */
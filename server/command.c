@@ -0,0 +1,124 @@
+/**
+ * @file    command.c
+ *
+ * @brief   Parser for the control commands clients can send instead of
+ *          log data.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <string.h>
+
+#include "command.h"
+
+struct command_def {
+    const char *prefix;
+    size_t prefix_len;
+    enum command_id id;
+    int nargs;
+};
+
+#define COMMAND(prefix, id, nargs)  { prefix, sizeof(prefix) - 1, id, nargs }
+
+static const struct command_def commands[] = {
+    COMMAND("AESDCHAR_IOCSEEKTO:", CMD_SEEKTO, 2),
+    COMMAND("AESDSOCKET_SUBSCRIBE", CMD_SUBSCRIBE, 0),
+};
+
+/* every prefix starts with this, which rejects log data at once */
+#define COMMAND_LEAD            "AESD"
+
+/**
+ * @brief Parse an unsigned decimal that must fit 32 bits.
+ *
+ * @param p first digit, advanced past the last one
+ * @param end end of the packet
+ * @param val parsed value
+ * @return int 0 on success or -1 if there is no digit or it overflows
+ */
+static int parse_u32(const char **p, const char *end, uint32_t *val)
+{
+    const char *s = *p;
+    uint64_t v = 0;
+
+    if (s == end || *s < '0' || *s > '9')
+        return -1;
+
+    while (s != end && *s >= '0' && *s <= '9') {
+        v = (v * 10) + (*s - '0');
+        if (v > UINT32_MAX)
+            return -1;
+        s++;
+    }
+
+    *p = s;
+    *val = (uint32_t) v;
+
+    return 0;
+}
+
+/**
+ * @brief Parse the arguments and the trailing '\n' of a command.
+ *
+ * @return int 0 on success or -1 if they are malformed
+ */
+static int parse_args(const char *p, const char *end, int nargs, uint32_t *args)
+{
+    int i;
+
+    for (i = 0; i < nargs; i++) {
+        if (i != 0 && (p == end || *p++ != ','))
+            return -1;
+        if (parse_u32(&p, end, &args[i]) != 0)
+            return -1;
+    }
+
+    return (end - p == 1 && *p == '\n') ? 0 : -1;
+}
+
+enum command_id command_parse(const char *pkt, size_t len, struct command *cmd)
+{
+    size_t i;
+    const struct command_def *def;
+
+    cmd->id = CMD_NONE;
+
+    if (len < sizeof(COMMAND_LEAD) - 1 || memcmp(pkt, COMMAND_LEAD, sizeof(COMMAND_LEAD) - 1) != 0)
+        return CMD_NONE;
+
+    for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        def = &commands[i];
+        if (len < def->prefix_len || memcmp(pkt, def->prefix, def->prefix_len) != 0)
+            continue;
+
+        if (parse_args(pkt + def->prefix_len, pkt + len, def->nargs, cmd->args) != 0)
+            cmd->id = CMD_INVALID;
+        else
+            cmd->id = def->id;
+        break;
+    }
+
+    return cmd->id;
+}
+
+int command_is_data(const struct command *cmd, int seekto)
+{
+    switch (cmd->id) {
+    case CMD_SEEKTO:
+    case CMD_INVALID:
+        return !seekto;
+    case CMD_SUBSCRIBE:
+        return 0;
+    default:
+        return 1;
+    }
+}
@@ -0,0 +1,67 @@
+/**
+ * @file    command.h
+ *
+ * @brief   Parser for the control commands clients can send instead of
+ *          log data.
+ *
+ * A command is a packet made of a fixed prefix, a number of unsigned
+ * decimal arguments separated by ',' and the terminating '\n', e.g.
+ * "AESDCHAR_IOCSEEKTO:X,Y\n". The known prefixes live in a table in
+ * command.c, so adding a command is one more entry there. Parsing never
+ * allocates and looks at every byte at most once.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COMMAND_MAX_ARGS        2
+
+enum command_id {
+    CMD_INVALID = -1,   /* known prefix, malformed arguments */
+    CMD_NONE = 0,       /* log data */
+    CMD_SEEKTO,         /* AESDCHAR_IOCSEEKTO:<write_cmd>,<write_cmd_offset> */
+    CMD_SUBSCRIBE,      /* AESDSOCKET_SUBSCRIBE, see tail.h */
+};
+
+struct command {
+    enum command_id id;
+    uint32_t args[COMMAND_MAX_ARGS];
+};
+
+/**
+ * @brief Recognize a control command.
+ *
+ * @param pkt packet, terminated by '\n'
+ * @param len packet length, including the trailing '\n'
+ * @param cmd filled with the command and its arguments
+ * @return enum command_id cmd->id
+ */
+enum command_id command_parse(const char *pkt, size_t len, struct command *cmd);
+
+/**
+ * @brief Tell whether a parsed packet is written to *log_file. A
+ * backend resolving AESDCHAR_IOCSEEKTO never logs a seek command, not
+ * even a malformed one, as the regex it replaces did; one that cannot
+ * resolve it logs both as data.
+ *
+ * @param cmd command filled by command_parse()
+ * @param seekto nonzero if the backend resolves AESDCHAR_IOCSEEKTO
+ * @return int 1 if the packet is log data or 0 if it is a command
+ */
+int command_is_data(const struct command *cmd, int seekto);
+
+#endif /* COMMAND_H */
@@ -0,0 +1,292 @@
+/**
+ * @file    commit.c
+ *
+ * @brief   Group commit of client packets to *log_file.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#define _GNU_SOURCE     /* IOV_MAX */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "tail.h"
+#include "metrics.h"
+#include "lockstat.h"
+#include "queue.h"
+#include "shutdown.h"
+
+/* a packet waiting for the committer, lives on the client's stack */
+struct commit_req {
+    int fd;
+    const char *pkt;
+    size_t len;
+    int done;
+    int rc;
+    pthread_cond_t cond;
+    STAILQ_ENTRY(commit_req) reqs;
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond;     /* on CLOCK_MONOTONIC, from commit_start() */
+static STAILQ_HEAD(req_head, commit_req) queue = STAILQ_HEAD_INITIALIZER(queue);
+static size_t queued = 0;
+static atomic_int running = 0;
+static int stopping = 0;
+
+static pthread_t committer;
+static pthread_mutex_t *writers_mutex = NULL;
+static size_t batch_max = COMMIT_MAX_BATCH;
+static long wait_us = COMMIT_MAX_WAIT_US;
+static int sync_batches = 0;
+static struct commit_req **batch = NULL;
+static struct iovec *iov = NULL;
+
+/**
+ * @brief Write one batch of packets for the same descriptor while
+ * holding the writers' mutex.
+ *
+ * @param n number of packets in batch[]
+ * @return int 0 on success or -1 on failure
+ */
+static int commit_batch(size_t n)
+{
+    int fd = batch[0]->fd;
+    ssize_t rc = 0;
+    size_t i, idx = 0, written = 0, cnt;
+    uint64_t t0;
+
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = (void *) batch[i]->pkt;
+        iov[i].iov_len = batch[i]->len;
+    }
+
+    if (lockstat_lock(writers_mutex, LOCKSTAT_COMMIT) != 0) {
+        syslog(LOG_ERR, "failed to lock mutex object before writing data to file");
+        return -1;
+    }
+
+    while (idx != n) {
+        t0 = metrics_now_ns();
+        rc = writev(fd, &iov[idx], n - idx);
+        metrics_observe_write(metrics_now_ns() - t0);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        written += rc;
+
+        /* resume a partial write where it stopped */
+        while (idx != n && (size_t) rc >= iov[idx].iov_len) {
+            rc -= iov[idx].iov_len;
+            idx++;
+        }
+        if (idx != n) {
+            iov[idx].iov_base = (char *) iov[idx].iov_base + rc;
+            iov[idx].iov_len -= rc;
+        }
+    }
+
+    /* keep subscribers in *log_file order, even after a failure */
+    for (i = 0; i < n && written != 0; i++) {
+        cnt = (batch[i]->len < written) ? batch[i]->len : written;
+        tail_append(batch[i]->pkt, cnt);
+        written -= cnt;
+    }
+
+    lockstat_unlock(writers_mutex);
+
+    if (idx != n)
+        return -1;
+
+    /* the char device has nothing to flush */
+    if (sync_batches && fdatasync(fd) != 0 && errno != EINVAL) {
+        syslog(LOG_ERR, "failed to sync %s: %s", log_file, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Committer thread function.
+ *
+ * @param thread_param unused
+ * @return void* returns NULL
+ */
+static void *commit_func(void *thread_param)
+{
+    int rc;
+    size_t i, n;
+    struct commit_req *r;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&queue_lock);
+
+    for (;;) {
+        while (STAILQ_EMPTY(&queue) && !stopping)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if (STAILQ_EMPTY(&queue))
+            break;
+
+        /* give the batch a chance to fill */
+        if (wait_us > 0 && queued < batch_max && !stopping) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += (wait_us % 1000000) * 1000;
+            deadline.tv_sec += (wait_us / 1000000) + (deadline.tv_nsec / 1000000000);
+            deadline.tv_nsec %= 1000000000;
+            while (queued < batch_max && !stopping &&
+                   pthread_cond_timedwait(&queue_cond, &queue_lock, &deadline) != ETIMEDOUT)
+                ;
+        }
+
+        n = 0;
+        while (n < batch_max && (r = STAILQ_FIRST(&queue)) != NULL &&
+               (n == 0 || r->fd == batch[0]->fd)) {
+            STAILQ_REMOVE_HEAD(&queue, reqs);
+            queued--;
+            batch[n++] = r;
+        }
+
+        pthread_mutex_unlock(&queue_lock);
+        rc = commit_batch(n);
+        pthread_mutex_lock(&queue_lock);
+
+        for (i = 0; i < n; i++) {
+            batch[i]->rc = rc;
+            batch[i]->done = 1;
+            pthread_cond_signal(&batch[i]->cond);
+        }
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return NULL;
+}
+
+int commit_start(pthread_mutex_t *mutex, size_t max_batch, long max_wait_us, int sync)
+{
+    int rc;
+    pthread_condattr_t attr;
+
+    if (max_batch < 1)
+        max_batch = 1;
+    if (max_batch > IOV_MAX)
+        max_batch = IOV_MAX;
+
+    batch = (struct commit_req **) calloc(max_batch, sizeof(struct commit_req *));
+    iov = (struct iovec *) calloc(max_batch, sizeof(struct iovec));
+    if (batch == NULL || iov == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for commit batches");
+        goto error;
+    }
+
+    writers_mutex = mutex;
+    batch_max = max_batch;
+    wait_us = (max_wait_us < 0) ? 0 : max_wait_us;
+    sync_batches = sync;
+    stopping = 0;
+
+    /* a wall-clock step must not stretch or cut the batch wait */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    rc = spawn_service_thread(&committer, commit_func, NULL);
+
+    if (rc != 0) {
+        syslog(LOG_ERR, "failed to create committer thread");
+        pthread_cond_destroy(&queue_cond);
+        goto error;
+    }
+
+    atomic_store(&running, 1);
+
+    return 0;
+
+error:
+    free(batch);
+    free(iov);
+    batch = NULL;
+    iov = NULL;
+    return -1;
+}
+
+void commit_stop(void)
+{
+    pthread_mutex_lock(&queue_lock);
+    if (!atomic_load(&running)) {
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+    atomic_store(&running, 0);
+    stopping = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    pthread_join(committer, NULL);
+    pthread_cond_destroy(&queue_cond);
+
+    free(batch);
+    free(iov);
+    batch = NULL;
+    iov = NULL;
+}
+
+int commit_write(int fd, const char *pkt, size_t len, pthread_mutex_t *mutex)
+{
+    struct commit_req r = {
+        .fd = fd,
+        .pkt = pkt,
+        .len = len,
+    };
+
+    if (!atomic_load(&running))
+        return write_packet(fd, pkt, len, mutex);
+
+    pthread_mutex_lock(&queue_lock);
+
+    /* stopped in the meantime */
+    if (!atomic_load(&running)) {
+        pthread_mutex_unlock(&queue_lock);
+        return write_packet(fd, pkt, len, mutex);
+    }
+
+    pthread_cond_init(&r.cond, NULL);
+    STAILQ_INSERT_TAIL(&queue, &r, reqs);
+    queued++;
+    pthread_cond_signal(&queue_cond);
+
+    while (!r.done)
+        pthread_cond_wait(&r.cond, &queue_lock);
+
+    pthread_mutex_unlock(&queue_lock);
+    pthread_cond_destroy(&r.cond);
+
+    return r.rc;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file    commit.h
+ *
+ * @brief   Group commit of client packets to *log_file.
+ *
+ * Instead of every client taking the writers' mutex for its own write(),
+ * clients queue their packets and sleep, and a single committer thread
+ * drains whatever is pending and writes it with one writev() per batch
+ * under the mutex. Each client is woken once its packet is written, so
+ * the ordering and visibility guarantees of write_packet() still hold.
+ * Optionally each batch is made durable with one fdatasync() before its
+ * clients are woken, which is where batching pays off the most.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef COMMIT_H
+#define COMMIT_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define COMMIT_MAX_BATCH        64      /* default packets per writev() */
+#define COMMIT_MAX_WAIT_US      0       /* default wait for a batch to fill */
+
+/**
+ * @brief Start the committer thread.
+ *
+ * @param mutex serializes writers of *log_file
+ * @param max_batch most packets written by one writev(), capped at IOV_MAX
+ * @param max_wait_us how long a batch may wait for more packets once the
+ * first one is queued, 0 to write whatever is pending right away
+ * @param sync 1 to fdatasync() every batch before waking its clients
+ * @return int 0 on success or -1 on failure
+ */
+int commit_start(pthread_mutex_t *mutex, size_t max_batch, long max_wait_us, int sync);
+
+/**
+ * @brief Write what is still queued and join the committer thread.
+ */
+void commit_stop(void);
+
+/**
+ * @brief Queue a packet for the committer and wait until it is written,
+ * or write it with write_packet() while the committer is not running.
+ *
+ * @param fd descriptor of *log_file
+ * @param pkt packet to write
+ * @param len packet length, including the trailing '\n'
+ * @param mutex serializes writers of *log_file
+ * @return int 0 on success or -1 on failure
+ */
+int commit_write(int fd, const char *pkt, size_t len, pthread_mutex_t *mutex);
+
+#endif /* COMMIT_H */
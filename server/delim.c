@@ -0,0 +1,210 @@
+/**
+ * @file    delim.c
+ *
+ * @brief   Vectorized delimiter search.
+ *
+ * The vector implementations compare 16 (SSE2) or 32 (AVX2) bytes at a
+ * time against the delimiter, turn the comparison into a bit mask and
+ * walk the set bits, so the cost per byte stays flat however dense the
+ * delimiters are. They are compiled with function level target
+ * attributes, which keeps the rest of the program buildable for the
+ * baseline ISA.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DELIM_X86
+#include <immintrin.h>
+#endif
+
+#include "delim.h"
+
+typedef size_t (*scan_fn)(const char *, size_t, char, size_t *, size_t, size_t *);
+
+static size_t scan_generic(const char *buf, size_t len, char delim,
+                           size_t *pos, size_t max, size_t *scanned)
+{
+    size_t n = 0, off = 0;
+    const char *p;
+
+    while (off < len && (p = memchr(buf + off, delim, len - off)) != NULL) {
+        pos[n] = p - buf;
+        off = pos[n++] + 1;
+        if (n == max) {
+            *scanned = off;
+            return n;
+        }
+    }
+
+    *scanned = len;
+
+    return n;
+}
+
+#ifdef DELIM_X86
+/**
+ * @brief Report the delimiters of a block described by a comparison bit
+ * mask, bit i set when buf[base + i] is the delimiter.
+ *
+ * @return int 1 once pos is full, 0 otherwise
+ */
+static inline int scan_mask(unsigned int mask, size_t base,
+                            size_t *pos, size_t *n, size_t max, size_t *scanned)
+{
+    while (mask != 0) {
+        pos[*n] = base + __builtin_ctz(mask);
+        if (++(*n) == max) {
+            *scanned = pos[*n - 1] + 1;
+            return 1;
+        }
+        mask &= mask - 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finish a vector scan on the bytes left after the last full
+ * vector, starting at buf[i] with n offsets already in pos.
+ */
+static size_t scan_tail(const char *buf, size_t i, size_t len, char delim,
+                        size_t *pos, size_t n, size_t max, size_t *scanned)
+{
+    size_t k, m, tail;
+
+    m = scan_generic(buf + i, len - i, delim, pos + n, max - n, &tail);
+    for (k = n; k < n + m; k++)
+        pos[k] += i;
+    *scanned = i + tail;
+
+    return n + m;
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *buf, size_t len, char delim,
+                        size_t *pos, size_t max, size_t *scanned)
+{
+    size_t i = 0, n = 0;
+    __m128i d = _mm_set1_epi8(delim);
+    __m128i v, c0, c1, c2, c3;
+
+    /* skip runs without delimiters 64 bytes at a time */
+    for (; i + 64 <= len; i += 64) {
+        c0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + i)), d);
+        c1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + i + 16)), d);
+        c2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + i + 32)), d);
+        c3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + i + 48)), d);
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(c2, c3))) == 0)
+            continue;
+
+        if (scan_mask(_mm_movemask_epi8(c0), i, pos, &n, max, scanned) ||
+            scan_mask(_mm_movemask_epi8(c1), i + 16, pos, &n, max, scanned) ||
+            scan_mask(_mm_movemask_epi8(c2), i + 32, pos, &n, max, scanned) ||
+            scan_mask(_mm_movemask_epi8(c3), i + 48, pos, &n, max, scanned))
+            return n;
+    }
+
+    for (; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (buf + i));
+        if (scan_mask(_mm_movemask_epi8(_mm_cmpeq_epi8(v, d)), i, pos, &n, max, scanned))
+            return n;
+    }
+
+    return scan_tail(buf, i, len, delim, pos, n, max, scanned);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buf, size_t len, char delim,
+                        size_t *pos, size_t max, size_t *scanned)
+{
+    size_t i = 0, n = 0;
+    __m256i d = _mm256_set1_epi8(delim);
+    __m256i v, c0, c1, c2, c3;
+
+    /* skip runs without delimiters 128 bytes at a time */
+    for (; i + 128 <= len; i += 128) {
+        c0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + i)), d);
+        c1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + i + 32)), d);
+        c2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + i + 64)), d);
+        c3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + i + 96)), d);
+        v = _mm256_or_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c2, c3));
+        if (_mm256_testz_si256(v, v))
+            continue;
+
+        if (scan_mask(_mm256_movemask_epi8(c0), i, pos, &n, max, scanned) ||
+            scan_mask(_mm256_movemask_epi8(c1), i + 32, pos, &n, max, scanned) ||
+            scan_mask(_mm256_movemask_epi8(c2), i + 64, pos, &n, max, scanned) ||
+            scan_mask(_mm256_movemask_epi8(c3), i + 96, pos, &n, max, scanned))
+            return n;
+    }
+
+    for (; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        if (scan_mask(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, d)), i, pos, &n, max, scanned))
+            return n;
+    }
+
+    return scan_tail(buf, i, len, delim, pos, n, max, scanned);
+}
+#endif
+
+static scan_fn scan = scan_generic;
+
+int delim_set_impl(enum delim_impl impl)
+{
+    switch (impl) {
+    case DELIM_IMPL_GENERIC:
+        scan = scan_generic;
+        return 0;
+#ifdef DELIM_X86
+    case DELIM_IMPL_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2"))
+            return -1;
+        scan = scan_sse2;
+        return 0;
+    case DELIM_IMPL_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        scan = scan_avx2;
+        return 0;
+    case DELIM_IMPL_AUTO:
+        if (delim_set_impl(DELIM_IMPL_AVX2) == 0 || delim_set_impl(DELIM_IMPL_SSE2) == 0)
+            return 0;
+        scan = scan_generic;
+        return 0;
+#else
+    case DELIM_IMPL_AUTO:
+        scan = scan_generic;
+        return 0;
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* pick the implementation once, before any thread can call delim_scan() */
+__attribute__((constructor))
+static void delim_init(void)
+{
+    delim_set_impl(DELIM_IMPL_AUTO);
+}
+
+size_t delim_scan(const char *buf, size_t len, char delim,
+                  size_t *pos, size_t max, size_t *scanned)
+{
+    return scan(buf, len, delim, pos, max, scanned);
+}
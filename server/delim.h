@@ -0,0 +1,59 @@
+/**
+ * @file    delim.h
+ *
+ * @brief   Vectorized delimiter search.
+ *
+ * delim_scan() reports every occurrence of a delimiter byte in a buffer in
+ * a single pass. SSE2 and AVX2 implementations are selected at runtime on
+ * x86 CPUs which support them, every other target uses the generic
+ * implementation. The search is length bounded, NUL bytes are data.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef DELIM_H
+#define DELIM_H
+
+#include <stddef.h>
+
+enum delim_impl {
+    DELIM_IMPL_AUTO,        /* best implementation supported by the CPU */
+    DELIM_IMPL_GENERIC,
+    DELIM_IMPL_SSE2,
+    DELIM_IMPL_AVX2,
+};
+
+/**
+ * @brief Find the offsets of delim in buf, in ascending order.
+ *
+ * @param buf buffer to search
+ * @param len number of bytes to search
+ * @param delim delimiter byte
+ * @param pos filled with up to max offsets relative to buf
+ * @param max capacity of pos, at least 1
+ * @param scanned filled with the number of bytes examined: len when fewer
+ * than max delimiters were found, otherwise one past the last offset
+ * @return size_t number of offsets stored in pos
+ */
+size_t delim_scan(const char *buf, size_t len, char delim,
+                  size_t *pos, size_t max, size_t *scanned);
+
+/**
+ * @brief Force the implementation used by delim_scan(), for tests and
+ * benchmarks.
+ *
+ * @param impl implementation
+ * @return int 0 on success or -1 if the CPU does not support impl
+ */
+int delim_set_impl(enum delim_impl impl);
+
+#endif /* DELIM_H */
@@ -0,0 +1,109 @@
+/**
+ * @file    framer.c
+ *
+ * @brief   Streaming '\n' packet framer for aesdsocket client streams.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framer.h"
+#include "delim.h"
+#include "bufpool.h"
+
+void framer_init(struct framer *f)
+{
+    memset(f, 0, sizeof(struct framer));
+}
+
+void framer_free(struct framer *f)
+{
+    bufpool_free(f->buf, f->size);
+    framer_init(f);
+}
+
+char *framer_reserve(struct framer *f, size_t want, size_t *avail)
+{
+    size_t i, size, need;
+    char *buf;
+
+    /* drop packets already handed out, the move is bounded by the
+     * size of the partial packet so every byte is moved at most once
+     * per packet */
+    if (f->start != 0) {
+        memmove(f->buf, f->buf + f->start, f->len - f->start);
+        for (i = f->next_delim; i < f->ndelims; i++)
+            f->delims[i] -= f->start;
+        f->len -= f->start;
+        f->scan -= f->start;
+        f->start = 0;
+    }
+
+    if (f->size - f->len < want) {
+        /* the pool rounds up to the next power of two, but only up to
+         * BUFPOOL_MAX_SIZE, so double past it to copy each byte O(1)
+         * times however large the packet grows */
+        need = f->len + want;
+        if (need < 2 * f->size)
+            need = 2 * f->size;
+        buf = bufpool_alloc(need, &size);
+        if (buf == NULL)
+            return NULL;
+
+        if (f->len != 0)
+            memcpy(buf, f->buf, f->len);
+        bufpool_free(f->buf, f->size);
+
+        f->buf = buf;
+        f->size = size;
+    }
+
+    *avail = f->size - f->len;
+
+    return f->buf + f->len;
+}
+
+void framer_commit(struct framer *f, size_t n)
+{
+    f->len += n;
+}
+
+const char *framer_next(struct framer *f, size_t *len)
+{
+    const char *pkt;
+    size_t i, end, scanned;
+
+    if (f->next_delim == f->ndelims) {
+        if (f->scan == f->len)
+            return NULL;
+
+        /* collect the next batch of packet boundaries in one pass */
+        f->ndelims = delim_scan(f->buf + f->scan, f->len - f->scan, '\n',
+                                f->delims, FRAMER_MAX_DELIMS, &scanned);
+        for (i = 0; i < f->ndelims; i++)
+            f->delims[i] += f->scan;
+        f->next_delim = 0;
+        f->scan += scanned;
+
+        if (f->ndelims == 0)
+            return NULL;
+    }
+
+    end = f->delims[f->next_delim++];
+    pkt = f->buf + f->start;
+    *len = (end - f->start) + 1;
+    f->start = end + 1;
+
+    return pkt;
+}
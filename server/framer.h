@@ -0,0 +1,99 @@
+/**
+ * @file    framer.h
+ *
+ * @brief   Streaming '\n' packet framer for aesdsocket client streams.
+ *
+ * Received bytes are appended to a per-connection buffer and complete
+ * packets are handed out in order. A scan cursor remembers how far the
+ * buffer has been searched, so every received byte is examined once no
+ * matter how the stream is split across recv() calls. The search reports
+ * up to FRAMER_MAX_DELIMS packet boundaries per pass (see delim.h).
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef FRAMER_H
+#define FRAMER_H
+
+#include <stddef.h>
+
+#define FRAMER_MAX_DELIMS       32
+
+struct framer {
+    char *buf;
+    size_t size;        /* total size of *buf */
+    size_t start;       /* first byte not handed out yet */
+    size_t scan;        /* first byte not searched for '\n' yet */
+    size_t len;         /* bytes available in *buf */
+    size_t delims[FRAMER_MAX_DELIMS];   /* offsets of '\n' found by the last search */
+    size_t ndelims;     /* number of entries in delims */
+    size_t next_delim;  /* first entry of delims not handed out yet */
+};
+
+/**
+ * @brief Initialize an empty framer, no memory is allocated until data
+ * is received.
+ *
+ * @param f framer
+ */
+void framer_init(struct framer *f);
+
+/**
+ * @brief Release the memory held by the framer.
+ *
+ * @param f framer
+ */
+void framer_free(struct framer *f);
+
+/**
+ * @brief Make room for at least want bytes after the buffered data,
+ * compacting consumed packets away or moving to a bigger bufpool buffer.
+ * Invalidates packets returned by framer_next().
+ *
+ * @param f framer
+ * @param want minimum number of free bytes
+ * @param avail filled with the number of free bytes
+ * @return char* where to receive the next bytes, or NULL on failure
+ */
+char *framer_reserve(struct framer *f, size_t want, size_t *avail);
+
+/**
+ * @brief Account for n bytes received into the space returned by
+ * framer_reserve().
+ *
+ * @param f framer
+ * @param n number of bytes received
+ */
+void framer_commit(struct framer *f, size_t n);
+
+/**
+ * @brief Hand out the next complete packet.
+ *
+ * @param f framer
+ * @param len filled with the packet length, including the trailing '\n'
+ * @return const char* the packet, valid until the next framer_reserve(),
+ * or NULL when no complete packet is buffered
+ */
+const char *framer_next(struct framer *f, size_t *len);
+
+/**
+ * @brief Number of buffered bytes which are not part of a complete packet.
+ *
+ * @param f framer
+ * @return size_t pending bytes
+ */
+static inline size_t framer_pending(const struct framer *f)
+{
+    return f->len - f->start;
+}
+
+#endif /* FRAMER_H */
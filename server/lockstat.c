@@ -0,0 +1,242 @@
+/**
+ * @file    lockstat.c
+ *
+ * @brief   Contention statistics of the mutex serializing *log_file writers.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include "lockstat.h"
+
+#if (USE_LOCKSTAT == 1)
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LOCKSTAT_BUCKETS];
+};
+
+struct site_stats {
+    uint64_t contended;
+    struct hist wait;
+    struct hist hold;
+};
+
+static const char *site_names[LOCKSTAT_SITES] = {
+    [LOCKSTAT_PACKET] = "packet",
+    [LOCKSTAT_TIMESTAMP] = "timestamp",
+    [LOCKSTAT_SEEK] = "seek",
+    [LOCKSTAT_COMMIT] = "commit",
+    [LOCKSTAT_APPEND] = "append",
+    [LOCKSTAT_SUBSCRIBE] = "subscribe",
+};
+
+/* protected by the writers' mutex itself */
+static struct site_stats stats[LOCKSTAT_SITES];
+
+/* the mutex is held by one thread at a time, so is its owner's state */
+static __thread uint64_t held_since;
+static __thread enum lockstat_site held_site;
+
+static pthread_mutex_t *writers_mutex;
+static pthread_t dumper;
+static atomic_int dumping;
+
+static void hist_add(struct hist *h, uint64_t ns)
+{
+    int i = 0;
+
+    /* bucket i counts durations below 2^(LOCKSTAT_MIN_SHIFT + i) ns */
+    if ((ns >> LOCKSTAT_MIN_SHIFT) != 0)
+        i = 64 - __builtin_clzll(ns >> LOCKSTAT_MIN_SHIFT);
+    if (i > LOCKSTAT_BUCKETS - 1)
+        i = LOCKSTAT_BUCKETS - 1;
+
+    h->buckets[i]++;
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+/**
+ * @brief Upper bound of the bucket holding the p-th percentile.
+ *
+ * @return uint64_t bound in ns, or the maximum for the last bucket
+ */
+static uint64_t hist_percentile(const struct hist *h, unsigned int p)
+{
+    int i;
+    uint64_t seen = 0, rank = (h->count * p + 99) / 100;
+
+    for (i = 0; i < LOCKSTAT_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return 1ULL << (LOCKSTAT_MIN_SHIFT + i);
+    }
+
+    return h->max_ns;
+}
+
+static void hist_log(const char *site, const char *what, const struct hist *h)
+{
+    int i;
+    size_t off = 0;
+    char line[512];
+
+    line[0] = '\0';
+    for (i = 0; i < LOCKSTAT_BUCKETS && off < sizeof(line); i++) {
+        if (h->buckets[i] == 0)
+            continue;
+        if (i == LOCKSTAT_BUCKETS - 1)
+            off += snprintf(&line[off], sizeof(line) - off, " rest:%llu",
+                            (unsigned long long) h->buckets[i]);
+        else
+            off += snprintf(&line[off], sizeof(line) - off, " <%lluns:%llu",
+                            1ULL << (LOCKSTAT_MIN_SHIFT + i),
+                            (unsigned long long) h->buckets[i]);
+    }
+
+    syslog(LOG_INFO, "lockstat %s %s:%s", site, what, line);
+}
+
+/**
+ * @brief Log a copy of the statistics taken under the writers' mutex.
+ */
+static void lockstat_dump(void)
+{
+    int i;
+    struct site_stats snap[LOCKSTAT_SITES];
+    const struct site_stats *s;
+
+    pthread_mutex_lock(writers_mutex);
+    memcpy(snap, stats, sizeof(snap));
+    pthread_mutex_unlock(writers_mutex);
+
+    for (i = 0; i < LOCKSTAT_SITES; i++) {
+        s = &snap[i];
+        if (s->wait.count == 0)
+            continue;
+
+        syslog(LOG_INFO, "lockstat %s: %llu acquired, %llu contended, "
+               "wait avg %lluns p99 %lluns max %lluns, hold avg %lluns p99 %lluns max %lluns",
+               site_names[i], (unsigned long long) s->wait.count,
+               (unsigned long long) s->contended,
+               (unsigned long long) (s->wait.sum_ns / s->wait.count),
+               (unsigned long long) hist_percentile(&s->wait, 99),
+               (unsigned long long) s->wait.max_ns,
+               (unsigned long long) (s->hold.count ? s->hold.sum_ns / s->hold.count : 0),
+               (unsigned long long) hist_percentile(&s->hold, 99),
+               (unsigned long long) s->hold.max_ns);
+        hist_log(site_names[i], "wait", &s->wait);
+        hist_log(site_names[i], "hold", &s->hold);
+    }
+}
+
+int lockstat_lock(pthread_mutex_t *mutex, enum lockstat_site site)
+{
+    int rc, contended = 0;
+    uint64_t t0, now;
+
+    t0 = metrics_now_ns();
+    if (pthread_mutex_trylock(mutex) != 0) {
+        contended = 1;
+        rc = pthread_mutex_lock(mutex);
+        if (rc != 0)
+            return rc;
+    }
+    now = metrics_now_ns();
+
+    metrics_add(METRIC_LOCK_ACQUIRED, 1);
+    if (contended)
+        metrics_add(METRIC_LOCK_WAIT_NS, now - t0);
+
+    stats[site].contended += contended;
+    hist_add(&stats[site].wait, now - t0);
+    held_since = now;
+    held_site = site;
+
+    return 0;
+}
+
+int lockstat_unlock(pthread_mutex_t *mutex)
+{
+    hist_add(&stats[held_site].hold, metrics_now_ns() - held_since);
+
+    return pthread_mutex_unlock(mutex);
+}
+
+static void *dumper_func(void *arg)
+{
+    int sig;
+    sigset_t set;
+
+    (void) arg;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    while (sigwait(&set, &sig) == 0 && atomic_load(&dumping))
+        lockstat_dump();
+
+    return NULL;
+}
+
+int lockstat_start(pthread_mutex_t *mutex)
+{
+    int rc;
+    sigset_t set;
+
+    writers_mutex = mutex;
+
+    /* every thread created from now on leaves SIGUSR1 to the dumper, so this
+     * must run before the server creates any */
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    rc = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (rc != 0) {
+        syslog(LOG_ERR, "failed to block SIGUSR1: %s", strerror(rc));
+        return -1;
+    }
+
+    atomic_store(&dumping, 1);
+    rc = pthread_create(&dumper, NULL, dumper_func, NULL);
+    if (rc != 0) {
+        atomic_store(&dumping, 0);
+        syslog(LOG_ERR, "failed to create lockstat thread: %s", strerror(rc));
+        return -1;
+    }
+
+    return 0;
+}
+
+void lockstat_stop(void)
+{
+    if (!atomic_exchange(&dumping, 0))
+        return;
+
+    pthread_kill(dumper, SIGUSR1);
+    pthread_join(dumper, NULL);
+
+    lockstat_dump();
+}
+
+#endif /* USE_LOCKSTAT */
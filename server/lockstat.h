@@ -0,0 +1,114 @@
+/**
+ * @file    lockstat.h
+ *
+ * @brief   Contention statistics of the mutex serializing *log_file writers.
+ *
+ * Build with -DUSE_LOCKSTAT=1 to record, for every call site taking the
+ * writers' mutex, how often it had to wait and histograms of the time
+ * spent waiting for and holding the lock. The statistics are logged to
+ * syslog on SIGUSR1 and once more at exit. They are only updated with
+ * the mutex held, so they add no lock or shared atomic of their own.
+ *
+ * Without USE_LOCKSTAT, lockstat_lock() and lockstat_unlock() are inline
+ * aliases of metrics_lock() and pthread_mutex_unlock(), and SIGUSR1 keeps
+ * its default action.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <pthread.h>
+
+#include "metrics.h"
+
+#ifndef USE_LOCKSTAT
+#define USE_LOCKSTAT            0
+#endif
+
+#define LOCKSTAT_MIN_SHIFT      7       /* the first bucket is below 128ns */
+#define LOCKSTAT_BUCKETS        24      /* ..., below 2^30ns and the rest */
+
+/* places taking the writers' mutex */
+enum lockstat_site {
+    LOCKSTAT_PACKET,            /* write_packet(), one write() of a packet */
+    LOCKSTAT_TIMESTAMP,         /* timer_thread_func() */
+    LOCKSTAT_SEEK,              /* AESDCHAR_IOCSEEKTO ioctl and lseek() */
+    LOCKSTAT_COMMIT,            /* a batch of the committer thread */
+    LOCKSTAT_APPEND,            /* io_uring write completion */
+    LOCKSTAT_SUBSCRIBE,         /* snapshot of a new subscriber */
+    LOCKSTAT_SITES,
+};
+
+#if (USE_LOCKSTAT == 1)
+
+/**
+ * @brief Lock the writers' mutex from a call site.
+ *
+ * @param mutex writers' mutex, the one given to lockstat_start()
+ * @param site caller
+ * @return int 0 on success or an error number
+ */
+int lockstat_lock(pthread_mutex_t *mutex, enum lockstat_site site);
+
+/**
+ * @brief Unlock the writers' mutex, accounting the hold time to the site
+ * which locked it.
+ *
+ * @param mutex writers' mutex
+ * @return int 0 on success or an error number
+ */
+int lockstat_unlock(pthread_mutex_t *mutex);
+
+/**
+ * @brief Block SIGUSR1 and start the thread dumping the statistics when
+ * it arrives. Call before creating any other thread, they must inherit
+ * the blocked SIGUSR1.
+ *
+ * @param mutex writers' mutex
+ * @return int 0 on success or -1 on failure
+ */
+int lockstat_start(pthread_mutex_t *mutex);
+
+/**
+ * @brief Stop the dump thread and log the final statistics, no-op if not
+ * started.
+ */
+void lockstat_stop(void);
+
+#else
+
+static inline int lockstat_lock(pthread_mutex_t *mutex, enum lockstat_site site)
+{
+    (void) site;
+    return metrics_lock(mutex);
+}
+
+static inline int lockstat_unlock(pthread_mutex_t *mutex)
+{
+    return pthread_mutex_unlock(mutex);
+}
+
+static inline int lockstat_start(pthread_mutex_t *mutex)
+{
+    (void) mutex;
+    return 0;
+}
+
+static inline void lockstat_stop(void)
+{
+}
+
+#endif /* USE_LOCKSTAT */
+
+#endif /* LOCKSTAT_H */
@@ -0,0 +1,265 @@
+/**
+ * @file    memlog.c
+ *
+ * @brief   Append-only in-memory log, periodically flushed to *log_file.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "aesdsocket.h"
+#include "memlog.h"
+#include "seqlog.h"
+#include "tail.h"
+
+#define SEG_OFF(o)              ((o) & (MEMLOG_SEGMENT_LEN - 1))
+#define SEG_ADDR(o)             (segs[(o) >> MEMLOG_SEGMENT_SHIFT] + SEG_OFF(o))
+
+/* written under grow_lock before core.backed covers them */
+static char *segs[MEMLOG_MAX_SEGMENTS];
+static size_t nsegs = 0;
+static pthread_mutex_t grow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct seqlog core;
+
+static pthread_mutex_t flush_fd_lock = PTHREAD_MUTEX_INITIALIZER;  /* memlog_flush() */
+static int flush_fd = -1;
+static uint64_t flushed = 0;
+static volatile sig_atomic_t reopen_requested = 0;
+
+/**
+ * @brief Allocate segments until need bytes are backed.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int memlog_grow(uint64_t need)
+{
+    int rc = 0;
+    char *seg;
+
+    pthread_mutex_lock(&grow_lock);
+
+    while (atomic_load_explicit(&core.backed, memory_order_relaxed) < need) {
+        if (nsegs == MEMLOG_MAX_SEGMENTS) {
+            syslog(LOG_ERR, "in-memory log is full");
+            rc = -1;
+            break;
+        }
+
+        seg = (char *) malloc(MEMLOG_SEGMENT_LEN);
+        if (seg == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for log segment: %s", strerror(errno));
+            rc = -1;
+            break;
+        }
+
+        segs[nsegs++] = seg;
+        atomic_store_explicit(&core.backed, (uint64_t) nsegs << MEMLOG_SEGMENT_SHIFT,
+                              memory_order_release);
+    }
+
+    pthread_mutex_unlock(&grow_lock);
+
+    return rc;
+}
+
+/**
+ * @brief Copy between a buffer and the segments, in either direction.
+ */
+static void memlog_copy(char *buf, size_t len, uint64_t offset, int to_log)
+{
+    size_t n;
+
+    while (len != 0) {
+        n = MEMLOG_SEGMENT_LEN - SEG_OFF(offset);
+        if (n > len)
+            n = len;
+
+        if (to_log)
+            memcpy(SEG_ADDR(offset), buf, n);
+        else
+            memcpy(buf, SEG_ADDR(offset), n);
+
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Copy a packet into the segments, see struct seqlog_ops.
+ */
+static void memlog_store(uint64_t offset, const char *buf, size_t len)
+{
+    memlog_copy((char *) buf, len, offset, 1);
+}
+
+/**
+ * @brief Pass published bytes on to the tail a segment at a time, see
+ * struct seqlog_ops.
+ */
+static void memlog_publish(uint64_t from, uint64_t to)
+{
+    size_t n;
+
+    while (from != to) {
+        n = MEMLOG_SEGMENT_LEN - SEG_OFF(from);
+        if (n > to - from)
+            n = to - from;
+        tail_append(SEG_ADDR(from), n);
+        from += n;
+    }
+}
+
+static const struct seqlog_ops memlog_ops = {
+    .fetch_add = 0,
+    .grow = memlog_grow,
+    .copy = memlog_store,
+    .publish = memlog_publish,
+    .flush = memlog_flush,
+};
+
+int memlog_append(const char *buf, size_t len)
+{
+    return seqlog_append(&core, buf, len);
+}
+
+uint64_t memlog_size(void)
+{
+    return seqlog_size(&core);
+}
+
+ssize_t memlog_read(char *buf, size_t len, uint64_t offset)
+{
+    uint64_t size = memlog_size();
+
+    if (offset >= size)
+        return 0;
+    if (len > size - offset)
+        len = size - offset;
+
+    memlog_copy(buf, len, offset, 0);
+
+    return len;
+}
+
+ssize_t memlog_send(int sockfd, uint64_t offset, size_t len)
+{
+    uint64_t size = memlog_size();
+
+    if (offset >= size)
+        return 0;
+    if (len > size - offset)
+        len = size - offset;
+    if (len > MEMLOG_SEGMENT_LEN - SEG_OFF(offset))
+        len = MEMLOG_SEGMENT_LEN - SEG_OFF(offset);
+
+    return send(sockfd, SEG_ADDR(offset), len, MSG_NOSIGNAL);
+}
+
+void memlog_request_reopen(void)
+{
+    reopen_requested = 1;
+}
+
+int memlog_flush(void)
+{
+    ssize_t rc;
+    size_t n;
+    uint64_t size = memlog_size();
+
+    pthread_mutex_lock(&flush_fd_lock);
+
+    if (reopen_requested || flush_fd == -1) {
+        reopen_requested = 0;
+        rc = open(log_file, (O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC), FILE_MODE);
+        if (rc == -1) {
+            syslog(LOG_ERR, "failed to open %s: %s", log_file, strerror(errno));
+        } else {
+            if (flush_fd != -1)
+                close(flush_fd);
+            flush_fd = rc;
+        }
+        /* on failure keep flushing to the previous descriptor, if any */
+        if (flush_fd == -1)
+            goto error;
+    }
+
+    while (flushed != size) {
+        n = MEMLOG_SEGMENT_LEN - SEG_OFF(flushed);
+        if (n > size - flushed)
+            n = size - flushed;
+
+        rc = write(flush_fd, SEG_ADDR(flushed), n);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            /* try again on the next period */
+            syslog(LOG_ERR, "failed to flush to %s: %s", log_file, strerror(errno));
+            goto error;
+        }
+        flushed += rc;
+    }
+
+    /* the char device has nothing to flush */
+    if (fdatasync(flush_fd) != 0 && errno != EINVAL) {
+        syslog(LOG_ERR, "failed to sync %s: %s", log_file, strerror(errno));
+        goto error;
+    }
+
+    pthread_mutex_unlock(&flush_fd_lock);
+
+    return 0;
+
+error:
+    pthread_mutex_unlock(&flush_fd_lock);
+
+    return -1;
+}
+
+int memlog_init(long flush_ms)
+{
+    core.ops = &memlog_ops;
+
+    return seqlog_start_flusher(&core, flush_ms);
+}
+
+void memlog_cleanup(void)
+{
+    size_t i;
+
+    seqlog_stop_flusher(&core);
+
+    memlog_flush();
+    if (flush_fd != -1)
+        close(flush_fd);
+    flush_fd = -1;
+    flushed = 0;
+
+    for (i = 0; i < nsegs; i++)
+        free(segs[i]);
+    nsegs = 0;
+
+    seqlog_reset(&core, 0, 0);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file    memlog.h
+ *
+ * @brief   Append-only in-memory log, periodically flushed to *log_file.
+ *
+ * The log is a table of MEMLOG_SEGMENT_LEN segments which are allocated
+ * as it grows and never move or change once written, so readers copy or
+ * send straight from them without any lock. Writers append through
+ * seqlog: each one reserves its range with a compare-and-swap once the
+ * segments cover it, copies its packet concurrently with the other
+ * writers and has it published in sequence order. Readers only look
+ * below the published length, which therefore always ends on a packet
+ * boundary. The seqlog flusher thread appends what was published since
+ * its last run to *log_file.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef MEMLOG_H
+#define MEMLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define MEMLOG_SEGMENT_SHIFT    20
+#define MEMLOG_SEGMENT_LEN      (1UL << MEMLOG_SEGMENT_SHIFT)
+#define MEMLOG_MAX_SEGMENTS     4096    /* 4 GiB of log */
+#define MEMLOG_FLUSH_MS         1000    /* default flush period */
+
+/**
+ * @brief Start an empty log and its flusher thread.
+ *
+ * @param flush_ms flush period, 0 to flush only from memlog_cleanup()
+ * @return int 0 on success or -1 on failure
+ */
+int memlog_init(long flush_ms);
+
+/**
+ * @brief Stop the flusher, flush what is left and free the log. No
+ * writer or reader may be running.
+ */
+void memlog_cleanup(void);
+
+/**
+ * @brief Append a packet, then copy it to the subscribers' tail in log
+ * order.
+ *
+ * @param buf packet
+ * @param len packet length
+ * @return int 0 on success or -1 if the log is full or out of memory
+ */
+int memlog_append(const char *buf, size_t len);
+
+/**
+ * @brief Published length of the log.
+ *
+ * @return uint64_t bytes readers may access
+ */
+uint64_t memlog_size(void);
+
+/**
+ * @brief Copy published bytes of the log.
+ *
+ * @param buf destination
+ * @param len size of buf
+ * @param offset offset to read from
+ * @return ssize_t bytes copied, less than len only at the published end
+ */
+ssize_t memlog_read(char *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief send() published bytes straight from the segment holding offset.
+ *
+ * @param sockfd destination socket
+ * @param offset offset to send from
+ * @param len most bytes to send
+ * @return ssize_t bytes sent, 0 at the published end or -1 on failure
+ */
+ssize_t memlog_send(int sockfd, uint64_t offset, size_t len);
+
+/**
+ * @brief Append everything published since the last flush to *log_file
+ * and sync it, as the flusher thread does every period.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int memlog_flush(void);
+
+/**
+ * @brief Make the flusher open *log_file again before its next flush.
+ * Async-signal-safe.
+ */
+void memlog_request_reopen(void);
+
+#endif /* MEMLOG_H */
@@ -0,0 +1,399 @@
+/**
+ * @file    metrics.c
+ *
+ * @brief   Runtime counters of aesdsocket, exposed in Prometheus format.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "aesdsocket.h"
+#include "metrics.h"
+#include "shutdown.h"
+
+#define METRICS_BUF_LEN         8192
+#define METRICS_BACKLOG         8
+#define METRICS_RECV_TIMEOUT_MS 100
+
+__thread struct metrics_shard *metrics_self;
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(shard_head, metrics_shard) shards = LIST_HEAD_INITIALIZER(shards);
+static struct metrics_shard retired;    /* totals of exited threads */
+static struct metrics_shard fallback;   /* shared if a shard can't be allocated */
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+static int listen_fd = -1;
+static char unix_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static pthread_t server;
+static atomic_int serving;
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} descs[METRIC_MAX] = {
+    [METRIC_CONN_ACCEPTED] = { "aesdsocket_connections_accepted_total", "counter",
+                               "Client connections accepted." },
+    [METRIC_CONN_CLOSED] = { "aesdsocket_connections_closed_total", "counter",
+                             "Client connections closed." },
+    [METRIC_BYTES_IN] = { "aesdsocket_received_bytes_total", "counter",
+                          "Bytes received from clients." },
+    [METRIC_BYTES_OUT] = { "aesdsocket_sent_bytes_total", "counter",
+                           "Bytes echoed or pushed to clients." },
+    [METRIC_PACKETS] = { "aesdsocket_packets_total", "counter",
+                         "Packets appended to the log." },
+    [METRIC_SEEKS] = { "aesdsocket_seeks_total", "counter",
+                       "AESDCHAR_IOCSEEKTO commands applied." },
+    [METRIC_LOCK_ACQUIRED] = { "aesdsocket_log_lock_acquisitions_total", "counter",
+                               "Acquisitions of the log writers' mutex." },
+    [METRIC_LOCK_WAIT_NS] = { "aesdsocket_log_lock_wait_seconds_total", "counter",
+                              "Time spent waiting for the log writers' mutex." },
+};
+
+/**
+ * @brief Thread exit hook, folds the shard into the retired totals.
+ */
+static void shard_retire(void *arg)
+{
+    int i;
+    struct metrics_shard *s = (struct metrics_shard *) arg;
+
+    pthread_mutex_lock(&shards_lock);
+    for (i = 0; i < METRIC_MAX; i++)
+        retired.counters[i] += s->counters[i];
+    for (i = 0; i < METRICS_WRITE_BUCKETS; i++)
+        retired.writes[i] += s->writes[i];
+    LIST_REMOVE(s, shards);
+    pthread_mutex_unlock(&shards_lock);
+
+    free(s);
+}
+
+static void shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_retire);
+}
+
+struct metrics_shard *metrics_register(void)
+{
+    struct metrics_shard *s;
+
+    pthread_once(&shard_once, shard_key_create);
+
+    s = (struct metrics_shard *) aligned_alloc(METRICS_CACHE_LINE, sizeof(struct metrics_shard));
+    if (s == NULL)
+        return &fallback;
+    memset(s, 0, sizeof(*s));
+
+    pthread_mutex_lock(&shards_lock);
+    LIST_INSERT_HEAD(&shards, s, shards);
+    pthread_mutex_unlock(&shards_lock);
+
+    pthread_setspecific(shard_key, s);
+    metrics_self = s;
+
+    return s;
+}
+
+uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int metrics_lock(pthread_mutex_t *mutex)
+{
+    int rc;
+    uint64_t t0;
+    struct metrics_shard *s = metrics_shard();
+
+    if (pthread_mutex_trylock(mutex) != 0) {
+        t0 = metrics_now_ns();
+        rc = pthread_mutex_lock(mutex);
+        if (rc != 0)
+            return rc;
+        metrics_add_to(s, METRIC_LOCK_WAIT_NS, metrics_now_ns() - t0);
+    }
+    metrics_add_to(s, METRIC_LOCK_ACQUIRED, 1);
+
+    return 0;
+}
+
+void metrics_observe_write(uint64_t ns)
+{
+    int i = 0;
+    uint64_t us = (ns + 999) / 1000;
+    struct metrics_shard *s = metrics_shard();
+
+    /* bucket i counts writes of at most 2^i microseconds */
+    if (us > 1)
+        i = 64 - __builtin_clzll(us - 1);
+    if (i > METRICS_WRITE_BUCKETS - 1)
+        i = METRICS_WRITE_BUCKETS - 1;
+
+    __atomic_store_n(&s->writes[i], s->writes[i] + 1, __ATOMIC_RELAXED);
+    metrics_add_to(s, METRIC_WRITE_NS, ns);
+}
+
+/**
+ * @brief Add the relaxed reads of a shard to the totals.
+ */
+static void shard_sum(struct metrics_shard *sum, struct metrics_shard *s)
+{
+    int i;
+
+    for (i = 0; i < METRIC_MAX; i++)
+        sum->counters[i] += __atomic_load_n(&s->counters[i], __ATOMIC_RELAXED);
+    for (i = 0; i < METRICS_WRITE_BUCKETS; i++)
+        sum->writes[i] += __atomic_load_n(&s->writes[i], __ATOMIC_RELAXED);
+}
+
+static size_t append(char *buf, size_t len, size_t off, const char *fmt, ...)
+{
+    int rc;
+    va_list ap;
+
+    if (off >= len)
+        return off;
+
+    va_start(ap, fmt);
+    rc = vsnprintf(buf + off, len - off, fmt, ap);
+    va_end(ap);
+
+    if (rc < 0)
+        return off;
+
+    return ((size_t) rc >= len - off) ? len - 1 : off + rc;
+}
+
+size_t metrics_format(char *buf, size_t len)
+{
+    int i;
+    size_t off = 0;
+    uint64_t cum = 0, active;
+    struct metrics_shard sum, *s;
+
+    if (len == 0)
+        return 0;
+    buf[0] = '\0';
+
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&shards_lock);
+    shard_sum(&sum, &retired);
+    shard_sum(&sum, &fallback);
+    LIST_FOREACH(s, &shards, shards)
+        shard_sum(&sum, s);
+    pthread_mutex_unlock(&shards_lock);
+
+    for (i = 0; i < METRIC_MAX; i++) {
+        if (descs[i].name == NULL)
+            continue;
+        off = append(buf, len, off, "# HELP %s %s\n# TYPE %s %s\n", descs[i].name, descs[i].help,
+                     descs[i].name, descs[i].type);
+        if (i == METRIC_LOCK_WAIT_NS)
+            off = append(buf, len, off, "%s %.9f\n", descs[i].name, sum.counters[i] / 1e9);
+        else
+            off = append(buf, len, off, "%s %llu\n", descs[i].name,
+                         (unsigned long long) sum.counters[i]);
+    }
+
+    /* shards are read one after the other, a close may be seen before
+     * its accept */
+    active = sum.counters[METRIC_CONN_ACCEPTED] - sum.counters[METRIC_CONN_CLOSED];
+    if (sum.counters[METRIC_CONN_CLOSED] > sum.counters[METRIC_CONN_ACCEPTED])
+        active = 0;
+    off = append(buf, len, off, "# HELP aesdsocket_connections_active Client connections open.\n"
+                 "# TYPE aesdsocket_connections_active gauge\n"
+                 "aesdsocket_connections_active %llu\n", (unsigned long long) active);
+
+    off = append(buf, len, off, "# HELP aesdsocket_log_write_seconds Duration of writes to the log.\n"
+                 "# TYPE aesdsocket_log_write_seconds histogram\n");
+    for (i = 0; i < METRICS_WRITE_BUCKETS; i++) {
+        cum += sum.writes[i];
+        if (i == METRICS_WRITE_BUCKETS - 1)
+            off = append(buf, len, off, "aesdsocket_log_write_seconds_bucket{le=\"+Inf\"} %llu\n",
+                         (unsigned long long) cum);
+        else
+            off = append(buf, len, off, "aesdsocket_log_write_seconds_bucket{le=\"%.9g\"} %llu\n",
+                         (double) (1ULL << i) / 1e6, (unsigned long long) cum);
+    }
+    off = append(buf, len, off, "aesdsocket_log_write_seconds_sum %.9f\n"
+                 "aesdsocket_log_write_seconds_count %llu\n",
+                 sum.counters[METRIC_WRITE_NS] / 1e9, (unsigned long long) cum);
+
+    return off;
+}
+
+/**
+ * @brief Answer one scrape with an HTTP/1.0 response, whatever the
+ * request was.
+ */
+static void metrics_serve(int fd)
+{
+    size_t len, off = 0;
+    ssize_t rc;
+    char req[512];
+    char *buf;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    /* consume the request if one comes, a bare connect works as well */
+    if (poll(&pfd, 1, METRICS_RECV_TIMEOUT_MS) == 1)
+        (void) recv(fd, req, sizeof(req), MSG_DONTWAIT);
+
+    buf = (char *) malloc(METRICS_BUF_LEN);
+    if (buf == NULL)
+        return;
+
+    len = snprintf(buf, METRICS_BUF_LEN, "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n\r\n");
+    len += metrics_format(buf + len, METRICS_BUF_LEN - len);
+
+    while (off != len) {
+        rc = send(fd, buf + off, len - off, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        off += rc;
+    }
+
+    free(buf);
+}
+
+/**
+ * @brief Metrics server thread function.
+ *
+ * @param thread_param unused
+ * @return void* returns NULL
+ */
+static void *metrics_func(void *thread_param)
+{
+    int fd;
+    struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+
+    /* still scraped while the connections drain, metrics_stop() wakes it */
+    while (atomic_load(&serving)) {
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) != 1)
+            continue;
+
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1)
+            continue;
+
+        metrics_serve(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int metrics_start(const char *addr)
+{
+    int rc, optval = 1;
+    struct sockaddr_in sin;
+    struct sockaddr_un sun;
+
+    if (strchr(addr, '/') != NULL) {
+        if (strlen(addr) >= sizeof(sun.sun_path)) {
+            syslog(LOG_ERR, "metrics socket path %s is too long", addr);
+            return -1;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, addr);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+            goto error;
+
+        unlink(addr);
+        if (bind(listen_fd, (struct sockaddr *) &sun, sizeof(sun)) != 0)
+            goto error;
+        strcpy(unix_path, addr);
+    } else {
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sin.sin_port = htons((unsigned short) atoi(addr));
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+            goto error;
+
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+        if (bind(listen_fd, (struct sockaddr *) &sin, sizeof(sin)) != 0)
+            goto error;
+    }
+
+    if (listen(listen_fd, METRICS_BACKLOG) != 0)
+        goto error;
+
+    atomic_store(&serving, 1);
+
+    rc = spawn_service_thread(&server, metrics_func, NULL);
+
+    if (rc != 0) {
+        atomic_store(&serving, 0);
+        errno = rc;
+        goto error;
+    }
+
+    return 0;
+
+error:
+    syslog(LOG_ERR, "failed to serve metrics on %s: %s", addr, strerror(errno));
+    if (listen_fd != -1)
+        close(listen_fd);
+    listen_fd = -1;
+    if (unix_path[0] != '\0')
+        unlink(unix_path);
+    unix_path[0] = '\0';
+    return -1;
+}
+
+void metrics_stop(void)
+{
+    if (!atomic_exchange(&serving, 0))
+        return;
+
+    /* wakes poll() at once, the listener is closed anyway */
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(server, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+
+    if (unix_path[0] != '\0')
+        unlink(unix_path);
+    unix_path[0] = '\0';
+}
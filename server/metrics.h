@@ -0,0 +1,132 @@
+/**
+ * @file    metrics.h
+ *
+ * @brief   Runtime counters of aesdsocket, exposed in Prometheus format.
+ *
+ * Every thread updates its own cache-line aligned shard of counters
+ * with plain relaxed stores, so counting costs no locked instruction and
+ * no shared cache line. A scrape sums the live shards and the totals
+ * of threads which already exited. metrics_start() serves the sums in
+ * the Prometheus text format on a local TCP port or Unix socket.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "queue.h"
+
+#define METRICS_CACHE_LINE      64
+#define METRICS_WRITE_BUCKETS   22      /* 1us, 2us, ... 2^20us and +Inf */
+
+enum metric_id {
+    METRIC_CONN_ACCEPTED,
+    METRIC_CONN_CLOSED,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_PACKETS,
+    METRIC_SEEKS,
+    METRIC_LOCK_ACQUIRED,
+    METRIC_LOCK_WAIT_NS,
+    METRIC_WRITE_NS,
+    METRIC_MAX,
+};
+
+/* written by its owning thread only */
+struct metrics_shard {
+    uint64_t counters[METRIC_MAX];
+    uint64_t writes[METRICS_WRITE_BUCKETS];
+    LIST_ENTRY(metrics_shard) shards;
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+extern __thread struct metrics_shard *metrics_self;
+
+/**
+ * @brief Give the calling thread its shard. Called on its first update.
+ *
+ * @return struct metrics_shard* the shard, or a shared dummy shard if
+ * none could be allocated
+ */
+struct metrics_shard *metrics_register(void);
+
+static inline struct metrics_shard *metrics_shard(void)
+{
+    return (metrics_self != NULL) ? metrics_self : metrics_register();
+}
+
+static inline void metrics_add_to(struct metrics_shard *s, enum metric_id id, uint64_t v)
+{
+    /* a single writer, so no read-modify-write atomic is needed */
+    __atomic_store_n(&s->counters[id], s->counters[id] + v, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Add v to a counter of the calling thread.
+ *
+ * @param id counter
+ * @param v amount
+ */
+static inline void metrics_add(enum metric_id id, uint64_t v)
+{
+    metrics_add_to(metrics_shard(), id, v);
+}
+
+/**
+ * @brief Monotonic clock in nanoseconds, for the timed metrics.
+ */
+uint64_t metrics_now_ns(void);
+
+/**
+ * @brief Lock the writers' mutex, accounting for the time spent waiting.
+ * An uncontended lock is not timed.
+ *
+ * @param mutex writers' mutex
+ * @return int 0 on success or an error number
+ */
+int metrics_lock(pthread_mutex_t *mutex);
+
+/**
+ * @brief Record the duration of one write to *log_file.
+ *
+ * @param ns duration in nanoseconds
+ */
+void metrics_observe_write(uint64_t ns);
+
+/**
+ * @brief Format the current totals in the Prometheus text format.
+ *
+ * @param buf destination
+ * @param len size of buf
+ * @return size_t length of the text, truncated to len - 1 bytes
+ */
+size_t metrics_format(char *buf, size_t len);
+
+/**
+ * @brief Serve the metrics from a thread until metrics_stop().
+ *
+ * @param addr TCP port on 127.0.0.1, or the path of a Unix socket if it
+ * contains a '/'
+ * @return int 0 on success or -1 on failure
+ */
+int metrics_start(const char *addr);
+
+/**
+ * @brief Stop serving the metrics, no-op if not started.
+ */
+void metrics_stop(void);
+
+#endif /* METRICS_H */
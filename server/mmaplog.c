@@ -0,0 +1,353 @@
+/**
+ * @file    mmaplog.c
+ *
+ * @brief   Append-only log in a memory-mapped *log_file.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <limits.h>
+
+#include "aesdsocket.h"
+#include "mmaplog.h"
+#include "seqlog.h"
+#include "tail.h"
+
+#define DATA                    (map + MMAPLOG_HDR_LEN)
+#define DATA_MAX                (MMAPLOG_MAX_LEN - MMAPLOG_HDR_LEN)
+
+static int log_fd = -1;
+static char *map = NULL;                /* MMAPLOG_MAX_LEN bytes of *log_file */
+static struct mmaplog_hdr *hdr;
+static pthread_mutex_t grow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct seqlog core;
+
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;  /* mmaplog_flush() */
+static uint64_t flushed = 0;
+
+/**
+ * @brief Extend *log_file by extents until need log bytes are backed.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int mmaplog_grow(uint64_t need)
+{
+    int rc = 0;
+    uint64_t len;
+
+    pthread_mutex_lock(&grow_lock);
+
+    while ((len = atomic_load_explicit(&core.backed, memory_order_relaxed)) < need) {
+        if (need > DATA_MAX) {
+            syslog(LOG_ERR, "mmap log %s is full", log_file);
+            rc = -1;
+            break;
+        }
+
+        len = (len + MMAPLOG_EXTENT < DATA_MAX) ? len + MMAPLOG_EXTENT : DATA_MAX;
+        rc = posix_fallocate(log_fd, 0, MMAPLOG_HDR_LEN + len);
+        if (rc != 0) {
+            syslog(LOG_ERR, "failed to grow %s: %s", log_file, strerror(rc));
+            rc = -1;
+            break;
+        }
+
+        atomic_store_explicit(&core.backed, len, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&grow_lock);
+
+    return rc;
+}
+
+/**
+ * @brief Copy a packet straight into the mapping, see struct seqlog_ops.
+ */
+static void mmaplog_store(uint64_t offset, const char *buf, size_t len)
+{
+    memcpy(DATA + offset, buf, len);
+}
+
+/**
+ * @brief Pass published bytes on to the tail, see struct seqlog_ops.
+ */
+static void mmaplog_publish(uint64_t from, uint64_t to)
+{
+    tail_append(DATA + from, to - from);
+}
+
+static const struct seqlog_ops mmaplog_ops = {
+    .fetch_add = 1,
+    .grow = mmaplog_grow,
+    .copy = mmaplog_store,
+    .publish = mmaplog_publish,
+    .flush = mmaplog_flush,
+};
+
+int mmaplog_append(const char *buf, size_t len)
+{
+    return seqlog_append(&core, buf, len);
+}
+
+uint64_t mmaplog_size(void)
+{
+    return seqlog_size(&core);
+}
+
+ssize_t mmaplog_read(char *buf, size_t len, uint64_t offset)
+{
+    uint64_t size = mmaplog_size();
+
+    if (offset >= size)
+        return 0;
+    if (len > size - offset)
+        len = size - offset;
+
+    memcpy(buf, DATA + offset, len);
+
+    return len;
+}
+
+ssize_t mmaplog_send(int sockfd, uint64_t offset, size_t len)
+{
+    uint64_t size = mmaplog_size();
+
+    if (offset >= size)
+        return 0;
+    if (len > size - offset)
+        len = size - offset;
+
+    return send(sockfd, DATA + offset, len, MSG_NOSIGNAL);
+}
+
+int mmaplog_flush(void)
+{
+    int rc = 0;
+    uintptr_t from;
+    uint64_t size = mmaplog_size();
+
+    pthread_mutex_lock(&sync_lock);
+
+    if (size != flushed) {
+        /* the data first, then the header claiming it */
+        from = (uintptr_t) (DATA + flushed) & ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+        rc = msync((void *) from, (uintptr_t) (DATA + size) - from, MS_SYNC);
+        if (rc == 0) {
+            hdr->committed = size;
+            rc = msync(map, MMAPLOG_HDR_LEN, MS_SYNC);
+        }
+
+        if (rc != 0)
+            syslog(LOG_ERR, "failed to sync %s: %s", log_file, strerror(errno));
+        else
+            flushed = size;
+    }
+
+    pthread_mutex_unlock(&sync_lock);
+
+    return rc;
+}
+
+/**
+ * @brief Replace the plain log in log_fd with an mmap log holding the
+ * same bytes. The copy is renamed over *log_file only once it is synced,
+ * so a crash leaves the plain log untouched.
+ *
+ * @param st stat of log_fd, updated to the new file
+ * @return int 0 on success or -1 on failure
+ */
+static int mmaplog_convert(struct stat *st)
+{
+    int fd;
+    off_t off = 0;
+    ssize_t rc;
+    char tmp[PATH_MAX];
+    struct mmaplog_hdr h;
+
+    if ((uint64_t) st->st_size > DATA_MAX) {
+        syslog(LOG_ERR, "%s is too large for an mmap log", log_file);
+        return -1;
+    }
+
+    syslog(LOG_WARNING, "%s is a plain log, converting it to an mmap log", log_file);
+
+    snprintf(tmp, sizeof(tmp), "%s.mmaplog", log_file);
+    fd = open(tmp, (O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC), FILE_MODE);
+    if (fd == -1) {
+        syslog(LOG_ERR, "failed to open %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MMAPLOG_MAGIC, sizeof(h.magic));
+    h.committed = st->st_size;
+    if (ftruncate(fd, MMAPLOG_HDR_LEN) != 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        lseek(fd, MMAPLOG_HDR_LEN, SEEK_SET) == -1)
+        goto error;
+
+    while (off != st->st_size) {
+        rc = sendfile(fd, log_fd, &off, st->st_size - off);
+        if (rc == -1 && errno != EINTR)
+            goto error;
+        if (rc == 0) {
+            errno = EIO;    /* shrank meanwhile */
+            goto error;
+        }
+    }
+
+    if (fsync(fd) != 0 || rename(tmp, log_file) != 0 || fstat(fd, st) != 0)
+        goto error;
+
+    close(log_fd);
+    log_fd = fd;
+    syslog(LOG_INFO, "converted %llu bytes of %s", (unsigned long long) h.committed, log_file);
+
+    return 0;
+
+error:
+    syslog(LOG_ERR, "failed to convert %s: %s", log_file, strerror(errno));
+    close(fd);
+    unlink(tmp);
+
+    return -1;
+}
+
+/**
+ * @brief Map *log_file, writing a header to an empty one or recovering
+ * the log of an existing one.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int mmaplog_map(void)
+{
+    int rc;
+    struct stat st;
+    char magic[sizeof(MMAPLOG_MAGIC) - 1];
+    uint64_t len = 0;
+
+    log_fd = open(log_file, (O_CREAT | O_RDWR | O_CLOEXEC), FILE_MODE);
+    if (log_fd == -1) {
+        syslog(LOG_ERR, "failed to open %s: %s", log_file, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(log_fd, &st) != 0) {
+        syslog(LOG_ERR, "failed to obtain information about %s", log_file);
+        goto error;
+    }
+
+    if (st.st_size != 0 &&
+        (pread(log_fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+         memcmp(magic, MMAPLOG_MAGIC, sizeof(magic)) != 0) &&
+        mmaplog_convert(&st) != 0)
+        goto error;
+
+    if (st.st_size == 0) {
+        rc = posix_fallocate(log_fd, 0, MMAPLOG_HDR_LEN);
+        if (rc != 0) {
+            syslog(LOG_ERR, "failed to grow %s: %s", log_file, strerror(rc));
+            goto error;
+        }
+    } else if (st.st_size < MMAPLOG_HDR_LEN) {
+        syslog(LOG_ERR, "%s is not an mmap log", log_file);
+        goto error;
+    }
+
+    /* pages past the end of the file are mapped but not accessed until
+     * the file has grown over them */
+    map = mmap(NULL, MMAPLOG_MAX_LEN, (PROT_READ | PROT_WRITE), MAP_SHARED, log_fd, 0);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        syslog(LOG_ERR, "failed to map %s: %s", log_file, strerror(errno));
+        goto error;
+    }
+    hdr = (struct mmaplog_hdr *) map;
+
+    if (st.st_size == 0) {
+        memcpy(hdr->magic, MMAPLOG_MAGIC, sizeof(hdr->magic));
+        hdr->committed = 0;
+        if (msync(map, MMAPLOG_HDR_LEN, MS_SYNC) != 0) {
+            syslog(LOG_ERR, "failed to sync %s: %s", log_file, strerror(errno));
+            goto error;
+        }
+    } else {
+        len = hdr->committed;
+        if (memcmp(hdr->magic, MMAPLOG_MAGIC, sizeof(hdr->magic)) != 0 ||
+            len > (uint64_t) st.st_size - MMAPLOG_HDR_LEN) {
+            syslog(LOG_ERR, "%s is not an mmap log", log_file);
+            goto error;
+        }
+        syslog(LOG_INFO, "recovered %llu bytes of %s", (unsigned long long) len, log_file);
+    }
+
+    seqlog_reset(&core, len, (st.st_size == 0) ? 0 : st.st_size - MMAPLOG_HDR_LEN);
+    flushed = len;
+
+    return 0;
+
+error:
+    if (map != NULL)
+        munmap(map, MMAPLOG_MAX_LEN);
+    map = NULL;
+    close(log_fd);
+    log_fd = -1;
+
+    return -1;
+}
+
+int mmaplog_init(long flush_ms)
+{
+    if (mmaplog_map() != 0)
+        return -1;
+
+    core.ops = &mmaplog_ops;
+
+    if (seqlog_start_flusher(&core, flush_ms) != 0) {
+        mmaplog_cleanup();
+        return -1;
+    }
+
+    return 0;
+}
+
+void mmaplog_cleanup(void)
+{
+    seqlog_stop_flusher(&core);
+
+    if (map == NULL)
+        return;
+
+    /* the preallocated extent is not part of the log */
+    if (mmaplog_flush() == 0 &&
+        ftruncate(log_fd, MMAPLOG_HDR_LEN + mmaplog_size()) != 0)
+        syslog(LOG_ERR, "failed to truncate %s: %s", log_file, strerror(errno));
+
+    munmap(map, MMAPLOG_MAX_LEN);
+    map = NULL;
+    close(log_fd);
+    log_fd = -1;
+}
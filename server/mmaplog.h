@@ -0,0 +1,120 @@
+/**
+ * @file    mmaplog.h
+ *
+ * @brief   Append-only log in a memory-mapped *log_file.
+ *
+ * *log_file is mapped once, MMAPLOG_MAX_LEN bytes of address space, and
+ * grown MMAPLOG_EXTENT bytes at a time with posix_fallocate() as appends
+ * get near its end. Writers append through seqlog: each one reserves
+ * its range and a sequence number with a single fetch-and-add on the
+ * reserved length, copies its packet straight into the mapping
+ * concurrently with the other writers and has it published in sequence
+ * order. Readers copy or send() from the mapping below the published
+ * length.
+ *
+ * The file starts with a MMAPLOG_HDR_LEN header holding the length of
+ * the log known to be on disk. A flusher thread msync()s the published
+ * bytes first and only then the header, so after a crash the log is
+ * recovered up to the last flush, never with a torn packet at its end.
+ * A plain log, as left by the file backend, is converted by copying it
+ * behind a header.
+ * *log_file is truncated to the log at exit, the preallocated extent
+ * left out.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef MMAPLOG_H
+#define MMAPLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define MMAPLOG_HDR_LEN         4096            /* a page, synced on its own */
+#define MMAPLOG_EXTENT          (16UL << 20)    /* file growth step */
+/* mapping, header included: a quarter of a 32-bit address space */
+#if SIZE_MAX > 0xffffffffUL
+#define MMAPLOG_MAX_LEN         ((size_t) 1 << 32)
+#else
+#define MMAPLOG_MAX_LEN         ((size_t) 1 << 30)
+#endif
+#define MMAPLOG_MAGIC           "AESDMLOG"
+
+/* first bytes of *log_file */
+struct mmaplog_hdr {
+    char magic[8];              /* MMAPLOG_MAGIC */
+    uint64_t committed;         /* log bytes flushed to disk */
+};
+
+/**
+ * @brief Map *log_file, recovering the log it holds if any, and start
+ * the flusher thread.
+ *
+ * @param flush_ms flush period, 0 to flush only from mmaplog_flush() and
+ * mmaplog_cleanup()
+ * @return int 0 on success or -1 on failure
+ */
+int mmaplog_init(long flush_ms);
+
+/**
+ * @brief Stop the flusher, flush, truncate *log_file to the log and
+ * unmap it. No writer or reader may be running.
+ */
+void mmaplog_cleanup(void);
+
+/**
+ * @brief Append a packet, then copy it to the subscribers' tail in log
+ * order.
+ *
+ * @param buf packet
+ * @param len packet length
+ * @return int 0 on success or -1 if *log_file cannot grow
+ */
+int mmaplog_append(const char *buf, size_t len);
+
+/**
+ * @brief Published length of the log.
+ *
+ * @return uint64_t bytes readers may access
+ */
+uint64_t mmaplog_size(void);
+
+/**
+ * @brief Copy published bytes of the log.
+ *
+ * @param buf destination
+ * @param len size of buf
+ * @param offset offset to read from
+ * @return ssize_t bytes copied, less than len only at the published end
+ */
+ssize_t mmaplog_read(char *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief send() published bytes straight from the mapping.
+ *
+ * @param sockfd destination socket
+ * @param offset offset to send from
+ * @param len most bytes to send
+ * @return ssize_t bytes sent, 0 at the published end or -1 on failure
+ */
+ssize_t mmaplog_send(int sockfd, uint64_t offset, size_t len);
+
+/**
+ * @brief msync() the bytes published since the last flush, then record
+ * their length in the header and msync() it.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+int mmaplog_flush(void);
+
+#endif /* MMAPLOG_H */
@@ -0,0 +1,109 @@
+/**
+ * @file    mpmc_queue.c
+ *
+ * @brief   Bounded lock-free multi-producer/multi-consumer queue of ints.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mpmc_queue.h"
+
+int mpmc_queue_init(struct mpmc_queue *q, size_t capacity)
+{
+    size_t i, size = 2;
+
+    while (size < capacity)
+        size <<= 1;
+
+    q->cells = (struct mpmc_cell *) calloc(size, sizeof(struct mpmc_cell));
+    if (q->cells == NULL)
+        return -1;
+
+    for (i = 0; i < size; i++)
+        atomic_init(&q->cells[i].seq, i);
+
+    q->mask = size - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+
+    return 0;
+}
+
+void mpmc_queue_destroy(struct mpmc_queue *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+int mpmc_queue_push(struct mpmc_queue *q, int value)
+{
+    struct mpmc_cell *cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            /* cell is free for this lap, try to claim it */
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return -1;      /* full */
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->value = value;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return 0;
+}
+
+int mpmc_queue_pop(struct mpmc_queue *q, int *value)
+{
+    struct mpmc_cell *cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            /* cell was published for this lap, try to claim it */
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return -1;      /* empty */
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *value = cell->value;
+    /* hand the cell back to producers for the next lap */
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+
+    return 0;
+}
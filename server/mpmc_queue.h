@@ -0,0 +1,78 @@
+/**
+ * @file    mpmc_queue.h
+ *
+ * @brief   Bounded lock-free multi-producer/multi-consumer queue of ints.
+ *
+ * Implementation of Dmitry Vyukov's bounded MPMC queue: every cell carries
+ * a sequence number which tells producers and consumers whether the cell
+ * is free for the current lap, so neither side takes a lock.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE_SIZE         64
+
+struct mpmc_cell {
+    atomic_size_t seq;
+    int value;
+};
+
+struct mpmc_queue {
+    struct mpmc_cell *cells;
+    size_t mask;
+    /* producers and consumers spin on different cache lines */
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+};
+
+/**
+ * @brief Initialize a queue holding at least capacity values. The
+ * capacity is rounded up to a power of two.
+ *
+ * @param q queue
+ * @param capacity minimum number of values
+ * @return int 0 on success or -1 on failure
+ */
+int mpmc_queue_init(struct mpmc_queue *q, size_t capacity);
+
+/**
+ * @brief Release the memory held by the queue.
+ *
+ * @param q queue
+ */
+void mpmc_queue_destroy(struct mpmc_queue *q);
+
+/**
+ * @brief Append a value.
+ *
+ * @param q queue
+ * @param value value to append
+ * @return int 0 on success or -1 if the queue is full
+ */
+int mpmc_queue_push(struct mpmc_queue *q, int value);
+
+/**
+ * @brief Remove the oldest value.
+ *
+ * @param q queue
+ * @param value filled with the removed value
+ * @return int 0 on success or -1 if the queue is empty
+ */
+int mpmc_queue_pop(struct mpmc_queue *q, int *value);
+
+#endif /* MPMC_QUEUE_H */
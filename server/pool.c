@@ -0,0 +1,186 @@
+/**
+ * @file    pool.c
+ *
+ * @brief   Fixed-size worker thread pool for aesdsocket client handling.
+ *
+ * The accept loop pushes accepted descriptors into a lock-free MPMC queue
+ * and the workers pop them. Two semaphores count the free and used queue
+ * slots: workers sleep on the used count instead of spinning, and the
+ * accept loop sleeps on the free count, which is what applies
+ * backpressure during connection storms.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "aesdsocket.h"
+#include "mpmc_queue.h"
+#include "pool.h"
+#include "metrics.h"
+#include "shutdown.h"
+
+struct pool {
+    struct mpmc_queue queue;
+    sem_t slots;            /* free queue slots */
+    sem_t items;            /* queued connections */
+    atomic_int stop;
+    pthread_mutex_t *mutex;
+};
+
+struct worker {
+    pthread_t tid;
+    struct pool *pool;
+};
+
+/**
+ * @brief Worker thread function, serves queued connections one at a
+ * time until the pool is stopped and its queue is empty. Connections
+ * still queued at shutdown are drained like the others.
+ *
+ * @param thread_param struct worker data
+ * @return void* returns NULL
+ */
+static void *worker_func(void *thread_param)
+{
+    int fd;
+    struct worker *w = (struct worker *) thread_param;
+    struct pool *p = w->pool;
+
+    for (;;) {
+        if (sem_wait(&p->items) != 0)
+            continue;       /* EINTR */
+
+        if (mpmc_queue_pop(&p->queue, &fd) != 0) {
+            if (atomic_load(&p->stop))
+                break;
+            continue;
+        }
+        sem_post(&p->slots);
+
+        serve_client(fd, p->mutex);
+    }
+
+    return NULL;
+}
+
+int pool_run(int sock, int nworkers, size_t qlen, pthread_mutex_t *mutex)
+{
+    int i, rc = 0, newfd;
+    int started = 0;
+    struct pool p;
+    struct worker *workers;
+    struct sockaddr_in addr;
+    socklen_t addrlen;
+    struct pollfd pfds[2];
+
+    if (nworkers < 1)
+        nworkers = 1;
+    if (qlen < 1)
+        qlen = 1;
+
+    memset(&p, 0, sizeof(p));
+    atomic_init(&p.stop, 0);
+    p.mutex = mutex;
+
+    if (mpmc_queue_init(&p.queue, qlen) != 0) {
+        syslog(LOG_ERR, "failed to allocate memory for connection queue");
+        return -1;
+    }
+
+    workers = (struct worker *) calloc(nworkers, sizeof(struct worker));
+    if (workers == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for workers: %s", strerror(errno));
+        mpmc_queue_destroy(&p.queue);
+        return -1;
+    }
+
+    sem_init(&p.slots, 0, qlen);
+    sem_init(&p.items, 0, 0);
+
+    for (i = 0; i < nworkers; i++) {
+        workers[i].pool = &p;
+        rc = spawn_service_thread(&workers[i].tid, worker_func, &workers[i]);
+        if (rc != 0) {
+            syslog(LOG_ERR, "failed to create worker thread: %s", strerror(rc));
+            rc = -1;
+            break;
+        }
+        started++;
+    }
+
+    pfds[0].fd = sock;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = shutdown_fd();
+    pfds[1].events = POLLIN;
+
+    while (!caught_signal && rc == 0) {
+        /* backpressure: wait for a free queue slot before accepting; the
+         * drain of the queued connections frees one at shutdown */
+        if (sem_wait(&p.slots) != 0)
+            continue;
+
+        if (poll(pfds, 2, -1) == -1 || caught_signal) {
+            sem_post(&p.slots);
+            continue;
+        }
+
+        addrlen = sizeof(addr);
+        newfd = accept(sock, (struct sockaddr *) &addr, &addrlen);
+        if (newfd == -1) {
+            sem_post(&p.slots);
+            if (errno != EINTR)
+                syslog(LOG_ERR, "failed to accept connection: %s", strerror(errno));
+            continue;
+        }
+
+        syslog(LOG_INFO, "Accepted connection from %s", inet_ntoa(addr.sin_addr));
+        metrics_add(METRIC_CONN_ACCEPTED, 1);
+
+        /* cannot fail, a slot was reserved above */
+        mpmc_queue_push(&p.queue, newfd);
+        sem_post(&p.items);
+    }
+
+    /* wake every idle worker, the drain thread wakes the busy ones */
+    atomic_store(&p.stop, 1);
+    for (i = 0; i < started; i++)
+        sem_post(&p.items);
+
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i].tid, NULL);
+
+    /* close connections nobody picked up */
+    while (mpmc_queue_pop(&p.queue, &newfd) == 0) {
+        close(newfd);
+        metrics_add(METRIC_CONN_CLOSED, 1);
+    }
+
+    sem_destroy(&p.items);
+    sem_destroy(&p.slots);
+    mpmc_queue_destroy(&p.queue);
+    free(workers);
+
+    return rc;
+}
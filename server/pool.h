@@ -0,0 +1,39 @@
+/**
+ * @file    pool.h
+ *
+ * @brief   Fixed-size worker thread pool for aesdsocket client handling.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * @brief Accept clients of the listening socket and hand them to
+ * nworkers pre-spawned threads through a bounded queue until
+ * caught_signal is set. Once qlen connections are waiting for a worker
+ * the accept loop stops accepting, leaving new connections in the
+ * kernel backlog.
+ *
+ * @param sock listening socket
+ * @param nworkers number of worker threads
+ * @param qlen maximum number of accepted connections waiting for a worker
+ * @param mutex serializes writers of *log_file
+ * @return int 0 on success or -1 on failure
+ */
+int pool_run(int sock, int nworkers, size_t qlen, pthread_mutex_t *mutex);
+
+#endif /* POOL_H */
@@ -0,0 +1,646 @@
+/**
+ * @file    reactor.c
+ *
+ * @brief   Edge-triggered epoll event loop for aesdsocket client handling.
+ *
+ * Every client socket is non-blocking and is driven by a small state
+ * machine instead of a dedicated thread:
+ *
+ *  RECV  - drain the socket into the connection buffer and look for a
+ *          complete packet ('\n' terminated).
+ *  ECHO  - the packet has been written to *log_file and the log is being
+ *          streamed back to the client; resumes on EPOLLOUT whenever the
+ *          socket send buffer is full. Nothing is read meanwhile, so a
+ *          client that never reads its echo fills its own socket buffers
+ *          instead of the connection buffer.
+ *  TAIL  - the client subscribed and got the log once; whatever any
+ *          client appends is pushed to it when the loop's tail waiter
+ *          fires. Its own packets are logged but not echoed.
+ *
+ * On shutdown a loop stops accepting and reading, finishes the packets
+ * it already holds and closes each connection once its echo completes,
+ * or at the drain deadline.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#define _GNU_SOURCE     /* accept4(), pthread_setaffinity_np() */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+
+#include "aesdsocket.h"
+#include "reactor.h"
+#include "framer.h"
+#include "storage.h"
+#include "tail.h"
+#include "command.h"
+#include "metrics.h"
+#include "lockstat.h"
+#include "shutdown.h"
+#include "queue.h"
+
+#define MAX_EVENTS              64
+#define EPOLL_TIMEOUT_MS        1000
+#define CONN_MAX_RX             (16 * 1024 * 1024)  /* longest packet buffered */
+
+enum conn_state {
+    CONN_RECV,
+    CONN_ECHO,
+    CONN_TAIL,
+};
+
+struct conn {
+    int connfd;
+    enum conn_state state;
+    int peer_closed;        /* client shut down its sending side */
+    int rx_held;            /* reads held back before the socket would block */
+    struct framer rx;
+    struct storage_handle *log;     /* *log_file being echoed, NULL in CONN_RECV */
+    off_t echo_off;         /* next *log_file offset to echo */
+    struct storage_tx tx;   /* echo in progress */
+    int subscribed;         /* enter CONN_TAIL once the echo completes */
+    struct tail_sub sub;    /* position of a subscriber */
+    LIST_ENTRY(conn) conns;
+    LIST_ENTRY(conn) subs;  /* in the loop's subscribers once subscribed */
+};
+
+struct loop {
+    pthread_t tid;
+    int epfd;
+    int sock;
+    int cpu;                /* CPU the loop is pinned to, -1 for none */
+    pthread_mutex_t *mutex;
+    struct tail_waiter waiter;  /* fires when subscribers have news */
+    int draining;           /* shutting down, no more packets are read */
+    LIST_HEAD(conn_head, conn) head;
+    struct conn_head subs;  /* connections subscribed, pushed on notification */
+};
+
+/**
+ * @brief Release a connection and every resource it holds.
+ *
+ * @param l owning event loop
+ * @param c connection to release
+ */
+static void conn_close(struct loop *l, struct conn *c)
+{
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, c->connfd, NULL);
+    close(c->connfd);
+    storage_release(c->log);
+    LIST_REMOVE(c, conns);
+    if (c->subscribed)
+        LIST_REMOVE(c, subs);
+    framer_free(&c->rx);
+    storage_tx_free(&c->tx);
+    tail_sub_free(&c->sub);
+    free(c);
+    metrics_add(METRIC_CONN_CLOSED, 1);
+}
+
+/**
+ * @brief Drain the non-blocking socket into the connection framer.
+ * Reading stops early while an echo is pending or once CONN_MAX_RX
+ * bytes are buffered, see conn_resume().
+ *
+ * @param c connection
+ * @return int 0 once the socket would block or reads are held back,
+ * -1 on failure
+ */
+static int conn_recv(struct conn *c)
+{
+    ssize_t rc;
+    size_t avail;
+    char *buf;
+
+    c->rx_held = 0;
+    while (!c->peer_closed) {
+        if (c->state == CONN_ECHO || framer_pending(&c->rx) >= CONN_MAX_RX) {
+            c->rx_held = 1;
+            break;
+        }
+
+        buf = framer_reserve(&c->rx, MAX_BUF_LEN, &avail);
+        if (buf == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for msg");
+            return -1;
+        }
+
+        rc = recv(c->connfd, buf, avail, 0);
+        if (rc > 0) {
+            metrics_add(METRIC_BYTES_IN, rc);
+            framer_commit(&c->rx, rc);
+        } else if (rc == 0) {
+            c->peer_closed = 1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read what conn_recv() held back once the packets buffered are
+ * handled: edge-triggered epoll does not report it again.
+ *
+ * @param c connection, without a complete packet buffered
+ * @return int 1 if reading resumed, 0 if nothing was held back or -1 on
+ * failure, including a packet longer than CONN_MAX_RX
+ */
+static int conn_resume(struct conn *c)
+{
+    if (!c->rx_held)
+        return 0;
+
+    if (framer_pending(&c->rx) >= CONN_MAX_RX) {
+        syslog(LOG_ERR, "packet longer than %d bytes, closing connection", CONN_MAX_RX);
+        return -1;
+    }
+
+    return (conn_recv(c) == 0) ? 1 : -1;
+}
+
+/**
+ * @brief Write a complete packet to *log_file, or apply it as a seek
+ * command, and switch to CONN_ECHO.
+ *
+ * @param l owning event loop
+ * @param c connection
+ * @param pkt packet, terminated by '\n'
+ * @param len packet length, including the trailing '\n'
+ * @return int 0 on success or -1 on failure
+ */
+static int conn_start_echo(struct loop *l, struct conn *c, const char *pkt, size_t len)
+{
+    struct command cmd;
+
+    c->log = storage_acquire();
+    if (c->log == NULL)
+        return -1;
+
+    if (command_parse(pkt, len, &cmd) == CMD_SUBSCRIBE) {
+        /* the history ends exactly where the pushed bytes start */
+        c->tx.end = storage_sub_init(c->log, &c->sub, &l->waiter, l->mutex);
+
+        if (c->tx.end == -1)
+            return -1;
+        c->subscribed = 1;
+        LIST_INSERT_HEAD(&l->subs, c, subs);
+        c->echo_off = 0;
+        c->state = CONN_ECHO;
+        return 0;
+    }
+
+    c->echo_off = storage_apply(c->log, pkt, len, &cmd, l->mutex);
+    if (c->echo_off == -1)
+        return -1;
+
+    c->state = CONN_ECHO;
+
+    return 0;
+}
+
+/**
+ * @brief Stream *log_file back to the client until it is exhausted or
+ * the socket would block.
+ *
+ * @param c connection
+ * @return int 1 when the echo is complete, 0 if the socket would block
+ * or -1 on failure
+ */
+static int conn_echo(struct conn *c)
+{
+    int rc;
+
+    rc = storage_send(c->log, &c->tx, c->connfd, &c->echo_off);
+    if (rc != 1)
+        return rc;
+
+    storage_release(c->log);
+    c->log = NULL;
+    c->tx.end = -1;
+    c->state = c->subscribed ? CONN_TAIL : CONN_RECV;
+
+    return 1;
+}
+
+/**
+ * @brief Log the packets of a subscriber and push what has been
+ * appended since the last push.
+ *
+ * @param l owning event loop
+ * @param c connection
+ * @return int 0 to keep the connection or -1 to close it
+ */
+static int conn_tail(struct loop *l, struct conn *c)
+{
+    struct command cmd;
+    struct storage_handle *h;
+    const char *pkt;
+    size_t len;
+    off_t rc;
+
+    while ((pkt = framer_next(&c->rx, &len)) != NULL) {
+        h = storage_acquire();
+        if (h == NULL)
+            return -1;
+        command_parse(pkt, len, &cmd);
+        rc = storage_apply(h, pkt, len, &cmd, l->mutex);
+        storage_release(h);
+        if (rc == -1)
+            return -1;
+    }
+
+    /* a half-closed subscriber keeps following the log */
+    return (tail_push(&c->sub, c->connfd) == -1) ? -1 : 0;
+}
+
+/**
+ * @brief Advance the connection state machine as far as possible.
+ *
+ * @param l owning event loop
+ * @param c connection
+ * @return int 0 to keep the connection or -1 to close it
+ */
+static int conn_run(struct loop *l, struct conn *c)
+{
+    const char *pkt;
+    size_t len;
+    int rc;
+
+    if (conn_recv(c) != 0)
+        return -1;
+
+    for (;;) {
+        switch (c->state) {
+        case CONN_RECV:
+            pkt = framer_next(&c->rx, &len);
+            if (pkt == NULL) {
+                rc = conn_resume(c);
+                if (rc == 1)
+                    continue;
+                if (rc == -1)
+                    return -1;
+                return c->peer_closed ? -1 : 0;
+            }
+            if (conn_start_echo(l, c, pkt, len) != 0)
+                return -1;
+            break;
+
+        case CONN_ECHO:
+            rc = conn_echo(c);
+            if (rc != 1)
+                return rc;
+            break;
+
+        case CONN_TAIL:
+            if (conn_tail(l, c) != 0)
+                return -1;
+            rc = conn_resume(c);
+            if (rc != 1)
+                return rc;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Accept every pending connection on the listener and register
+ * it with this loop's epoll instance.
+ *
+ * @param l event loop
+ */
+static void loop_accept(struct loop *l)
+{
+    int newfd;
+    struct conn *c;
+    struct epoll_event ev;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    while ((newfd = accept4(l->sock, (struct sockaddr *) &addr, &addrlen,
+                            (SOCK_NONBLOCK | SOCK_CLOEXEC))) != -1) {
+        syslog(LOG_INFO, "Accepted connection from %s", inet_ntoa(addr.sin_addr));
+        metrics_add(METRIC_CONN_ACCEPTED, 1);
+
+        c = (struct conn *) calloc(1, sizeof(struct conn));
+        if (c == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for client conn: %s", strerror(errno));
+            close(newfd);
+            metrics_add(METRIC_CONN_CLOSED, 1);
+            continue;
+        }
+        c->connfd = newfd;
+        c->log = NULL;
+        framer_init(&c->rx);
+        storage_tx_init(&c->tx);
+        c->state = CONN_RECV;
+        LIST_INSERT_HEAD(&l->head, c, conns);
+
+        ev.events = (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        ev.data.ptr = c;
+        if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, newfd, &ev) != 0) {
+            syslog(LOG_ERR, "failed to register client fd %d: %s", newfd, strerror(errno));
+            conn_close(l, c);
+        }
+
+        addrlen = sizeof(addr);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        syslog(LOG_ERR, "failed to accept connection: %s", strerror(errno));
+}
+
+/**
+ * @brief Push the bytes appended since the last notification to every
+ * subscriber of this loop.
+ *
+ * @param l event loop
+ */
+static void loop_notify(struct loop *l)
+{
+    struct conn *c, *next;
+
+    tail_waiter_clear(&l->waiter);
+
+    for (c = LIST_FIRST(&l->subs); c != NULL; c = next) {
+        next = LIST_NEXT(c, subs);
+        if (c->state == CONN_TAIL && conn_run(l, c) != 0)
+            conn_close(l, c);
+    }
+}
+
+/**
+ * @brief Stop accepting and reading: every connection gets the packets
+ * already received processed and is closed once their echo completes.
+ * Subscribers are closed right away.
+ *
+ * @param l event loop
+ */
+static void loop_start_drain(struct loop *l)
+{
+    struct conn *c, *next;
+    struct epoll_event ev;
+
+    l->draining = 1;
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, l->sock, NULL);
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, shutdown_fd(), NULL);
+
+    /* a second request wakes the loop to close what is left */
+    ev.events = EPOLLIN;
+    ev.data.ptr = l;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, shutdown_expire_fd(), &ev) != 0)
+        syslog(LOG_ERR, "failed to register shutdown eventfd: %s", strerror(errno));
+
+    for (c = LIST_FIRST(&l->head); c != NULL; c = next) {
+        next = LIST_NEXT(c, conns);
+        /* take what the kernel holds, unless an echo holds reads back,
+         * then treat the client as gone */
+        if (conn_recv(c) != 0) {
+            conn_close(l, c);
+            continue;
+        }
+        c->peer_closed = 1;
+        if (conn_run(l, c) != 0 || c->state == CONN_TAIL)
+            conn_close(l, c);
+    }
+}
+
+/**
+ * @brief Event-loop thread function.
+ *
+ * @param thread_param struct loop data
+ * @return void* returns NULL
+ */
+static void *loop_func(void *thread_param)
+{
+    int i, n, notified, stop = 0;
+    struct loop *l = (struct loop *) thread_param;
+    struct epoll_event events[MAX_EVENTS];
+    struct conn *c;
+    cpu_set_t set;
+
+    if (l->cpu != -1) {
+        CPU_ZERO(&set);
+        CPU_SET(l->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            syslog(LOG_WARNING, "failed to pin event loop to CPU %d", l->cpu);
+    }
+
+    /* once draining, run until the last connection is done or the
+     * deadline passes */
+    while (!l->draining || !LIST_EMPTY(&l->head)) {
+        if (l->draining && shutdown_expired())
+            break;
+
+        n = epoll_wait(l->epfd, events, MAX_EVENTS, shutdown_timeout_ms(EPOLL_TIMEOUT_MS));
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "failed to wait for events: %s", strerror(errno));
+            break;
+        }
+
+        notified = 0;
+        for (i = 0; i < n; i++) {
+            c = (struct conn *) events[i].data.ptr;
+            if (c == NULL) {
+                loop_accept(l);
+                continue;
+            }
+
+            if (events[i].data.ptr == &l->waiter) {
+                notified = 1;
+                continue;
+            }
+
+            if (events[i].data.ptr == l) {
+                stop = 1;
+                continue;
+            }
+
+            if (conn_run(l, c) != 0 || (l->draining && c->state == CONN_TAIL))
+                conn_close(l, c);
+        }
+
+        /* may close any connection, so only once events[] is consumed */
+        if (notified && !l->draining)
+            loop_notify(l);
+        if (stop && !l->draining)
+            loop_start_drain(l);
+    }
+
+    /* whatever is left ran out of time */
+    n = 0;
+    while (!LIST_EMPTY(&l->head)) {
+        conn_close(l, LIST_FIRST(&l->head));
+        n++;
+    }
+    if (n > 0)
+        shutdown_forced(n);
+
+    return NULL;
+}
+
+/**
+ * @brief Run nthreads event loops, loop i accepting from socks[i % nsocks]
+ * and pinned to cpus[i] unless cpus is NULL.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int reactor_start(const int *socks, int nsocks, int nthreads, const int *cpus,
+                         pthread_mutex_t *mutex)
+{
+    int i, rc = 0;
+    int started = 0;
+    struct loop *loops;
+    struct epoll_event ev;
+
+    for (i = 0; i < nsocks; i++) {
+        if (fcntl(socks[i], F_SETFL, fcntl(socks[i], F_GETFL) | O_NONBLOCK) != 0) {
+            syslog(LOG_ERR, "failed to make socket %d non-blocking: %s", socks[i], strerror(errno));
+            return -1;
+        }
+    }
+
+    loops = (struct loop *) calloc(nthreads, sizeof(struct loop));
+    if (loops == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for event loops: %s", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        loops[i].sock = socks[i % nsocks];
+        loops[i].cpu = (cpus != NULL) ? cpus[i] : -1;
+        loops[i].mutex = mutex;
+        LIST_INIT(&loops[i].head);
+        LIST_INIT(&loops[i].subs);
+
+        loops[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loops[i].epfd == -1) {
+            syslog(LOG_ERR, "failed to create epoll instance: %s", strerror(errno));
+            rc = -1;
+            break;
+        }
+
+        ev.events = (EPOLLIN | EPOLLEXCLUSIVE);
+        ev.data.ptr = NULL;
+        if (epoll_ctl(loops[i].epfd, EPOLL_CTL_ADD, loops[i].sock, &ev) != 0) {
+            syslog(LOG_ERR, "failed to register listener: %s", strerror(errno));
+            close(loops[i].epfd);
+            rc = -1;
+            break;
+        }
+
+        if (tail_waiter_add(&loops[i].waiter) != 0) {
+            close(loops[i].epfd);
+            rc = -1;
+            break;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &loops[i].waiter;
+        if (epoll_ctl(loops[i].epfd, EPOLL_CTL_ADD, loops[i].waiter.efd, &ev) != 0) {
+            syslog(LOG_ERR, "failed to register tail waiter: %s", strerror(errno));
+            tail_waiter_remove(&loops[i].waiter);
+            close(loops[i].epfd);
+            rc = -1;
+            break;
+        }
+
+        /* data.ptr is the loop itself, no connection can have it */
+        ev.events = EPOLLIN;
+        ev.data.ptr = &loops[i];
+        if (epoll_ctl(loops[i].epfd, EPOLL_CTL_ADD, shutdown_fd(), &ev) != 0) {
+            syslog(LOG_ERR, "failed to register shutdown eventfd: %s", strerror(errno));
+            tail_waiter_remove(&loops[i].waiter);
+            close(loops[i].epfd);
+            rc = -1;
+            break;
+        }
+
+        rc = pthread_create(&loops[i].tid, NULL, loop_func, &loops[i]);
+        if (rc != 0) {
+            syslog(LOG_ERR, "failed to create event loop thread: %s", strerror(rc));
+            tail_waiter_remove(&loops[i].waiter);
+            close(loops[i].epfd);
+            rc = -1;
+            break;
+        }
+        started++;
+    }
+
+    if (rc != 0)
+        shutdown_request();
+
+    for (i = 0; i < started; i++) {
+        pthread_join(loops[i].tid, NULL);
+        tail_waiter_remove(&loops[i].waiter);
+        close(loops[i].epfd);
+    }
+
+    free(loops);
+
+    return rc;
+}
+
+int reactor_run(int sock, int nthreads, pthread_mutex_t *mutex)
+{
+    if (nthreads < 1)
+        nthreads = 1;
+
+    return reactor_start(&sock, 1, nthreads, NULL, mutex);
+}
+
+int reactor_run_sharded(const int *socks, int nsocks, pthread_mutex_t *mutex)
+{
+    int i, j, rc;
+    int *cpus;
+    cpu_set_t set;
+
+    cpus = (int *) malloc(nsocks * sizeof(int));
+    if (cpus == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for CPU list: %s", strerror(errno));
+        return -1;
+    }
+
+    /* spread the loops over the CPUs this process may run on */
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0 || CPU_COUNT(&set) == 0) {
+        for (i = 0; i < nsocks; i++)
+            cpus[i] = -1;
+    } else {
+        for (i = 0, j = 0; i < nsocks; j = (j + 1) % CPU_SETSIZE) {
+            if (CPU_ISSET(j, &set))
+                cpus[i++] = j;
+        }
+    }
+
+    rc = reactor_start(socks, nsocks, nsocks, cpus, mutex);
+    free(cpus);
+
+    return rc;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file    reactor.h
+ *
+ * @brief   Edge-triggered epoll event loop for aesdsocket client handling.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+
+/**
+ * @brief Serve every client of the listening socket from nthreads
+ * event-loop threads until caught_signal is set. Each thread owns an
+ * epoll instance; the listener is shared between them with
+ * EPOLLEXCLUSIVE so an incoming connection wakes a single loop.
+ *
+ * @param sock listening socket
+ * @param nthreads number of event-loop threads
+ * @param mutex serializes writers of *log_file
+ * @return int 0 on success or -1 on failure
+ */
+int reactor_run(int sock, int nthreads, pthread_mutex_t *mutex);
+
+/**
+ * @brief Serve clients with one event loop per listening socket until
+ * caught_signal is set. The sockets are bound to the same port with
+ * SO_REUSEPORT, so the kernel spreads incoming connections over them
+ * and no two loops contend for an accept queue. Each loop is pinned to
+ * its own CPU, round-robin over the CPUs the process may run on.
+ *
+ * @param socks listening sockets, one per event loop
+ * @param nsocks number of sockets
+ * @param mutex serializes writers of *log_file
+ * @return int 0 on success or -1 on failure
+ */
+int reactor_run_sharded(const int *socks, int nsocks, pthread_mutex_t *mutex);
+
+#endif /* REACTOR_H */
@@ -0,0 +1,312 @@
+/**
+ * @file    seqlog.c
+ *
+ * @brief   Lockless reservation and in-order publication shared by the
+ *          append-only logs.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <sched.h>
+
+#include "seqlog.h"
+#include "metrics.h"
+#include "shutdown.h"
+
+/* the reservation word packs a sequence number above the byte offset, so
+ * a single fetch-and-add of (1 << RES_OFF_BITS) | len reserves both */
+#define RES_OFF_BITS            40
+#define RES_OFF(r)              ((r) & ((1ULL << RES_OFF_BITS) - 1))
+#define RES_SEQ(r)              ((r) >> RES_OFF_BITS)
+#define SEQ_MASK                ((1ULL << (64 - RES_OFF_BITS)) - 1)
+
+#define SLOT_FREE               0
+#define SLOT_DONE               1       /* copied, waiting to be published */
+#define SLOT_WAITER             2       /* its writer sleeps until published */
+#define SLOT_BROKEN             4       /* the log stopped growing */
+#define WAIT_SPINS              256     /* polls before sleeping */
+
+/**
+ * @brief Fail every append from now on. The reservation which could not
+ * be backed is a hole the publication never gets past, so wake the
+ * writers waiting behind it.
+ */
+static void seqlog_break(struct seqlog *l)
+{
+    size_t i;
+
+    if (atomic_exchange(&l->broken, 1))
+        return;
+
+    for (i = 0; i < SEQLOG_SLOTS; i++) {
+        if (atomic_fetch_or(&l->slots[i].state, SLOT_BROKEN) & SLOT_WAITER)
+            syscall(SYS_futex, &l->slots[i].state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * @brief Reserve len bytes at the end of the log and the next sequence
+ * number.
+ *
+ * @return int 0 on success or -1 on failure
+ */
+static int seqlog_reserve(struct seqlog *l, size_t len, uint64_t *seq, uint64_t *start)
+{
+    uint64_t r;
+
+    if (l->ops->fetch_add) {
+        r = atomic_fetch_add_explicit(&l->reserved, (1ULL << RES_OFF_BITS) | len,
+                                      memory_order_relaxed);
+        *seq = RES_SEQ(r);
+        *start = RES_OFF(r);
+
+        if (*start + len > atomic_load_explicit(&l->backed, memory_order_acquire) &&
+            l->ops->grow(*start + len) != 0) {
+            seqlog_break(l);
+            return -1;
+        }
+        return 0;
+    }
+
+    /* only backed bytes are reserved, so a failure leaves no hole */
+    r = atomic_load_explicit(&l->reserved, memory_order_relaxed);
+    for (;;) {
+        if (RES_OFF(r) + len > atomic_load_explicit(&l->backed, memory_order_acquire)) {
+            if (l->ops->grow(RES_OFF(r) + len) != 0)
+                return -1;
+            r = atomic_load_explicit(&l->reserved, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&l->reserved, &r,
+                                                  (((RES_SEQ(r) + 1) & SEQ_MASK) << RES_OFF_BITS) |
+                                                  (RES_OFF(r) + len),
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *seq = RES_SEQ(r);
+            *start = RES_OFF(r);
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief Publish every copied reservation following the published ones.
+ * Whoever gets the publishing flag publishes for everyone, a writer which
+ * does not get it relies on the holder looking once more after letting
+ * go, so no writer ever waits to publish.
+ */
+static void seqlog_publish(struct seqlog *l)
+{
+    int busy;
+    uint64_t seq, prev, end;
+    unsigned int state;
+    struct seqlog_slot *s;
+
+    do {
+        busy = 0;
+        if (!atomic_compare_exchange_strong(&l->publishing, &busy, 1))
+            return;
+
+        seq = atomic_load_explicit(&l->published, memory_order_relaxed);
+        s = &l->slots[seq & (SEQLOG_SLOTS - 1)];
+
+        while (atomic_load_explicit(&s->state, memory_order_acquire) & SLOT_DONE) {
+            prev = atomic_load_explicit(&l->committed, memory_order_relaxed);
+            end = s->end;
+
+            /* readers first, the tail after, see storage_sub_init() */
+            atomic_store_explicit(&l->committed, end, memory_order_release);
+            l->ops->publish(prev, end);
+
+            state = atomic_exchange(&s->state, SLOT_FREE);
+            if (state & SLOT_WAITER)
+                syscall(SYS_futex, &s->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+            atomic_store(&l->published, ++seq);
+            s = &l->slots[seq & (SEQLOG_SLOTS - 1)];
+        }
+
+        atomic_store(&l->publishing, 0);
+    } while (atomic_load(&s->state) & SLOT_DONE);
+}
+
+/**
+ * @brief Wait until the packet ending at end is published, i.e. until
+ * the writers reserved before it are done copying.
+ *
+ * @return int 0 once published or -1 if the log broke first
+ */
+static int seqlog_wait_published(struct seqlog *l, struct seqlog_slot *s, uint64_t end)
+{
+    int spins = 0;
+    unsigned int state;
+
+    while (atomic_load_explicit(&l->committed, memory_order_acquire) < end) {
+        if (atomic_load(&l->broken))
+            return -1;
+        if (++spins < WAIT_SPINS)
+            continue;
+
+        state = SLOT_DONE;
+        if (atomic_compare_exchange_strong(&s->state, &state, SLOT_DONE | SLOT_WAITER) ||
+            state == (SLOT_DONE | SLOT_WAITER))
+            syscall(SYS_futex, &s->state, FUTEX_WAIT_PRIVATE, SLOT_DONE | SLOT_WAITER,
+                    NULL, NULL, 0);
+    }
+
+    return 0;
+}
+
+void seqlog_reset(struct seqlog *l, uint64_t len, uint64_t backed)
+{
+    atomic_store(&l->backed, backed);
+    atomic_store(&l->reserved, len);
+    atomic_store(&l->committed, len);
+    atomic_store(&l->published, 0);
+    atomic_store(&l->broken, 0);
+    atomic_store(&l->publishing, 0);
+    memset(l->slots, 0, sizeof(l->slots));
+}
+
+int seqlog_append(struct seqlog *l, const char *buf, size_t len)
+{
+    uint64_t seq, start, t0;
+    struct seqlog_slot *s;
+
+    t0 = metrics_now_ns();
+
+    if (atomic_load(&l->broken))
+        return -1;
+
+    if (seqlog_reserve(l, len, &seq, &start) != 0)
+        return -1;
+
+    /* only as many writers as threads are ever in flight, far fewer
+     * than SEQLOG_SLOTS, so this practically never waits */
+    while (((seq - atomic_load(&l->published)) & SEQ_MASK) >= SEQLOG_SLOTS) {
+        if (atomic_load(&l->broken))
+            return -1;
+        sched_yield();
+    }
+
+    l->ops->copy(start, buf, len);
+
+    s = &l->slots[seq & (SEQLOG_SLOTS - 1)];
+    s->end = start + len;
+    atomic_store_explicit(&s->state, SLOT_DONE, memory_order_release);
+
+    seqlog_publish(l);
+
+    /* the client echoes the log right after, its packet must be there */
+    if (seqlog_wait_published(l, s, start + len) != 0)
+        return -1;
+
+    metrics_observe_write(metrics_now_ns() - t0);
+
+    return 0;
+}
+
+uint64_t seqlog_size(struct seqlog *l)
+{
+    return atomic_load_explicit(&l->committed, memory_order_acquire);
+}
+
+/**
+ * @brief Flusher thread function.
+ *
+ * @param thread_param struct seqlog data
+ * @return void* returns NULL
+ */
+static void *flush_func(void *thread_param)
+{
+    struct seqlog *l = (struct seqlog *) thread_param;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&l->flush_lock);
+
+    while (!l->stopping) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (l->flush_period_ms % 1000) * 1000000;
+        deadline.tv_sec += (l->flush_period_ms / 1000) + (deadline.tv_nsec / 1000000000);
+        deadline.tv_nsec %= 1000000000;
+        while (!l->stopping &&
+               pthread_cond_timedwait(&l->flush_cond, &l->flush_lock, &deadline) != ETIMEDOUT)
+            ;
+        if (l->stopping)
+            break;
+
+        pthread_mutex_unlock(&l->flush_lock);
+        l->ops->flush();
+        pthread_mutex_lock(&l->flush_lock);
+    }
+
+    pthread_mutex_unlock(&l->flush_lock);
+
+    return NULL;
+}
+
+int seqlog_start_flusher(struct seqlog *l, long flush_ms)
+{
+    int rc;
+    pthread_condattr_t attr;
+
+    l->flush_period_ms = flush_ms;
+    l->stopping = 0;
+
+    if (flush_ms <= 0)
+        return 0;
+
+    pthread_mutex_init(&l->flush_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&l->flush_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    rc = spawn_service_thread(&l->flusher, flush_func, l);
+
+    if (rc != 0) {
+        syslog(LOG_ERR, "failed to create flusher thread: %s", strerror(rc));
+        pthread_cond_destroy(&l->flush_cond);
+        pthread_mutex_destroy(&l->flush_lock);
+        return -1;
+    }
+    l->flushing = 1;
+
+    return 0;
+}
+
+void seqlog_stop_flusher(struct seqlog *l)
+{
+    if (!l->flushing)
+        return;
+
+    pthread_mutex_lock(&l->flush_lock);
+    l->stopping = 1;
+    pthread_cond_signal(&l->flush_cond);
+    pthread_mutex_unlock(&l->flush_lock);
+
+    pthread_join(l->flusher, NULL);
+    pthread_cond_destroy(&l->flush_cond);
+    pthread_mutex_destroy(&l->flush_lock);
+    l->flushing = 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file    seqlog.h
+ *
+ * @brief   Lockless reservation and in-order publication shared by the
+ *          append-only logs, memlog and mmaplog.
+ *
+ * A writer reserves its range of the log and a sequence number at once,
+ * both packed in one reservation word, copies its packet concurrently
+ * with the other writers and marks its slot of a ring done. Whichever
+ * writer gets to publish advances the published length over every done
+ * slot in sequence order, so no writer waits for its turn to publish; it
+ * only waits, asleep on a futex if need be, until its own packet is
+ * published. Readers only look below the published length, which
+ * therefore always ends on a packet boundary.
+ *
+ * Where the bytes live is up to the log, through its struct seqlog_ops.
+ * A log either grows before reserving with a compare-and-swap, so a
+ * failure leaves no hole, or reserves with a single fetch-and-add and
+ * grows afterwards; a reservation it then cannot back is a hole the
+ * publication never gets past, so the log breaks and every later append
+ * fails.
+ *
+ * A flusher thread calls the log's flush() every period.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef SEQLOG_H
+#define SEQLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define SEQLOG_SLOTS            4096    /* writers between reservation and publication */
+
+/* a reservation copied into the log, published in sequence order */
+struct seqlog_slot {
+    uint64_t end;
+    atomic_uint state;          /* SLOT_* bits, futex word */
+};
+
+/* where a log keeps its bytes, see memlog.c and mmaplog.c */
+struct seqlog_ops {
+    int fetch_add;      /* reserve first, break the log if it cannot grow */
+
+    /**
+     * @brief Back at least need bytes of log and store the new length
+     * in backed.
+     *
+     * @return int 0 on success or -1 on failure
+     */
+    int (*grow)(uint64_t need);
+
+    /**
+     * @brief Copy a packet into its reserved range.
+     */
+    void (*copy)(uint64_t offset, const char *buf, size_t len);
+
+    /**
+     * @brief Pass bytes just published on to the subscribers' tail.
+     */
+    void (*publish)(uint64_t from, uint64_t to);
+
+    /**
+     * @brief Flush the published bytes, called by the flusher thread.
+     *
+     * @return int 0 on success or -1 on failure
+     */
+    int (*flush)(void);
+};
+
+struct seqlog {
+    const struct seqlog_ops *ops;
+    atomic_uint_fast64_t backed;    /* log bytes backed by storage */
+    atomic_uint_fast64_t reserved;  /* next sequence number and offset */
+    atomic_uint_fast64_t committed; /* bytes readers may access */
+    atomic_uint_fast64_t published; /* sequence numbers published */
+    atomic_int broken;              /* a reservation could not be backed */
+    atomic_int publishing;          /* a writer is publishing */
+    struct seqlog_slot slots[SEQLOG_SLOTS];
+
+    pthread_t flusher;
+    pthread_mutex_t flush_lock;
+    pthread_cond_t flush_cond;      /* on CLOCK_MONOTONIC */
+    int stopping;
+    int flushing;
+    long flush_period_ms;
+};
+
+/**
+ * @brief Start the log over at len bytes, backed bytes of storage
+ * available, nothing in flight. No writer may be running.
+ *
+ * @param l log
+ * @param len published length
+ * @param backed length of the storage already backed
+ */
+void seqlog_reset(struct seqlog *l, uint64_t len, uint64_t backed);
+
+/**
+ * @brief Reserve, copy and publish a packet and wait until it is
+ * published, so the client can echo the log right after.
+ *
+ * @param l log
+ * @param buf packet
+ * @param len packet length
+ * @return int 0 on success or -1 if the log cannot grow
+ */
+int seqlog_append(struct seqlog *l, const char *buf, size_t len);
+
+/**
+ * @brief Published length of the log.
+ *
+ * @param l log
+ * @return uint64_t bytes readers may access
+ */
+uint64_t seqlog_size(struct seqlog *l);
+
+/**
+ * @brief Start the flusher thread.
+ *
+ * @param l log
+ * @param flush_ms flush period, 0 to start none
+ * @return int 0 on success or -1 on failure
+ */
+int seqlog_start_flusher(struct seqlog *l, long flush_ms);
+
+/**
+ * @brief Stop the flusher thread, if any, without a last flush.
+ *
+ * @param l log
+ */
+void seqlog_stop_flusher(struct seqlog *l);
+
+#endif /* SEQLOG_H */
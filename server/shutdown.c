@@ -0,0 +1,314 @@
+/**
+ * @file    shutdown.c
+ *
+ * @brief   Graceful shutdown: shutdown eventfd, drain deadline and the
+ *          drain thread of the blocking connections.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "aesdsocket.h"
+#include "shutdown.h"
+#include "metrics.h"
+
+static int efd = -1;            /* readable once a shutdown is requested */
+static int expire_fd = -1;      /* readable once asked to stop draining */
+static int kick_fd = -1;        /* wakes the drain thread */
+static long drain_period_ms = SHUTDOWN_DRAIN_MS;
+
+/* CLOCK_MONOTONIC ns, 0 until a shutdown is requested */
+static atomic_uint_fast64_t requested_ns;
+static atomic_uint_fast64_t deadline_ns;
+
+static atomic_int forced;
+
+/* connections of the blocking threads */
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(, shutdown_conn) conns = LIST_HEAD_INITIALIZER(conns);
+static int nconns;
+
+static pthread_t drainer;
+static int draining;            /* drain thread running */
+static atomic_int stopping;
+
+static void kick(void)
+{
+    uint64_t one = 1;
+    ssize_t rc;
+
+    rc = write(kick_fd, &one, sizeof(one));
+    (void) rc;
+}
+
+/**
+ * @brief Shut down every registered connection.
+ *
+ * @param how SHUT_RD or SHUT_RDWR
+ * @return int number of connections
+ */
+static int conns_shutdown(int how)
+{
+    int n;
+    struct shutdown_conn *c;
+
+    pthread_mutex_lock(&conns_lock);
+    LIST_FOREACH(c, &conns, conns)
+        shutdown(c->fd, how);
+    n = nconns;
+    pthread_mutex_unlock(&conns_lock);
+
+    return n;
+}
+
+/**
+ * @brief Drain thread function: once a shutdown is requested, wakes the
+ * blocking threads out of recv(), waits for their connections to close
+ * and cuts off whatever is left at the deadline.
+ *
+ * @param thread_param unused
+ * @return void* returns NULL
+ */
+static void *drain_func(void *thread_param)
+{
+    int n;
+    uint64_t cnt;
+    ssize_t rc;
+    struct pollfd pfd;
+
+    (void) thread_param;
+
+    pfd.fd = kick_fd;
+    pfd.events = POLLIN;
+
+    /* the request may predate this thread, so look before sleeping */
+    while (atomic_load(&requested_ns) == 0 && !atomic_load(&stopping)) {
+        if (poll(&pfd, 1, -1) == 1)
+            rc = read(kick_fd, &cnt, sizeof(cnt));
+    }
+    if (atomic_load(&stopping))
+        return NULL;
+
+    conns_shutdown(SHUT_RD);
+
+    /* woken by the last connection to go or by a second request */
+    while (!atomic_load(&stopping)) {
+        pthread_mutex_lock(&conns_lock);
+        n = nconns;
+        pthread_mutex_unlock(&conns_lock);
+        if (n == 0 || shutdown_expired())
+            break;
+
+        if (poll(&pfd, 1, shutdown_timeout_ms(-1)) == 1)
+            rc = read(kick_fd, &cnt, sizeof(cnt));
+    }
+    (void) rc;
+
+    n = conns_shutdown(SHUT_RDWR);
+    if (n > 0)
+        shutdown_forced(n);
+
+    return NULL;
+}
+
+int spawn_service_thread(pthread_t *tid, void *(*func)(void *), void *arg)
+{
+    int rc;
+    sigset_t set, oldset;
+
+    /* the new thread inherits the mask, restored right after for the caller */
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, &oldset);
+    rc = pthread_create(tid, NULL, func, arg);
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+    return rc;
+}
+
+int shutdown_init(long drain_ms)
+{
+    int rc;
+    uint64_t one = 1;
+
+    drain_period_ms = (drain_ms < 0) ? 0 : drain_ms;
+    atomic_store(&forced, 0);
+    atomic_store(&stopping, 0);
+
+    efd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+    expire_fd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+    kick_fd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+    if (efd == -1 || expire_fd == -1 || kick_fd == -1) {
+        syslog(LOG_ERR, "failed to create shutdown eventfd: %s", strerror(errno));
+        goto error;
+    }
+
+    /* a request that came before efd existed could not signal it */
+    if (atomic_load(&requested_ns) != 0) {
+        kick();
+        rc = write(efd, &one, sizeof(one));
+    }
+
+    rc = spawn_service_thread(&drainer, drain_func, NULL);
+
+    if (rc != 0) {
+        syslog(LOG_ERR, "failed to create drain thread");
+        goto error;
+    }
+    draining = 1;
+
+    return 0;
+
+error:
+    if (efd != -1)
+        close(efd);
+    if (expire_fd != -1)
+        close(expire_fd);
+    if (kick_fd != -1)
+        close(kick_fd);
+    efd = -1;
+    expire_fd = -1;
+    kick_fd = -1;
+
+    return -1;
+}
+
+void shutdown_cleanup(void)
+{
+    uint64_t t0;
+
+    if (draining) {
+        atomic_store(&stopping, 1);
+        kick();
+        pthread_join(drainer, NULL);
+        draining = 0;
+    }
+
+    t0 = atomic_load(&requested_ns);
+    if (t0 != 0)
+        syslog(LOG_INFO, "shutdown took %llu ms, %d connections forced",
+               (unsigned long long) ((metrics_now_ns() - t0) / 1000000),
+               atomic_load(&forced));
+
+    if (efd != -1)
+        close(efd);
+    if (expire_fd != -1)
+        close(expire_fd);
+    if (kick_fd != -1)
+        close(kick_fd);
+    efd = -1;
+    expire_fd = -1;
+    kick_fd = -1;
+}
+
+void shutdown_request(void)
+{
+    uint64_t one = 1, now = metrics_now_ns();
+    uint_fast64_t expected = 0;
+    ssize_t rc;
+
+    caught_signal = 1;
+
+    if (atomic_compare_exchange_strong(&requested_ns, &expected, now)) {
+        atomic_store(&deadline_ns, now + (uint64_t) drain_period_ms * 1000000);
+    } else {
+        /* asked twice, stop draining */
+        atomic_store(&deadline_ns, now);
+        if (expire_fd != -1)
+            rc = write(expire_fd, &one, sizeof(one));
+    }
+
+    if (efd != -1)
+        rc = write(efd, &one, sizeof(one));
+    if (kick_fd != -1)
+        rc = write(kick_fd, &one, sizeof(one));
+    (void) rc;
+}
+
+int shutdown_fd(void)
+{
+    return efd;
+}
+
+int shutdown_expire_fd(void)
+{
+    return expire_fd;
+}
+
+int shutdown_timeout_ms(int timeout_ms)
+{
+    uint64_t now, deadline;
+    uint64_t left_ms;
+
+    if (atomic_load(&requested_ns) == 0)
+        return timeout_ms;
+
+    now = metrics_now_ns();
+    deadline = atomic_load(&deadline_ns);
+    if (now >= deadline)
+        return 0;
+
+    /* round up, a poll() must not time out before the deadline */
+    left_ms = (deadline - now + 999999) / 1000000;
+    if (timeout_ms >= 0 && left_ms > (uint64_t) timeout_ms)
+        return timeout_ms;
+
+    return (left_ms > INT32_MAX) ? INT32_MAX : (int) left_ms;
+}
+
+int shutdown_expired(void)
+{
+    return atomic_load(&requested_ns) != 0 &&
+           metrics_now_ns() >= atomic_load(&deadline_ns);
+}
+
+void shutdown_conn_add(struct shutdown_conn *c, int fd)
+{
+    c->fd = fd;
+
+    pthread_mutex_lock(&conns_lock);
+    LIST_INSERT_HEAD(&conns, c, conns);
+    nconns++;
+    /* accepted just as the drain thread went through the list */
+    if (atomic_load(&requested_ns) != 0)
+        shutdown(fd, shutdown_expired() ? SHUT_RDWR : SHUT_RD);
+    pthread_mutex_unlock(&conns_lock);
+}
+
+void shutdown_conn_remove(struct shutdown_conn *c)
+{
+    pthread_mutex_lock(&conns_lock);
+    LIST_REMOVE(c, conns);
+    nconns--;
+    if (nconns == 0 && atomic_load(&requested_ns) != 0)
+        kick();
+    pthread_mutex_unlock(&conns_lock);
+}
+
+void shutdown_forced(int n)
+{
+    atomic_fetch_add(&forced, n);
+}
@@ -0,0 +1,135 @@
+/**
+ * @file    shutdown.h
+ *
+ * @brief   Graceful shutdown of aesdsocket.
+ *
+ * SIGINT or SIGTERM makes shutdown_fd(), an eventfd every blocking
+ * thread and event loop polls alongside its own descriptors, readable
+ * for good, so nothing waits for a poll timeout to notice. From then on
+ * no connection is accepted and the connections still open get a drain
+ * period, -D milliseconds, to finish what they have already received:
+ *
+ *  - connections served by a blocking thread register themselves here;
+ *    a drain thread shuts down their receiving side so a blocked recv()
+ *    returns, and once the deadline passes shuts them down completely;
+ *  - the event loops stop reading their connections and close each one
+ *    as soon as its last packet is echoed, or at the deadline.
+ *
+ * A second signal ends the drain period at once, making
+ * shutdown_expire_fd() readable for the loops waiting on a deadline.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef SHUTDOWN_H
+#define SHUTDOWN_H
+
+#include <pthread.h>
+
+#include "queue.h"
+
+#define SHUTDOWN_DRAIN_MS       2000    /* default drain period */
+
+/* a connection served by a blocking thread */
+struct shutdown_conn {
+    int fd;
+    LIST_ENTRY(shutdown_conn) conns;
+};
+
+/**
+ * @brief Start a thread serving the rest of the server, which leaves
+ * SIGINT & SIGTERM to interrupt the accept loop.
+ *
+ * @param tid set to the new thread
+ * @param func thread function
+ * @param arg argument of func
+ * @return int 0 on success or the error number of pthread_create()
+ */
+int spawn_service_thread(pthread_t *tid, void *(*func)(void *), void *arg);
+
+/**
+ * @brief Create shutdown_fd() and start the drain thread.
+ *
+ * @param drain_ms how long open connections may take to finish
+ * @return int 0 on success or -1 on failure
+ */
+int shutdown_init(long drain_ms);
+
+/**
+ * @brief Stop the drain thread, log how long the shutdown took and close
+ * shutdown_fd(). No connection may still be registered.
+ */
+void shutdown_cleanup(void);
+
+/**
+ * @brief Set caught_signal, start the drain period, or end it if it has
+ * already started, and make shutdown_fd() readable. Async-signal-safe.
+ */
+void shutdown_request(void);
+
+/**
+ * @brief Descriptor that becomes readable, and stays so, once a shutdown
+ * is requested.
+ *
+ * @return int eventfd, never to be read
+ */
+int shutdown_fd(void);
+
+/**
+ * @brief Descriptor that becomes readable, and stays so, once a second
+ * request ends the drain period early.
+ *
+ * @return int eventfd, never to be read
+ */
+int shutdown_expire_fd(void);
+
+/**
+ * @brief Bound a poll timeout by the drain deadline.
+ *
+ * @param timeout_ms timeout the caller would use, -1 for none
+ * @return int timeout_ms before a shutdown is requested, then at most the
+ * milliseconds left to the deadline, 0 once it has passed
+ */
+int shutdown_timeout_ms(int timeout_ms);
+
+/**
+ * @brief Whether the drain deadline has passed.
+ *
+ * @return int 1 if it has, 0 otherwise
+ */
+int shutdown_expired(void);
+
+/**
+ * @brief Register a connection served by a blocking thread. If a
+ * shutdown is already under way, its receiving side, or all of it past
+ * the deadline, is shut down right away.
+ *
+ * @param c registration, owned by the caller until shutdown_conn_remove()
+ * @param fd client socket
+ */
+void shutdown_conn_add(struct shutdown_conn *c, int fd);
+
+/**
+ * @brief Unregister a connection before it is closed.
+ *
+ * @param c registration
+ */
+void shutdown_conn_remove(struct shutdown_conn *c);
+
+/**
+ * @brief Account for connections closed at the deadline with work left.
+ *
+ * @param n number of connections
+ */
+void shutdown_forced(int n);
+
+#endif /* SHUTDOWN_H */
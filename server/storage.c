@@ -0,0 +1,374 @@
+/**
+ * @file    storage.c
+ *
+ * @brief   Long-lived, reference-counted handle to *log_file, and the
+ *          code its backends share.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdatomic.h>
+
+#include "aesdsocket.h"
+#include "storage.h"
+#include "command.h"
+#include "bufpool.h"
+#include "metrics.h"
+#include "lockstat.h"
+#include "tail.h"
+
+static pthread_mutex_t storage_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct storage_handle *current = NULL;
+static volatile sig_atomic_t reopen_requested = 0;
+static atomic_int zerocopy = 1;
+static const struct storage_ops *backend = NULL;
+static off_t start_size = 0;       /* log size when the tail started */
+
+static const struct storage_ops *const backends[] = {
+    &storage_chardev_ops,
+    &storage_file_ops,
+    &storage_memory_ops,
+    &storage_mmap_ops,
+};
+
+const struct storage_ops *storage_find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i]->name, name) == 0)
+            return backends[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Open *log_file into a new handle holding the "current" reference.
+ *
+ * @return struct storage_handle* the handle, or NULL on failure
+ */
+static struct storage_handle *storage_open(void)
+{
+    struct storage_handle *h;
+
+    h = (struct storage_handle *) calloc(1, sizeof(struct storage_handle));
+    if (h == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for storage handle: %s", strerror(errno));
+        return NULL;
+    }
+    h->refcnt = 1;
+    h->fd = -1;
+    h->ops = backend;
+
+    if (backend->open(h) != 0) {
+        free(h);
+        return NULL;
+    }
+
+    return h;
+}
+
+/**
+ * @brief Drop a reference, storage_lock must be held.
+ *
+ * @param h handle
+ */
+static void storage_put_locked(struct storage_handle *h)
+{
+    if (--h->refcnt == 0) {
+        if (h->fd != -1)
+            close(h->fd);
+        free(h);
+    }
+}
+
+int storage_init(const struct storage_ops *ops, long flush_ms)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&storage_lock);
+    if (current == NULL) {
+        backend = ops;
+        if (backend->init != NULL)
+            rc = backend->init(flush_ms);
+        if (rc == 0) {
+            current = storage_open();
+            if (current == NULL) {
+                if (backend->cleanup != NULL)
+                    backend->cleanup();
+                rc = -1;
+            } else if (backend->lockless) {
+                /* e.g. a log recovered from a previous run */
+                start_size = backend->size(current);
+            }
+        }
+    }
+    pthread_mutex_unlock(&storage_lock);
+
+    return rc;
+}
+
+const struct storage_ops *storage_get_ops(void)
+{
+    return backend;
+}
+
+void storage_cleanup(void)
+{
+    pthread_mutex_lock(&storage_lock);
+    if (current != NULL) {
+        storage_flush(current);
+        storage_put_locked(current);
+        current = NULL;
+        if (backend->cleanup != NULL)
+            backend->cleanup();
+    }
+    pthread_mutex_unlock(&storage_lock);
+}
+
+struct storage_handle *storage_acquire(void)
+{
+    struct storage_handle *h;
+
+    pthread_mutex_lock(&storage_lock);
+
+    if (reopen_requested || current == NULL) {
+        reopen_requested = 0;
+        h = storage_open();
+        if (h != NULL) {
+            syslog(LOG_INFO, "reopened %s", log_file);
+            if (current != NULL)
+                storage_put_locked(current);
+            current = h;
+        }
+        /* on failure keep writing to the previous descriptor, if any */
+    }
+
+    h = current;
+    if (h != NULL)
+        h->refcnt++;
+
+    pthread_mutex_unlock(&storage_lock);
+
+    return h;
+}
+
+void storage_release(struct storage_handle *h)
+{
+    if (h == NULL)
+        return;
+
+    pthread_mutex_lock(&storage_lock);
+    storage_put_locked(h);
+    pthread_mutex_unlock(&storage_lock);
+}
+
+void storage_request_reopen(void)
+{
+    reopen_requested = 1;
+}
+
+off_t storage_apply(struct storage_handle *h, const char *pkt, size_t len,
+                    const struct command *cmd, pthread_mutex_t *mutex)
+{
+    off_t pos;
+
+    /* without AESDCHAR_IOCSEEKTO support, commands are logged as data */
+    if (!command_is_data(cmd, h->ops->seek_to_cmd != NULL)) {
+        if (cmd->id == CMD_INVALID) {
+            syslog(LOG_ERR, "malformed command %.*s", (int) (len - 1), pkt);
+            return 0;
+        }
+
+        /* handle AESDCHAR_IOCSEEKTO:X,Y */
+        if (cmd->id == CMD_SEEKTO) {
+            metrics_add(METRIC_SEEKS, 1);
+            pos = h->ops->seek_to_cmd(h, cmd->args[0], cmd->args[1], mutex);
+            if (pos == -1)
+                syslog(LOG_ERR, "invalid seek to command %u offset %u", cmd->args[0], cmd->args[1]);
+            return (pos == -1) ? 0 : pos;
+        }
+
+        /* a subscriber asking again, nothing to log */
+        return 0;
+    }
+
+    /* write packet to log file, echo from the start */
+    if (h->ops->append(h, pkt, len, mutex) != 0)
+        return -1;
+    metrics_add(METRIC_PACKETS, 1);
+
+    return 0;
+}
+
+ssize_t storage_read(struct storage_handle *h, char *buf, size_t len, off_t offset)
+{
+    return h->ops->read_range(h, buf, len, offset);
+}
+
+off_t storage_size(struct storage_handle *h)
+{
+    return h->ops->size(h);
+}
+
+int storage_flush(struct storage_handle *h)
+{
+    return h->ops->flush(h);
+}
+
+ssize_t storage_append(struct storage_handle *h, const char *buf, size_t len,
+                       pthread_mutex_t *mutex)
+{
+    ssize_t rc;
+
+    if (h->ops->lockless)
+        return (h->ops->append(h, buf, len, NULL) == 0) ? (ssize_t) len : -1;
+
+    if (lockstat_lock(mutex, LOCKSTAT_TIMESTAMP) != 0) {
+        syslog(LOG_ERR, "failed to lock mutex object before writing to %s", log_file);
+        return -1;
+    }
+
+    rc = write(h->fd, buf, len);
+    if (rc > 0)
+        tail_append(buf, rc);
+
+    lockstat_unlock(mutex);
+
+    return rc;
+}
+
+off_t storage_sub_init(struct storage_handle *h, struct tail_sub *sub, struct tail_waiter *w,
+                       pthread_mutex_t *mutex)
+{
+    off_t end;
+    uint64_t pos;
+
+    /* a lockless log publishes each packet before appending it to the
+     * tail, which started along with the log at start_size, so the tail
+     * position is an offset the log already holds */
+    if (h->ops->lockless) {
+        pos = tail_sub_init(sub, w);
+        return start_size + pos;
+    }
+
+    lockstat_lock(mutex, LOCKSTAT_SUBSCRIBE);
+    tail_sub_init(sub, w);
+    end = storage_size(h);
+    lockstat_unlock(mutex);
+
+    return end;
+}
+
+void storage_tx_init(struct storage_tx *tx)
+{
+    memset(tx, 0, sizeof(*tx));
+    tx->pipefd[0] = tx->pipefd[1] = -1;
+    tx->end = -1;
+}
+
+size_t storage_tx_want(struct storage_tx *tx, off_t offset, size_t max)
+{
+    if (tx->end == -1)
+        return max;
+    if (offset >= tx->end)
+        return 0;
+
+    return ((size_t) (tx->end - offset) < max) ? (size_t) (tx->end - offset) : max;
+}
+
+void storage_tx_free(struct storage_tx *tx)
+{
+    if (tx->pipefd[0] != -1) {
+        close(tx->pipefd[0]);
+        close(tx->pipefd[1]);
+    }
+    bufpool_free(tx->buf, tx->buf_size);
+    storage_tx_init(tx);
+}
+
+void storage_disable_zerocopy(void)
+{
+    atomic_store(&zerocopy, 0);
+}
+
+/**
+ * @brief Echo through a userspace buffer, echo_block_len bytes at a time.
+ *
+ * @return int 1 when done, 0 if the socket would block or -1 on failure
+ */
+static int storage_send_copy(struct storage_handle *h, struct storage_tx *tx, int sockfd,
+                             off_t *offset)
+{
+    ssize_t rc;
+
+    if (tx->buf == NULL) {
+        tx->buf = bufpool_alloc(echo_block_len, &tx->buf_size);
+        if (tx->buf == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for echo buffer");
+            return -1;
+        }
+    }
+
+    for (;;) {
+        if (tx->off == tx->len) {
+            rc = storage_read(h, tx->buf, storage_tx_want(tx, *offset, echo_block_len), *offset);
+            if (rc == -1)
+                return -1;
+            tx->len = tx->off = 0;
+            if (rc == 0)
+                return 1;
+            *offset += rc;
+            tx->len = rc;
+        }
+
+        rc = send(sockfd, tx->buf + tx->off, tx->len - tx->off, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        metrics_add(METRIC_BYTES_OUT, rc);
+        tx->off += rc;
+    }
+}
+
+int storage_send(struct storage_handle *h, struct storage_tx *tx, int sockfd, off_t *offset)
+{
+    int rc;
+
+    /* finish whatever the previous method left in flight */
+    if (h->ops->send != NULL &&
+        (tx->piped != 0 || (tx->off == tx->len && atomic_load(&zerocopy)))) {
+        rc = h->ops->send(h, tx, sockfd, offset);
+        if (rc != -1 || (errno != EINVAL && errno != ENOSYS) || tx->piped != 0)
+            return rc;
+
+        /* e.g. a driver without splice_read, nothing has been sent yet */
+        if (atomic_exchange(&zerocopy, 0))
+            syslog(LOG_WARNING, "%s does not support zero-copy, falling back to copying", log_file);
+    }
+
+    return storage_send_copy(h, tx, sockfd, offset);
+}
@@ -0,0 +1,335 @@
+/**
+ * @file    storage.h
+ *
+ * @brief   Long-lived, reference-counted handle to *log_file.
+ *
+ * *log_file is opened once and the descriptor is shared by every client
+ * and the timer thread, so the packet path does not open() or close()
+ * anything. Writers append with O_APPEND and readers use pread(), so a
+ * shared file offset never matters. After storage_request_reopen() the
+ * next storage_acquire() opens *log_file again, which follows a rotated
+ * log; the previous descriptor is closed when its last user releases it.
+ *
+ * Where the log lives is up to a backend, chosen at runtime through its
+ * struct storage_ops: the char device, a regular file, memlog, which
+ * keeps the log in memory and only flushes it to *log_file periodically,
+ * or mmaplog, which appends to a memory-mapped *log_file.
+ * The code shared by all of them, applying commands, reopening and
+ * echoing, stays in storage.c and takes the writers' mutex only for
+ * backends which are not lockless.
+ *
+ * storage_send() streams the log to a client without copying it through
+ * userspace when the backend can: sendfile() for a regular file, splice()
+ * through a pipe for the char device, send() from the memlog segments or
+ * the mapping.
+ * It falls back to read_range()/send() blocks for files that support
+ * neither.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "command.h"
+#include "tail.h"
+
+struct storage_handle {
+    int fd;             /* -1 if the backend has no descriptor */
+    int refcnt;         /* users, plus one while this is the current handle */
+    const struct storage_ops *ops;
+};
+
+struct storage_tx;
+
+/* a log backend, see storage_fd.c, storage_mem.c and storage_mmap.c */
+struct storage_ops {
+    const char *name;   /* -B argument */
+    const char *path;   /* *log_file unless -f is given */
+    int timestamps;     /* the timer thread appends timestamps */
+    int lockless;       /* no writers' mutex, handles have no descriptor */
+    int short_read_end; /* a short read is the end of the log */
+
+    /**
+     * @brief Set the backend up before the first open(), optional.
+     *
+     * @param flush_ms flush period of a backend flushing in the background
+     * @return int 0 on success or -1 on failure
+     */
+    int (*init)(long flush_ms);
+
+    /**
+     * @brief Tear down what init() set up, once no handle is left,
+     * optional.
+     */
+    void (*cleanup)(void);
+
+    /**
+     * @brief Open *log_file, or follow it after a reopen request, into
+     * a new handle.
+     *
+     * @param h handle, fd set to -1
+     * @return int 0 on success or -1 on failure
+     */
+    int (*open)(struct storage_handle *h);
+
+    /**
+     * @brief Append a packet in one piece and copy it to the tail.
+     *
+     * @param h handle
+     * @param pkt bytes to append
+     * @param len number of bytes
+     * @param mutex serializes writers of *log_file, unused if lockless
+     * @return int 0 on success or -1 on failure
+     */
+    int (*append)(struct storage_handle *h, const char *pkt, size_t len,
+                  pthread_mutex_t *mutex);
+
+    /**
+     * @brief Read until buf is full or the end of the log is reached.
+     *
+     * @param h handle
+     * @param buf destination
+     * @param len size of buf
+     * @param offset offset to read from
+     * @return ssize_t bytes read or -1 on failure
+     */
+    ssize_t (*read_range)(struct storage_handle *h, char *buf, size_t len, off_t offset);
+
+    /**
+     * @brief Resolve an AESDCHAR_IOCSEEKTO command, NULL if the backend
+     * logs such packets as data.
+     *
+     * @param h handle
+     * @param write_cmd index of the packet, 0 for the first one
+     * @param write_cmd_offset offset inside that packet
+     * @param mutex serializes writers of *log_file
+     * @return off_t offset to echo from, or -1 if invalid
+     */
+    off_t (*seek_to_cmd)(struct storage_handle *h, uint32_t write_cmd,
+                         uint32_t write_cmd_offset, pthread_mutex_t *mutex);
+
+    /**
+     * @brief Current size of the log.
+     *
+     * @param h handle
+     * @return off_t size in bytes, or -1 on failure
+     */
+    off_t (*size)(struct storage_handle *h);
+
+    /**
+     * @brief Make what was appended so far durable.
+     *
+     * @param h handle
+     * @return int 0 on success or -1 on failure
+     */
+    int (*flush)(struct storage_handle *h);
+
+    /**
+     * @brief Zero-copy echo, NULL to always copy. Same contract as
+     * storage_send().
+     */
+    int (*send)(struct storage_handle *h, struct storage_tx *tx, int sockfd, off_t *offset);
+};
+
+extern const struct storage_ops storage_chardev_ops;
+extern const struct storage_ops storage_file_ops;
+extern const struct storage_ops storage_memory_ops;
+extern const struct storage_ops storage_mmap_ops;
+
+/* largest zero-copy request, the kernel caps sendfile() below 2 GiB anyway */
+#define STORAGE_SEND_CHUNK      (1 << 30)
+
+/* per-client state of an echo in progress, see storage_send() */
+struct storage_tx {
+    int pipefd[2];      /* splice() staging pipe, opened on first use */
+    size_t piped;       /* bytes in the pipe not sent yet */
+    char *buf;          /* echo_block_len bytes for the copy path */
+    size_t buf_size;    /* size of buf as allocated from bufpool */
+    size_t len;         /* bytes available in buf */
+    size_t off;         /* bytes of buf already sent */
+    off_t end;          /* offset to stop the echo at, -1 for the end */
+};
+
+/**
+ * @brief Look a backend up by name.
+ *
+ * @param name chardev, file, memory or mmap
+ * @return const struct storage_ops* the backend, or NULL if unknown
+ */
+const struct storage_ops *storage_find(const char *name);
+
+/**
+ * @brief Set a backend up and open its first handle.
+ *
+ * @param ops backend
+ * @param flush_ms flush period of the memory and mmap backends, 0 to
+ * flush only at exit
+ * @return int 0 on success or -1 on failure
+ */
+int storage_init(const struct storage_ops *ops, long flush_ms);
+
+/**
+ * @brief Backend chosen by storage_init().
+ *
+ * @return const struct storage_ops* backend, NULL before storage_init()
+ */
+const struct storage_ops *storage_get_ops(void);
+
+/**
+ * @brief Drop the current handle, its descriptor is closed once every
+ * user has released it.
+ */
+void storage_cleanup(void);
+
+/**
+ * @brief Take a reference to the current handle, opening *log_file
+ * again first if a reopen was requested.
+ *
+ * @return struct storage_handle* the handle, or NULL on failure
+ */
+struct storage_handle *storage_acquire(void);
+
+/**
+ * @brief Release a reference taken by storage_acquire().
+ *
+ * @param h handle
+ */
+void storage_release(struct storage_handle *h);
+
+/**
+ * @brief Ask for *log_file to be opened again, e.g. after log rotation.
+ * Async-signal-safe.
+ */
+void storage_request_reopen(void);
+
+/**
+ * @brief Append a client packet to *log_file, or apply it as an
+ * AESDCHAR_IOCSEEKTO command, and tell where the echo starts.
+ *
+ * @param h handle
+ * @param pkt packet, terminated by '\n'
+ * @param len packet length, including the trailing '\n'
+ * @param cmd the packet parsed by command_parse()
+ * @param mutex serializes writers of *log_file
+ * @return off_t offset to echo *log_file from, or -1 on failure
+ */
+off_t storage_apply(struct storage_handle *h, const char *pkt, size_t len,
+                    const struct command *cmd, pthread_mutex_t *mutex);
+
+/**
+ * @brief Read from *log_file until buf is full or the end is reached.
+ * The char device returns at most one write command per read, so a
+ * single pread() is not enough to fill a block.
+ *
+ * @param h handle
+ * @param buf destination
+ * @param len size of buf
+ * @param offset offset to read from
+ * @return ssize_t bytes read, less than len only at the end of
+ * *log_file, or -1 on failure
+ */
+ssize_t storage_read(struct storage_handle *h, char *buf, size_t len, off_t offset);
+
+/**
+ * @brief Current size of *log_file. Call with the writers' mutex held,
+ * the char device reports it by seeking the shared descriptor.
+ *
+ * @param h handle
+ * @return off_t size in bytes, or -1 on failure
+ */
+off_t storage_size(struct storage_handle *h);
+
+/**
+ * @brief Make everything appended to *log_file so far durable.
+ *
+ * @param h handle
+ * @return int 0 on success or -1 on failure
+ */
+int storage_flush(struct storage_handle *h);
+
+/**
+ * @brief Append bytes which are not a client packet, e.g. a timestamp,
+ * with a single write.
+ *
+ * @param h handle
+ * @param buf bytes to append
+ * @param len number of bytes
+ * @param mutex serializes writers of *log_file
+ * @return ssize_t bytes appended or -1 on failure
+ */
+ssize_t storage_append(struct storage_handle *h, const char *buf, size_t len,
+                       pthread_mutex_t *mutex);
+
+/**
+ * @brief Start a subscriber exactly where the history it is echoed first
+ * ends.
+ *
+ * @param h handle
+ * @param sub subscriber
+ * @param w waiter woken when the subscriber has news
+ * @param mutex serializes writers of *log_file
+ * @return off_t end of the history, or -1 on failure
+ */
+off_t storage_sub_init(struct storage_handle *h, struct tail_sub *sub, struct tail_waiter *w,
+                       pthread_mutex_t *mutex);
+
+/**
+ * @brief Prepare an echo state, no resources are allocated until used.
+ *
+ * @param tx echo state
+ */
+void storage_tx_init(struct storage_tx *tx);
+
+/**
+ * @brief Bytes to request from *log_file at offset.
+ *
+ * @param tx echo state
+ * @param offset next offset to echo
+ * @param max most bytes wanted
+ * @return size_t at most max, 0 once tx->end is reached
+ */
+size_t storage_tx_want(struct storage_tx *tx, off_t offset, size_t max);
+
+/**
+ * @brief Release the pipe and buffer of an echo state.
+ *
+ * @param tx echo state
+ */
+void storage_tx_free(struct storage_tx *tx);
+
+/**
+ * @brief Always echo through a userspace buffer, e.g. for comparison.
+ */
+void storage_disable_zerocopy(void);
+
+/**
+ * @brief Stream *log_file from *offset to its end, or to tx->end if
+ * set, into a client socket.
+ * On a non-blocking socket the echo can stop early, call again with the
+ * same tx and offset once the socket is writable.
+ *
+ * @param h handle
+ * @param tx echo state of the client
+ * @param sockfd client socket
+ * @param offset offset to echo from, advanced past the data read
+ * @return int 1 once the end of *log_file is sent, 0 if the socket would
+ * block or -1 on failure
+ */
+int storage_send(struct storage_handle *h, struct storage_tx *tx, int sockfd, off_t *offset);
+
+#endif /* STORAGE_H */
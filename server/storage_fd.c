@@ -0,0 +1,252 @@
+/**
+ * @file    storage_fd.c
+ *
+ * @brief   Log backends writing straight to *log_file: the aesdchar char
+ *          device and a regular file.
+ *
+ * Both share one descriptor opened with O_APPEND, append a packet with a
+ * single write() under the writers' mutex, or through the committer, and
+ * read with pread(). The char device additionally resolves
+ * AESDCHAR_IOCSEEKTO and is echoed with splice(), a regular file with
+ * sendfile().
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#define _GNU_SOURCE     /* splice() */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+
+#include "aesdsocket.h"
+#include "storage.h"
+#include "commit.h"
+#include "metrics.h"
+#include "lockstat.h"
+
+static int fd_open(struct storage_handle *h)
+{
+    h->fd = open(log_file, (O_CREAT | O_APPEND | O_RDWR | O_CLOEXEC), FILE_MODE);
+    if (h->fd == -1) {
+        syslog(LOG_ERR, "failed to open %s: %s", log_file, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int fd_append(struct storage_handle *h, const char *pkt, size_t len,
+                     pthread_mutex_t *mutex)
+{
+    return commit_write(h->fd, pkt, len, mutex);
+}
+
+/* the char device returns at most one write command per read, so a
+ * single pread() is not enough to fill a block */
+static ssize_t fd_read_range(struct storage_handle *h, char *buf, size_t len, off_t offset)
+{
+    ssize_t rc;
+    size_t cnt = 0;
+
+    while (cnt != len) {
+        rc = pread(h->fd, buf + cnt, len - cnt, offset + cnt);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (rc == 0)
+            break;
+        cnt += rc;
+    }
+
+    return cnt;
+}
+
+static off_t fd_size(struct storage_handle *h)
+{
+    struct stat statbuf;
+
+    if (fstat(h->fd, &statbuf) != 0) {
+        syslog(LOG_ERR, "failed to obtain information about %s", log_file);
+        return -1;
+    }
+
+    if (S_ISREG(statbuf.st_mode))
+        return statbuf.st_size;
+
+    /* the char device reports its size by seeking */
+    return lseek(h->fd, 0, SEEK_END);
+}
+
+static off_t chardev_seek_to_cmd(struct storage_handle *h, uint32_t write_cmd,
+                                 uint32_t write_cmd_offset, pthread_mutex_t *mutex)
+{
+    off_t pos = -1;
+    struct aesd_seekto seekto;
+
+    seekto.write_cmd = write_cmd;
+    seekto.write_cmd_offset = write_cmd_offset;
+
+    /* the descriptor is shared, read back the position the ioctl set
+     * before another client moves it */
+    if (lockstat_lock(mutex, LOCKSTAT_SEEK) != 0) {
+        syslog(LOG_ERR, "failed to lock mutex object before seeking %s", log_file);
+        return -1;
+    }
+
+    if (ioctl(h->fd, AESDCHAR_IOCSEEKTO, &seekto) != 0)
+        syslog(LOG_ERR, "failed to execute ioctl command for %s", log_file);
+    else
+        pos = lseek(h->fd, 0, SEEK_CUR);
+
+    lockstat_unlock(mutex);
+
+    return pos;
+}
+
+static int chardev_flush(struct storage_handle *h)
+{
+    /* every write lands in the driver's buffer, there is nothing to sync */
+    (void) h;
+    return 0;
+}
+
+static int file_flush(struct storage_handle *h)
+{
+    /* EINVAL when pointed at something unsyncable, e.g. with -f */
+    if (fdatasync(h->fd) != 0 && errno != EINVAL) {
+        syslog(LOG_ERR, "failed to sync %s: %s", log_file, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Echo with splice() through a pipe. sendfile() needs a source
+ * it can map page by page, a pipe takes whatever the driver reads.
+ *
+ * @return int 1 when done, 0 if the socket would block or -1 on failure
+ */
+static int chardev_send(struct storage_handle *h, struct storage_tx *tx, int sockfd,
+                        off_t *offset)
+{
+    ssize_t rc;
+    size_t want;
+    loff_t off;
+
+    if (tx->pipefd[0] == -1 && pipe2(tx->pipefd, O_CLOEXEC) != 0) {
+        syslog(LOG_ERR, "failed to create echo pipe: %s", strerror(errno));
+        return -1;
+    }
+
+    for (;;) {
+        /* the pipe is empty here, so this never blocks */
+        if (tx->piped == 0) {
+            want = storage_tx_want(tx, *offset, echo_block_len);
+            if (want == 0)
+                return 1;
+
+            off = *offset;
+            rc = splice(h->fd, &off, tx->pipefd[1], NULL, want, SPLICE_F_MOVE);
+            if (rc == 0)
+                return 1;
+            if (rc == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            *offset = off;
+            tx->piped = rc;
+        }
+
+        rc = splice(tx->pipefd[0], NULL, sockfd, NULL, tx->piped, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        metrics_add(METRIC_BYTES_OUT, rc);
+        tx->piped -= rc;
+    }
+}
+
+/**
+ * @brief Echo with sendfile(), straight from the page cache.
+ *
+ * @return int 1 when done, 0 if the socket would block or -1 on failure
+ */
+static int file_send(struct storage_handle *h, struct storage_tx *tx, int sockfd,
+                     off_t *offset)
+{
+    ssize_t rc;
+    size_t want;
+
+    for (;;) {
+        want = storage_tx_want(tx, *offset, STORAGE_SEND_CHUNK);
+        if (want == 0)
+            return 1;
+
+        rc = sendfile(sockfd, h->fd, offset, want);
+        if (rc == 0)
+            return 1;
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno != EINTR)
+                return -1;
+        } else {
+            metrics_add(METRIC_BYTES_OUT, rc);
+        }
+    }
+}
+
+const struct storage_ops storage_chardev_ops = {
+    .name = "chardev",
+    .path = "/dev/aesdchar",
+    .timestamps = 0,
+    .lockless = 0,
+    .short_read_end = 0,
+    .open = fd_open,
+    .append = fd_append,
+    .read_range = fd_read_range,
+    .seek_to_cmd = chardev_seek_to_cmd,
+    .size = fd_size,
+    .flush = chardev_flush,
+    .send = chardev_send,
+};
+
+const struct storage_ops storage_file_ops = {
+    .name = "file",
+    .path = "/var/tmp/aesdsocketdata",
+    .timestamps = 1,
+    .lockless = 0,
+    .short_read_end = 1,
+    .open = fd_open,
+    .append = fd_append,
+    .read_range = fd_read_range,
+    .seek_to_cmd = NULL,
+    .size = fd_size,
+    .flush = file_flush,
+    .send = file_send,
+};
@@ -0,0 +1,112 @@
+/**
+ * @file    storage_mem.c
+ *
+ * @brief   Log backend keeping the log in memlog, flushed to *log_file.
+ *
+ * Its handles have no descriptor: packets are appended without the
+ * writers' mutex and echoes are sent straight from the log segments.
+ * AESDCHAR_IOCSEEKTO packets are logged as data, as with a regular file,
+ * so every backend but the char device logs and echoes the same bytes.
+ * Opening a handle only makes the flusher follow *log_file again.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <errno.h>
+#include <sys/types.h>
+
+#include "storage.h"
+#include "metrics.h"
+#include "memlog.h"
+
+static int mem_open(struct storage_handle *h)
+{
+    (void) h;
+    memlog_request_reopen();
+    return 0;
+}
+
+static int mem_append(struct storage_handle *h, const char *pkt, size_t len,
+                      pthread_mutex_t *mutex)
+{
+    (void) h;
+    (void) mutex;
+    return memlog_append(pkt, len);
+}
+
+static ssize_t mem_read_range(struct storage_handle *h, char *buf, size_t len, off_t offset)
+{
+    (void) h;
+    return memlog_read(buf, len, offset);
+}
+
+static off_t mem_size(struct storage_handle *h)
+{
+    (void) h;
+    return memlog_size();
+}
+
+static int mem_flush(struct storage_handle *h)
+{
+    (void) h;
+    return memlog_flush();
+}
+
+/**
+ * @brief Echo with send() straight from the log segments.
+ *
+ * @return int 1 when done, 0 if the socket would block or -1 on failure
+ */
+static int mem_send(struct storage_handle *h, struct storage_tx *tx, int sockfd,
+                    off_t *offset)
+{
+    ssize_t rc;
+    size_t want;
+
+    (void) h;
+
+    for (;;) {
+        want = storage_tx_want(tx, *offset, STORAGE_SEND_CHUNK);
+        if (want == 0)
+            return 1;
+
+        rc = memlog_send(sockfd, *offset, want);
+        if (rc == 0)
+            return 1;
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno != EINTR)
+                return -1;
+        } else {
+            metrics_add(METRIC_BYTES_OUT, rc);
+            *offset += rc;
+        }
+    }
+}
+
+const struct storage_ops storage_memory_ops = {
+    .name = "memory",
+    .path = "/var/tmp/aesdsocketdata",
+    .timestamps = 1,
+    .lockless = 1,
+    .short_read_end = 1,
+    .init = memlog_init,
+    .cleanup = memlog_cleanup,
+    .open = mem_open,
+    .append = mem_append,
+    .read_range = mem_read_range,
+    .seek_to_cmd = NULL,
+    .size = mem_size,
+    .flush = mem_flush,
+    .send = mem_send,
+};
@@ -0,0 +1,111 @@
+/**
+ * @file    storage_mmap.c
+ *
+ * @brief   Log backend keeping the log in a memory-mapped *log_file.
+ *
+ * Like the in-memory log its handles have no descriptor, packets are
+ * appended without the writers' mutex and echoes are sent straight from
+ * the mapping. AESDCHAR_IOCSEEKTO packets are logged as data, as with a
+ * regular file. The mapping stays on the file mapped at start, a reopen
+ * does not follow a rotated *log_file.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <errno.h>
+#include <sys/types.h>
+
+#include "storage.h"
+#include "metrics.h"
+#include "mmaplog.h"
+
+static int mmap_open(struct storage_handle *h)
+{
+    (void) h;
+    return 0;
+}
+
+static int mmap_append(struct storage_handle *h, const char *pkt, size_t len,
+                       pthread_mutex_t *mutex)
+{
+    (void) h;
+    (void) mutex;
+    return mmaplog_append(pkt, len);
+}
+
+static ssize_t mmap_read_range(struct storage_handle *h, char *buf, size_t len, off_t offset)
+{
+    (void) h;
+    return mmaplog_read(buf, len, offset);
+}
+
+static off_t mmap_size(struct storage_handle *h)
+{
+    (void) h;
+    return mmaplog_size();
+}
+
+static int mmap_flush(struct storage_handle *h)
+{
+    (void) h;
+    return mmaplog_flush();
+}
+
+/**
+ * @brief Echo with send() straight from the mapping.
+ *
+ * @return int 1 when done, 0 if the socket would block or -1 on failure
+ */
+static int mmap_send(struct storage_handle *h, struct storage_tx *tx, int sockfd,
+                     off_t *offset)
+{
+    ssize_t rc;
+    size_t want;
+
+    (void) h;
+
+    for (;;) {
+        want = storage_tx_want(tx, *offset, STORAGE_SEND_CHUNK);
+        if (want == 0)
+            return 1;
+
+        rc = mmaplog_send(sockfd, *offset, want);
+        if (rc == 0)
+            return 1;
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno != EINTR)
+                return -1;
+        } else {
+            metrics_add(METRIC_BYTES_OUT, rc);
+            *offset += rc;
+        }
+    }
+}
+
+const struct storage_ops storage_mmap_ops = {
+    .name = "mmap",
+    .path = "/var/tmp/aesdsocketdata",
+    .timestamps = 1,
+    .lockless = 1,
+    .short_read_end = 1,
+    .init = mmaplog_init,
+    .cleanup = mmaplog_cleanup,
+    .open = mmap_open,
+    .append = mmap_append,
+    .read_range = mmap_read_range,
+    .seek_to_cmd = NULL,
+    .size = mmap_size,
+    .flush = mmap_flush,
+    .send = mmap_send,
+};
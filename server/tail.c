@@ -0,0 +1,253 @@
+/**
+ * @file    tail.c
+ *
+ * @brief   Shared in-memory copy of the newest *log_file bytes, followed by
+ *          subscribers.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "aesdsocket.h"
+#include "tail.h"
+#include "metrics.h"
+
+static pthread_mutex_t tail_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *ring = NULL;
+static size_t ring_size = 0;
+static uint64_t head = 0;
+static unsigned int nsubs = 0;     /* the ring is only written with subscribers */
+static LIST_HEAD(waiter_head, tail_waiter) waiters = LIST_HEAD_INITIALIZER(waiters);
+
+int tail_init(size_t capacity)
+{
+    pthread_mutex_lock(&tail_lock);
+    ring = (char *) malloc(capacity);
+    if (ring != NULL)
+        ring_size = capacity;
+    pthread_mutex_unlock(&tail_lock);
+
+    if (ring == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for subscriber log");
+        return -1;
+    }
+
+    return 0;
+}
+
+void tail_cleanup(void)
+{
+    pthread_mutex_lock(&tail_lock);
+    free(ring);
+    ring = NULL;
+    ring_size = 0;
+    pthread_mutex_unlock(&tail_lock);
+}
+
+void tail_append(const char *buf, size_t len)
+{
+    size_t at, n;
+    struct tail_waiter *w;
+
+    pthread_mutex_lock(&tail_lock);
+
+    if (ring == NULL) {
+        pthread_mutex_unlock(&tail_lock);
+        return;
+    }
+
+    head += len;
+
+    /* a subscriber starts at head, nobody reads these bytes back */
+    if (nsubs == 0) {
+        pthread_mutex_unlock(&tail_lock);
+        return;
+    }
+
+    /* only the newest ring_size bytes can ever be read back */
+    if (len > ring_size) {
+        buf += len - ring_size;
+        len = ring_size;
+    }
+
+    at = (head - len) % ring_size;
+    n = (len < ring_size - at) ? len : ring_size - at;
+    memcpy(ring + at, buf, n);
+    memcpy(ring, buf + n, len - n);
+
+    LIST_FOREACH(w, &waiters, waiters) {
+        if (w->nsubs > 0 && !w->pending) {
+            w->pending = 1;
+            eventfd_write(w->efd, 1);
+        }
+    }
+
+    pthread_mutex_unlock(&tail_lock);
+}
+
+uint64_t tail_head(void)
+{
+    uint64_t pos;
+
+    pthread_mutex_lock(&tail_lock);
+    pos = head;
+    pthread_mutex_unlock(&tail_lock);
+
+    return pos;
+}
+
+int tail_waiter_add(struct tail_waiter *w)
+{
+    w->efd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+    if (w->efd == -1) {
+        syslog(LOG_ERR, "failed to create subscriber eventfd: %s", strerror(errno));
+        return -1;
+    }
+    w->pending = 0;
+    w->nsubs = 0;
+
+    pthread_mutex_lock(&tail_lock);
+    LIST_INSERT_HEAD(&waiters, w, waiters);
+    pthread_mutex_unlock(&tail_lock);
+
+    return 0;
+}
+
+void tail_waiter_remove(struct tail_waiter *w)
+{
+    pthread_mutex_lock(&tail_lock);
+    LIST_REMOVE(w, waiters);
+    pthread_mutex_unlock(&tail_lock);
+
+    close(w->efd);
+}
+
+void tail_waiter_clear(struct tail_waiter *w)
+{
+    eventfd_t val;
+
+    pthread_mutex_lock(&tail_lock);
+    eventfd_read(w->efd, &val);
+    w->pending = 0;
+    pthread_mutex_unlock(&tail_lock);
+}
+
+uint64_t tail_sub_init(struct tail_sub *s, struct tail_waiter *w)
+{
+    memset(s, 0, sizeof(*s));
+    s->waiter = w;
+
+    /* counted along with the position, so every append it pushes is kept */
+    pthread_mutex_lock(&tail_lock);
+    s->pos = head;
+    w->nsubs++;
+    nsubs++;
+    pthread_mutex_unlock(&tail_lock);
+
+    return s->pos;
+}
+
+void tail_sub_free(struct tail_sub *s)
+{
+    if (s->waiter != NULL) {
+        pthread_mutex_lock(&tail_lock);
+        s->waiter->nsubs--;
+        nsubs--;
+        pthread_mutex_unlock(&tail_lock);
+        s->waiter = NULL;
+    }
+
+    free(s->buf);
+    s->buf = NULL;
+    s->len = s->off = 0;
+}
+
+/**
+ * @brief Copy the bytes following s->pos out of the ring.
+ *
+ * @return ssize_t bytes copied, 0 when caught up or -1 if they have
+ * been overwritten already
+ */
+static ssize_t tail_read(struct tail_sub *s, char *buf, size_t len)
+{
+    size_t at, n, first;
+
+    pthread_mutex_lock(&tail_lock);
+
+    if (ring == NULL || head - s->pos > ring_size) {
+        pthread_mutex_unlock(&tail_lock);
+        return -1;
+    }
+
+    n = head - s->pos;
+    if (n > len)
+        n = len;
+
+    at = s->pos % ring_size;
+    first = (n < ring_size - at) ? n : ring_size - at;
+    memcpy(buf, ring + at, first);
+    memcpy(buf + first, ring, n - first);
+    s->pos += n;
+
+    pthread_mutex_unlock(&tail_lock);
+
+    return n;
+}
+
+int tail_push(struct tail_sub *s, int sockfd)
+{
+    ssize_t rc;
+
+    if (s->buf == NULL) {
+        s->buf = (char *) malloc(echo_block_len);
+        if (s->buf == NULL) {
+            syslog(LOG_ERR, "failed to allocate memory for subscriber buffer");
+            return -1;
+        }
+    }
+
+    for (;;) {
+        if (s->off == s->len) {
+            rc = tail_read(s, s->buf, echo_block_len);
+            if (rc == -1) {
+                syslog(LOG_WARNING, "subscriber fell more than %zu bytes behind", ring_size);
+                return -1;
+            }
+            s->len = s->off = 0;
+            if (rc == 0)
+                return 1;
+            s->len = rc;
+        }
+
+        rc = send(sockfd, s->buf + s->off, s->len - s->off, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        metrics_add(METRIC_BYTES_OUT, rc);
+        s->off += rc;
+    }
+}
@@ -0,0 +1,138 @@
+/**
+ * @file    tail.h
+ *
+ * @brief   Shared in-memory copy of the newest *log_file bytes, followed by
+ *          subscribers.
+ *
+ * A client that sends "AESDSOCKET_SUBSCRIBE\n" receives the log once and afterwards
+ * only the bytes appended by any client, instead of the whole log after
+ * each of its own packets. Every append is copied into a ring of the
+ * newest tail_init() bytes, addressed by absolute position, and each
+ * subscriber pushes from its own position. A subscriber that falls a
+ * whole ring behind is disconnected. While nobody subscribes an append
+ * only advances the position, and only the waiters with subscribers are
+ * woken.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef TAIL_H
+#define TAIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "queue.h"
+
+#define TAIL_LOG_LEN            (1 << 20)
+
+/* wakes a thread or event loop once new bytes are appended */
+struct tail_waiter {
+    int efd;            /* eventfd, readable after an append */
+    int pending;        /* efd signalled and not cleared yet */
+    int nsubs;          /* subscribers pushed when it fires */
+    LIST_ENTRY(tail_waiter) waiters;
+};
+
+/* position and pending data of one subscriber */
+struct tail_sub {
+    uint64_t pos;       /* absolute position of the next byte to copy */
+    char *buf;          /* echo_block_len bytes, allocated on first push */
+    size_t len;         /* bytes available in buf */
+    size_t off;         /* bytes of buf already sent */
+    struct tail_waiter *waiter;     /* woken by appends, NULL once freed */
+};
+
+/**
+ * @brief Allocate the shared ring.
+ *
+ * @param capacity bytes kept for subscribers that lag behind
+ * @return int 0 on success or -1 on failure
+ */
+int tail_init(size_t capacity);
+
+/**
+ * @brief Free the shared ring.
+ */
+void tail_cleanup(void);
+
+/**
+ * @brief Copy bytes just written to *log_file into the ring and wake
+ * every waiter with subscribers, only advance the position if there are
+ * none. Call with the writers' mutex held so the ring keeps the order of
+ * *log_file.
+ *
+ * @param buf bytes written
+ * @param len number of bytes
+ */
+void tail_append(const char *buf, size_t len);
+
+/**
+ * @brief Position following the newest byte appended so far.
+ *
+ * @return uint64_t absolute position
+ */
+uint64_t tail_head(void);
+
+/**
+ * @brief Create the eventfd of a waiter and register it.
+ *
+ * @param w waiter
+ * @return int 0 on success or -1 on failure
+ */
+int tail_waiter_add(struct tail_waiter *w);
+
+/**
+ * @brief Unregister a waiter and close its eventfd.
+ *
+ * @param w waiter
+ */
+void tail_waiter_remove(struct tail_waiter *w);
+
+/**
+ * @brief Drain the eventfd of a waiter so the next append signals it
+ * again. Call before pushing to its subscribers.
+ *
+ * @param w waiter
+ */
+void tail_waiter_clear(struct tail_waiter *w);
+
+/**
+ * @brief Start a subscriber at the position following the newest byte
+ * appended, from which on appends are kept in the ring for it.
+ *
+ * @param s subscriber
+ * @param w waiter woken by appends, registered with tail_waiter_add()
+ * @return uint64_t first position to push, as tail_head() would return
+ */
+uint64_t tail_sub_init(struct tail_sub *s, struct tail_waiter *w);
+
+/**
+ * @brief Stop a subscriber started with tail_sub_init() and free its
+ * buffer, no-op for one that was not.
+ *
+ * @param s subscriber
+ */
+void tail_sub_free(struct tail_sub *s);
+
+/**
+ * @brief Send everything appended since the last push.
+ *
+ * @param s subscriber
+ * @param sockfd client socket
+ * @return int 1 once caught up, 0 if the socket would block or -1 on
+ * failure, including a subscriber overrun by the ring
+ */
+int tail_push(struct tail_sub *s, int sockfd);
+
+#endif /* TAIL_H */
@@ -0,0 +1,1179 @@
+/**
+ * @file    uring.c
+ *
+ * @brief   io_uring engine for aesdsocket client handling.
+ *
+ * The rings are driven with the raw io_uring_setup()/io_uring_enter()/
+ * io_uring_register() system calls, so there is no liburing dependency.
+ * Every thread owns a ring with:
+ *
+ *  - a fixed file table, slot URING_LOG_SLOT holding *log_file and the
+ *    other slots filled by accepting clients straight into the table;
+ *  - URING_BUFS registered echo buffers of echo_block_len bytes, which
+ *    log reads fill with IORING_OP_READ_FIXED.
+ *
+ * A client connection goes through:
+ *
+ *  RECV  - one IORING_OP_RECV into the framer at a time.
+ *  ECHO  - for each complete packet, an IORING_OP_WRITE appending it to
+ *          *log_file linked to the IORING_OP_READ_FIXED of the first
+ *          echo block, so the read starts once the write is done; then
+ *          IORING_OP_SEND and READ_FIXED alternate until the end of the
+ *          log. Connections wait for a free echo buffer if need be.
+ *
+ * Control commands (AESDCHAR_IOCSEEKTO) are applied synchronously with
+ * storage_apply() before the echo. Subscribing is not supported.
+ *
+ * Every ring also polls shutdown_fd(). Once it fires the ring cancels
+ * its accept and the receives waiting on idle clients, and closes each
+ * connection when the packets it already holds are echoed, or at the
+ * drain deadline.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "uring.h"
+
+#if __has_include(<linux/io_uring.h>)
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+
+#include "framer.h"
+#include "storage.h"
+#include "command.h"
+#include "tail.h"
+#include "metrics.h"
+#include "lockstat.h"
+#include "shutdown.h"
+#include "queue.h"
+
+#define URING_ENTRIES           256
+#define URING_MAX_CONNS         1024    /* client slots per ring */
+#define URING_BUFS              32      /* registered echo buffers per ring */
+#define URING_LOG_SLOT          0       /* fixed file slot of *log_file */
+#define URING_TIMEOUT_MS        1000
+#define URING_DRAIN_TRIES       10
+
+enum uring_op {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_WRITE,
+    OP_READ,
+    OP_SEND,
+    OP_CLOSE,
+    OP_CANCEL,
+    OP_SHUTDOWN,
+};
+
+/* user_data of a request: fixed file slot of the client and operation */
+#define UDATA(slot, op)         (((uint64_t) (slot) << 8) | (op))
+#define UDATA_SLOT(ud)          ((int) ((ud) >> 8))
+#define UDATA_OP(ud)            ((int) ((ud) & 0xff))
+
+/* the mmap()ed submission and completion queues */
+struct ring {
+    int fd;
+    void *ring_ptr;
+    size_t ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;      /* local tail, published by ring_enter() */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+struct uconn {
+    int slot;               /* fixed file slot of the client socket */
+    int inflight;           /* requests not completed yet */
+    int closing;
+    int receiving;          /* a RECV is in flight */
+    int peer_closed;        /* client shut down its sending side */
+    struct framer rx;
+    const char *pkt;        /* packet being appended, NULL once written */
+    size_t pkt_len;
+    uint64_t write_ns;      /* submission time of the append */
+    int buf;                /* registered echo buffer, -1 if none */
+    off_t echo_off;         /* next *log_file offset to echo */
+    size_t tx_len;          /* bytes of buf to send */
+    size_t tx_off;          /* bytes of buf already sent */
+    int last_block;         /* a short read of a regular file hit its end */
+    STAILQ_ENTRY(uconn) waiting;
+};
+
+struct uloop {
+    pthread_t tid;
+    struct ring ring;
+    int sock;
+    pthread_mutex_t *mutex;
+    int inflight;           /* every request, including accept and cancel */
+    int accept_armed;
+    int accept_failed;      /* accepting failed for good */
+    int draining;           /* shutting down, no more packets are read */
+    int nconns;             /* connections not closed yet */
+    struct storage_handle *log;     /* registered in URING_LOG_SLOT */
+    char *bufs;             /* URING_BUFS * echo_block_len bytes */
+    int free_bufs[URING_BUFS];
+    int nfree;
+    STAILQ_HEAD(uconn_head, uconn) buf_waiters;
+    struct uconn *conns[URING_MAX_CONNS + 1];   /* by fixed file slot */
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * @brief Create a ring and map its queues.
+ *
+ * @param r ring
+ * @param entries submission queue size
+ * @return int 0 on success or -1 on failure, errno is ENOSYS if the
+ * kernel lacks a feature this engine relies on
+ */
+static int ring_init(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    size_t sq_len, cq_len;
+    char *ptr;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd == -1)
+        return -1;
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    sq_len = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+    cq_len = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+    r->ring_len = (sq_len > cq_len) ? sq_len : cq_len;
+    r->ring_ptr = mmap(NULL, r->ring_len, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE),
+                       r->fd, IORING_OFF_SQ_RING);
+    if (r->ring_ptr == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE),
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring_ptr, r->ring_len);
+        close(r->fd);
+        return -1;
+    }
+
+    ptr = (char *) r->ring_ptr;
+    r->sq_head = (unsigned *) (ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *) (ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *) (ptr + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+    r->cq_head = (unsigned *) (ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *) (ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (ptr + p.cq_off.cqes);
+
+    /* submission queue entry i always sits at index i */
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        ((unsigned *) (ptr + p.sq_off.array))[i] = i;
+
+    return 0;
+}
+
+/**
+ * @brief Unmap the queues and close the ring, which cancels whatever
+ * is still in flight.
+ *
+ * @param r ring
+ */
+static void ring_free(struct ring *r)
+{
+    munmap(r->sqes, r->sqes_len);
+    munmap(r->ring_ptr, r->ring_len);
+    close(r->fd);
+}
+
+/**
+ * @brief Submit the queued entries and wait for completions.
+ *
+ * @param r ring
+ * @param wait_nr completions to wait for, 0 to only submit
+ * @param timeout_ms give up waiting after this long
+ * @return int 0 on success or -1 on failure
+ */
+static int ring_enter(struct ring *r, unsigned wait_nr, int timeout_ms)
+{
+    int rc;
+    unsigned submit;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    submit = r->sqe_tail - *r->sq_tail;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+    if (wait_nr == 0) {
+        rc = sys_io_uring_enter(r->fd, submit, 0, 0, NULL, 0);
+    } else {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        rc = sys_io_uring_enter(r->fd, submit, wait_nr, (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG),
+                                &arg, sizeof(arg));
+    }
+
+    if (rc == -1 && (errno == ETIME || errno == EINTR || errno == EBUSY))
+        return 0;
+
+    return (rc == -1) ? -1 : 0;
+}
+
+/**
+ * @brief Get a zeroed submission queue entry, submitting the queued ones
+ * first if the queue is full.
+ *
+ * @param r ring
+ * @return struct io_uring_sqe* the entry, or NULL on failure
+ */
+static struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+    struct io_uring_sqe *sqe;
+
+    if (r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) {
+        if (ring_enter(r, 0, 0) != 0 ||
+            r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries)
+            return NULL;
+    }
+
+    sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqe_tail++;
+
+    return sqe;
+}
+
+/**
+ * @brief Check that the kernel supports every request this engine
+ * submits. IORING_FILE_INDEX_ALLOC and IORING_ASYNC_CANCEL_ANY came in
+ * Linux 5.19, later than IORING_FEAT_EXT_ARG: a cancel of any request
+ * on the idle ring completes with -ENOENT there and -EINVAL before.
+ *
+ * @param r ring, with nothing in flight
+ * @return int 0 if supported or -1 with errno ENOSYS otherwise
+ */
+static int ring_probe(struct ring *r)
+{
+    static const int opcodes[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_WRITE,
+        IORING_OP_READ_FIXED, IORING_OP_CLOSE, IORING_OP_ASYNC_CANCEL,
+        IORING_OP_POLL_ADD,
+    };
+    struct io_uring_probe *probe;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    size_t i;
+    int rc = 0;
+
+    probe = (struct io_uring_probe *) calloc(1, sizeof(*probe) + (256 * sizeof(struct io_uring_probe_op)));
+    if (probe == NULL)
+        return -1;
+
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        rc = -1;
+    } else {
+        for (i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++) {
+            if (opcodes[i] > probe->last_op || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+                rc = -1;
+        }
+    }
+    free(probe);
+
+    if (rc == 0) {
+        sqe = ring_get_sqe(r);
+        if (sqe == NULL)
+            return -1;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+
+        if (ring_enter(r, 1, URING_TIMEOUT_MS) != 0 || *r->cq_head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+            return -1;
+        cqe = &r->cqes[*r->cq_head & *r->cq_mask];
+        if (cqe->res == -EINVAL)
+            rc = -1;
+        __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    if (rc != 0)
+        errno = ENOSYS;
+
+    return rc;
+}
+
+/**
+ * @brief Queue a request of the loop, counting it as in flight.
+ *
+ * @return struct io_uring_sqe* the entry to fill, or NULL on failure
+ */
+static struct io_uring_sqe *loop_prep(struct uloop *l, int opcode, int slot, int op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = ring_get_sqe(&l->ring);
+    if (sqe == NULL) {
+        syslog(LOG_ERR, "io_uring submission queue is full");
+        return NULL;
+    }
+
+    sqe->opcode = opcode;
+    sqe->user_data = UDATA(slot, op);
+    l->inflight++;
+
+    return sqe;
+}
+
+/**
+ * @brief Keep an accept request in flight while there is a free slot.
+ *
+ * @param l ring loop
+ */
+static void loop_arm_accept(struct uloop *l)
+{
+    struct io_uring_sqe *sqe;
+
+    if (l->accept_armed || l->accept_failed || l->draining)
+        return;
+
+    sqe = loop_prep(l, IORING_OP_ACCEPT, 0, OP_ACCEPT);
+    if (sqe == NULL)
+        return;
+
+    /* the client lands directly in a free fixed file slot */
+    sqe->fd = l->sock;
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    l->accept_armed = 1;
+}
+
+/**
+ * @brief Make sure URING_LOG_SLOT holds the current *log_file, which
+ * changes after a SIGHUP.
+ *
+ * @param l ring loop
+ * @return int 0 on success or -1 on failure
+ */
+static int loop_update_log(struct uloop *l)
+{
+    struct storage_handle *h;
+    struct io_uring_files_update up;
+
+    h = storage_acquire();
+    if (h == NULL)
+        return -1;
+
+    if (h == l->log) {
+        storage_release(h);
+        return 0;
+    }
+
+    memset(&up, 0, sizeof(up));
+    up.offset = URING_LOG_SLOT;
+    up.fds = (uint64_t) (uintptr_t) &h->fd;
+    if (sys_io_uring_register(l->ring.fd, IORING_REGISTER_FILES_UPDATE, &up, 1) != 1) {
+        syslog(LOG_ERR, "failed to register %s with io_uring: %s", log_file, strerror(errno));
+        storage_release(h);
+        return -1;
+    }
+
+    storage_release(l->log);
+    l->log = h;
+
+    return 0;
+}
+
+static void conn_next(struct uloop *l, struct uconn *c);
+
+/**
+ * @brief Close a connection once nothing of it is in flight any more.
+ *
+ * @param l ring loop
+ * @param c connection
+ */
+static void conn_close(struct uloop *l, struct uconn *c)
+{
+    struct io_uring_sqe *sqe;
+    struct uconn *w;
+
+    c->closing = 1;
+    if (c->inflight != 0)
+        return;
+
+    if (c->buf != -1) {
+        l->free_bufs[l->nfree++] = c->buf;
+        c->buf = -1;
+    }
+    STAILQ_FOREACH(w, &l->buf_waiters, waiting) {
+        if (w == c) {
+            STAILQ_REMOVE(&l->buf_waiters, c, uconn, waiting);
+            break;
+        }
+    }
+
+    sqe = loop_prep(l, IORING_OP_CLOSE, c->slot, OP_CLOSE);
+    if (sqe != NULL) {
+        sqe->file_index = c->slot + 1;
+        c->inflight++;
+    } else {
+        /* the slot leaks until the ring is closed */
+        l->conns[c->slot] = NULL;
+        l->nconns--;
+        framer_free(&c->rx);
+        free(c);
+    }
+}
+
+/**
+ * @brief Receive into the connection framer.
+ *
+ * @param l ring loop
+ * @param c connection
+ */
+static void conn_arm_recv(struct uloop *l, struct uconn *c)
+{
+    struct io_uring_sqe *sqe;
+    size_t avail;
+    char *buf;
+
+    buf = framer_reserve(&c->rx, MAX_BUF_LEN, &avail);
+    if (buf == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for msg");
+        conn_close(l, c);
+        return;
+    }
+
+    sqe = loop_prep(l, IORING_OP_RECV, c->slot, OP_RECV);
+    if (sqe == NULL) {
+        conn_close(l, c);
+        return;
+    }
+
+    sqe->fd = c->slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = avail;
+    c->inflight++;
+    c->receiving = 1;
+}
+
+/**
+ * @brief Read the next echo block of *log_file into the echo buffer.
+ *
+ * @param l ring loop
+ * @param c connection holding an echo buffer
+ * @return int 0 on success or -1 on failure
+ */
+static int conn_arm_read(struct uloop *l, struct uconn *c)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = loop_prep(l, IORING_OP_READ_FIXED, c->slot, OP_READ);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->fd = URING_LOG_SLOT;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t) (uintptr_t) (l->bufs + (c->buf * echo_block_len));
+    sqe->len = echo_block_len;
+    sqe->off = c->echo_off;
+    sqe->buf_index = c->buf;
+    c->inflight++;
+
+    return 0;
+}
+
+/**
+ * @brief Send what is left of the echo buffer.
+ *
+ * @param l ring loop
+ * @param c connection
+ * @return int 0 on success or -1 on failure
+ */
+static int conn_arm_send(struct uloop *l, struct uconn *c)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = loop_prep(l, IORING_OP_SEND, c->slot, OP_SEND);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->fd = c->slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t) (uintptr_t) (l->bufs + (c->buf * echo_block_len) + c->tx_off);
+    sqe->len = c->tx_len - c->tx_off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    c->inflight++;
+
+    return 0;
+}
+
+/**
+ * @brief Append the packet, if any, and start echoing. The write and the
+ * first read are linked so the read sees the packet.
+ *
+ * @param l ring loop
+ * @param c connection holding an echo buffer
+ */
+static void conn_start_echo(struct uloop *l, struct uconn *c)
+{
+    struct io_uring_sqe *sqe;
+
+    c->last_block = 0;
+
+    if (c->pkt != NULL) {
+        sqe = loop_prep(l, IORING_OP_WRITE, c->slot, OP_WRITE);
+        if (sqe == NULL) {
+            conn_close(l, c);
+            return;
+        }
+
+        sqe->fd = URING_LOG_SLOT;
+        sqe->flags = (IOSQE_FIXED_FILE | IOSQE_IO_LINK);
+        sqe->addr = (uint64_t) (uintptr_t) c->pkt;
+        sqe->len = c->pkt_len;
+        sqe->off = (uint64_t) -1;       /* append at the current end */
+        c->write_ns = metrics_now_ns();
+        c->inflight++;
+    }
+
+    if (conn_arm_read(l, c) != 0)
+        conn_close(l, c);
+}
+
+/**
+ * @brief Take an echo buffer, or queue the connection until one is free.
+ *
+ * @param l ring loop
+ * @param c connection
+ */
+static void conn_get_buf(struct uloop *l, struct uconn *c)
+{
+    if (l->nfree == 0) {
+        STAILQ_INSERT_TAIL(&l->buf_waiters, c, waiting);
+        return;
+    }
+
+    c->buf = l->free_bufs[--l->nfree];
+    conn_start_echo(l, c);
+}
+
+/**
+ * @brief Return the echo buffer and hand it to a waiting connection.
+ *
+ * @param l ring loop
+ * @param c connection
+ */
+static void conn_put_buf(struct uloop *l, struct uconn *c)
+{
+    struct uconn *w;
+
+    l->free_bufs[l->nfree++] = c->buf;
+    c->buf = -1;
+
+    w = STAILQ_FIRST(&l->buf_waiters);
+    if (w != NULL) {
+        STAILQ_REMOVE_HEAD(&l->buf_waiters, waiting);
+        conn_get_buf(l, w);
+    }
+}
+
+/**
+ * @brief Handle the next complete packet, or receive more.
+ *
+ * @param l ring loop
+ * @param c connection
+ */
+static void conn_next(struct uloop *l, struct uconn *c)
+{
+    struct command cmd;
+    const char *pkt;
+    size_t len;
+
+    pkt = framer_next(&c->rx, &len);
+    if (pkt == NULL) {
+        if (c->peer_closed)
+            conn_close(l, c);
+        else
+            conn_arm_recv(l, c);
+        return;
+    }
+
+    if (loop_update_log(l) != 0) {
+        conn_close(l, c);
+        return;
+    }
+
+    c->echo_off = 0;
+    c->pkt = NULL;
+
+    switch (command_parse(pkt, len, &cmd)) {
+    case CMD_SUBSCRIBE:
+        syslog(LOG_WARNING, "subscribing is not supported by the io_uring engine");
+        conn_close(l, c);
+        return;
+
+    case CMD_SEEKTO:
+    case CMD_INVALID:
+        /* a single ioctl, not worth a round trip through the ring; a
+         * backend without AESDCHAR_IOCSEEKTO logs the packet as data */
+        if (l->log->ops->seek_to_cmd != NULL) {
+            c->echo_off = storage_apply(l->log, pkt, len, &cmd, l->mutex);
+            if (c->echo_off == -1) {
+                conn_close(l, c);
+                return;
+            }
+            break;
+        }
+        /* fall through */
+
+    default:
+        c->pkt = pkt;
+        c->pkt_len = len;
+        break;
+    }
+
+    conn_get_buf(l, c);
+}
+
+/**
+ * @brief Register an accepted client.
+ *
+ * @param l ring loop
+ * @param res accept result, the fixed file slot of the client
+ */
+static void loop_on_accept(struct uloop *l, int res)
+{
+    struct io_uring_sqe *sqe;
+    struct uconn *c;
+
+    l->accept_armed = 0;
+
+    if (res < 0) {
+        switch (-res) {
+        case ENFILE:
+            /* no free slot, accept again once a client is closed */
+            return;
+        case EINTR:
+        case EAGAIN:
+        case ECANCELED:
+            break;
+        case ECONNABORTED:
+        case EPROTO:
+        case EPERM:
+        case EMFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            /* this client is lost, the next one may get through */
+            syslog(LOG_ERR, "failed to accept client: %s", strerror(-res));
+            break;
+        default:
+            /* every accept would fail the same way, do not spin on it */
+            syslog(LOG_ERR, "failed to accept client, shutting down: %s", strerror(-res));
+            l->accept_failed = 1;
+            shutdown_request();
+            return;
+        }
+        loop_arm_accept(l);
+        return;
+    }
+
+    metrics_add(METRIC_CONN_ACCEPTED, 1);
+
+    c = (struct uconn *) calloc(1, sizeof(struct uconn));
+    if (c == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for client conn: %s", strerror(errno));
+        metrics_add(METRIC_CONN_CLOSED, 1);
+        /* close the slot, its completion finds no connection */
+        sqe = loop_prep(l, IORING_OP_CLOSE, res, OP_CLOSE);
+        if (sqe != NULL)
+            sqe->file_index = res + 1;
+    } else {
+        c->slot = res;
+        c->buf = -1;
+        framer_init(&c->rx);
+        l->conns[res] = c;
+        l->nconns++;
+        /* accepted just before the accept was cancelled */
+        if (l->draining)
+            conn_close(l, c);
+        else
+            conn_arm_recv(l, c);
+    }
+
+    loop_arm_accept(l);
+}
+
+/**
+ * @brief Advance a connection with the result of one of its requests.
+ *
+ * @param l ring loop
+ * @param c connection
+ * @param op completed operation
+ * @param res its result
+ */
+static void conn_on_complete(struct uloop *l, struct uconn *c, int op, int res)
+{
+    c->inflight--;
+
+    if (op == OP_CLOSE) {
+        l->conns[c->slot] = NULL;
+        l->nconns--;
+        framer_free(&c->rx);
+        free(c);
+        metrics_add(METRIC_CONN_CLOSED, 1);
+        loop_arm_accept(l);
+        return;
+    }
+
+    if (c->closing) {
+        conn_close(l, c);
+        return;
+    }
+
+    switch (op) {
+    case OP_RECV:
+        c->receiving = 0;
+        /* cancelled by the drain, the packets already received remain */
+        if (res == -ECANCELED && l->draining)
+            res = 0;
+        if (res < 0) {
+            conn_close(l, c);
+            return;
+        }
+        if (res == 0) {
+            c->peer_closed = 1;
+        } else {
+            metrics_add(METRIC_BYTES_IN, res);
+            framer_commit(&c->rx, res);
+        }
+        conn_next(l, c);
+        break;
+
+    case OP_WRITE:
+        /* a failed or short write cancels the linked read */
+        if (res != (int) c->pkt_len) {
+            syslog(LOG_ERR, "failed to write packet to %s: %s", log_file,
+                   (res < 0) ? strerror(-res) : "short write");
+            conn_close(l, c);
+            return;
+        }
+        lockstat_lock(l->mutex, LOCKSTAT_APPEND);
+        tail_append(c->pkt, c->pkt_len);
+        lockstat_unlock(l->mutex);
+        metrics_observe_write(metrics_now_ns() - c->write_ns);
+        metrics_add(METRIC_PACKETS, 1);
+        c->pkt = NULL;
+        break;
+
+    case OP_READ:
+        if (res < 0) {
+            conn_close(l, c);
+            return;
+        }
+        if (res == 0) {
+            conn_put_buf(l, c);
+            conn_next(l, c);
+            return;
+        }
+        /* the char device returns one write per read, only a regular
+         * file is known to be exhausted by a short read */
+        c->last_block = l->log->ops->short_read_end && ((size_t) res < echo_block_len);
+        c->echo_off += res;
+        c->tx_len = res;
+        c->tx_off = 0;
+        if (conn_arm_send(l, c) != 0)
+            conn_close(l, c);
+        break;
+
+    case OP_SEND:
+        if (res < 0) {
+            conn_close(l, c);
+            return;
+        }
+        metrics_add(METRIC_BYTES_OUT, res);
+        c->tx_off += res;
+        if (c->tx_off != c->tx_len) {
+            if (conn_arm_send(l, c) != 0)
+                conn_close(l, c);
+        } else if (c->last_block) {
+            conn_put_buf(l, c);
+            conn_next(l, c);
+        } else if (conn_arm_read(l, c) != 0) {
+            conn_close(l, c);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Cancel a request of the loop.
+ *
+ * @param l ring loop
+ * @param slot fixed file slot of the request
+ * @param op its operation
+ */
+static void loop_cancel(struct uloop *l, int slot, int op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = loop_prep(l, IORING_OP_ASYNC_CANCEL, 0, OP_CANCEL);
+    if (sqe != NULL)
+        sqe->addr = UDATA(slot, op);
+}
+
+/**
+ * @brief Poll shutdown_fd(), which completes once a shutdown is
+ * requested, or shutdown_expire_fd() once draining.
+ *
+ * @param l ring loop
+ * @param fd descriptor to poll
+ * @return int 0 on success or -1 on failure
+ */
+static int loop_arm_shutdown(struct uloop *l, int fd)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = loop_prep(l, IORING_OP_POLL_ADD, 0, OP_SHUTDOWN);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+
+    return 0;
+}
+
+/**
+ * @brief Stop accepting and reading: clients waiting to send get their
+ * receive cancelled, the others are closed once their echo completes.
+ *
+ * @param l ring loop
+ */
+static void loop_start_drain(struct uloop *l)
+{
+    int i;
+    struct uconn *c;
+
+    l->draining = 1;
+
+    /* a second request wakes the loop to close what is left */
+    loop_arm_shutdown(l, shutdown_expire_fd());
+
+    if (l->accept_armed)
+        loop_cancel(l, 0, OP_ACCEPT);
+
+    for (i = 0; i <= URING_MAX_CONNS; i++) {
+        c = l->conns[i];
+        if (c == NULL || c->closing)
+            continue;
+        c->peer_closed = 1;
+        if (c->receiving)
+            loop_cancel(l, c->slot, OP_RECV);
+    }
+}
+
+/**
+ * @brief Dispatch every available completion.
+ *
+ * @param l ring loop
+ * @param draining only account for completions, during shutdown
+ */
+static void loop_reap(struct uloop *l, int draining)
+{
+    struct ring *r = &l->ring;
+    struct io_uring_cqe *cqe;
+    struct uconn *c;
+    unsigned head, tail;
+    int slot, op;
+
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        cqe = &r->cqes[head & *r->cq_mask];
+        slot = UDATA_SLOT(cqe->user_data);
+        op = UDATA_OP(cqe->user_data);
+        l->inflight--;
+
+        if (draining) {
+            c = (op == OP_ACCEPT || op == OP_CANCEL || op == OP_SHUTDOWN) ? NULL : l->conns[slot];
+            if (c != NULL)
+                c->inflight--;
+        } else if (op == OP_ACCEPT) {
+            loop_on_accept(l, cqe->res);
+        } else if (op == OP_SHUTDOWN) {
+            if (!l->draining)
+                loop_start_drain(l);
+        } else if (op != OP_CANCEL && l->conns[slot] != NULL) {
+            conn_on_complete(l, l->conns[slot], op, cqe->res);
+        }
+
+        head++;
+        /* free the entry at once, handlers may wait for more */
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+/**
+ * @brief Cancel everything in flight and wait for it, so no request
+ * still points into memory about to be freed.
+ *
+ * @param l ring loop
+ */
+static void loop_drain(struct uloop *l)
+{
+    struct io_uring_sqe *sqe;
+    int i, tries;
+
+    sqe = loop_prep(l, IORING_OP_ASYNC_CANCEL, 0, OP_CANCEL);
+    if (sqe != NULL)
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+
+    for (tries = 0; l->inflight > 0 && tries < URING_DRAIN_TRIES; tries++) {
+        if (ring_enter(&l->ring, 1, URING_TIMEOUT_MS / 10) != 0)
+            break;
+        loop_reap(l, 1);
+    }
+
+    for (i = 0; i <= URING_MAX_CONNS; i++) {
+        if (l->conns[i] != NULL) {
+            framer_free(&l->conns[i]->rx);
+            free(l->conns[i]);
+            l->conns[i] = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Ring thread function.
+ *
+ * @param thread_param struct uloop data
+ * @return void* returns NULL
+ */
+static void *loop_func(void *thread_param)
+{
+    struct uloop *l = (struct uloop *) thread_param;
+
+    if (loop_arm_shutdown(l, shutdown_fd()) != 0)
+        return NULL;
+    loop_arm_accept(l);
+
+    /* once draining, run until the last connection is closed or the
+     * deadline passes */
+    while (!l->draining || l->nconns > 0) {
+        if (l->draining && shutdown_expired())
+            break;
+
+        if (ring_enter(&l->ring, 1, shutdown_timeout_ms(URING_TIMEOUT_MS)) != 0) {
+            syslog(LOG_ERR, "failed to wait for io_uring completions: %s", strerror(errno));
+            break;
+        }
+        loop_reap(l, 0);
+    }
+
+    /* whatever is left ran out of time */
+    if (l->nconns > 0)
+        shutdown_forced(l->nconns);
+
+    loop_drain(l);
+
+    return NULL;
+}
+
+/**
+ * @brief Create the ring of a loop and register its files and buffers.
+ *
+ * @param l ring loop
+ * @return int 0 on success or -1 on failure
+ */
+static int loop_init(struct uloop *l)
+{
+    int i;
+    int *fds = NULL;
+    struct iovec iov[URING_BUFS];
+
+    STAILQ_INIT(&l->buf_waiters);
+
+    if (ring_init(&l->ring, URING_ENTRIES) != 0)
+        return -1;
+
+    if (ring_probe(&l->ring) != 0) {
+        i = errno;
+        ring_free(&l->ring);
+        errno = i;
+        return -1;
+    }
+
+    l->bufs = (char *) malloc(URING_BUFS * echo_block_len);
+    fds = (int *) malloc((URING_MAX_CONNS + 1) * sizeof(int));
+    l->log = storage_acquire();
+    if (l->bufs == NULL || fds == NULL || l->log == NULL)
+        goto error;
+
+    for (i = 0; i < URING_BUFS; i++) {
+        iov[i].iov_base = l->bufs + (i * echo_block_len);
+        iov[i].iov_len = echo_block_len;
+        l->free_bufs[i] = i;
+    }
+    l->nfree = URING_BUFS;
+
+    if (sys_io_uring_register(l->ring.fd, IORING_REGISTER_BUFFERS, iov, URING_BUFS) != 0)
+        goto error;
+
+    /* *log_file plus empty slots for accept to fill */
+    fds[URING_LOG_SLOT] = l->log->fd;
+    for (i = 1; i <= URING_MAX_CONNS; i++)
+        fds[i] = -1;
+
+    if (sys_io_uring_register(l->ring.fd, IORING_REGISTER_FILES, fds, URING_MAX_CONNS + 1) != 0)
+        goto error;
+
+    free(fds);
+    return 0;
+
+error:
+    i = errno;
+    free(fds);
+    free(l->bufs);
+    storage_release(l->log);
+    ring_free(&l->ring);
+    errno = i;
+    return -1;
+}
+
+/**
+ * @brief Release the ring of a loop.
+ *
+ * @param l ring loop
+ */
+static void loop_free(struct uloop *l)
+{
+    ring_free(&l->ring);
+    free(l->bufs);
+    storage_release(l->log);
+}
+
+int uring_run(int sock, int nthreads, pthread_mutex_t *mutex)
+{
+    int i, rc = 0;
+    int started = 0, ready = 0;
+    struct uloop *loops;
+
+    if (nthreads < 1)
+        nthreads = 1;
+
+    loops = (struct uloop *) calloc(nthreads, sizeof(struct uloop));
+    if (loops == NULL) {
+        syslog(LOG_ERR, "failed to allocate memory for io_uring loops: %s", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        loops[i].sock = sock;
+        loops[i].mutex = mutex;
+
+        if (loop_init(&loops[i]) != 0) {
+            syslog(LOG_ERR, "failed to set up io_uring: %s", strerror(errno));
+            rc = -1;
+            break;
+        }
+        ready++;
+    }
+
+    /* nothing started yet, let the caller fall back to epoll */
+    if (ready == 0) {
+        free(loops);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    for (i = 0; rc == 0 && i < nthreads; i++) {
+        rc = pthread_create(&loops[i].tid, NULL, loop_func, &loops[i]);
+        if (rc != 0) {
+            syslog(LOG_ERR, "failed to create io_uring thread: %s", strerror(rc));
+            rc = -1;
+            break;
+        }
+        started++;
+    }
+
+    if (rc != 0)
+        shutdown_request();
+
+    for (i = 0; i < started; i++)
+        pthread_join(loops[i].tid, NULL);
+
+    for (i = 0; i < ready; i++)
+        loop_free(&loops[i]);
+
+    free(loops);
+
+    return rc;
+}
+
+#else /* no <linux/io_uring.h> */
+
+int uring_run(int sock, int nthreads, pthread_mutex_t *mutex)
+{
+    syslog(LOG_WARNING, "built without io_uring support");
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
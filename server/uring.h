@@ -0,0 +1,37 @@
+/**
+ * @file    uring.h
+ *
+ * @brief   io_uring engine for aesdsocket client handling.
+ *
+ * @author  Harinarayanan Gajapathy (haga9942@colorado.edu)
+ * @date    2023-03-02
+ *
+ * @copyright Copyright (c) 2023 Harinarayanan Gajapathy
+ * Redistribution, modification or use of this software in source or binary
+ * forms is permitted as long as the files maintain this copyright. Users
+ * are permitted to modify this and use it to learn about the field of
+ * embedded software. Harinarayanan Gajapathy and the University of Colorado
+ * are not liable for any misuse of this material
+ *
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <pthread.h>
+
+/**
+ * @brief Serve every client of the listening socket from nthreads
+ * threads, each driving its own io_uring instance, until caught_signal
+ * is set. Accepts, receives, log appends, log reads and echo sends are
+ * all submitted to the ring, a whole batch per io_uring_enter().
+ *
+ * @param sock listening socket
+ * @param nthreads number of ring threads
+ * @param mutex serializes writers of *log_file
+ * @return int 0 on success or -1 on failure, with errno set to ENOSYS
+ * if io_uring is not available at build or run time
+ */
+int uring_run(int sock, int nthreads, pthread_mutex_t *mutex);
+
+#endif /* URING_H */
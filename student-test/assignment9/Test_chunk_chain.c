@@ -0,0 +1,198 @@
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-chunk.h"
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+#define TEST_MAX_LEN    (4 * AESD_CHUNK_DATA_SIZE + 17)
+
+static char pattern[TEST_MAX_LEN];
+
+static void fill_pattern(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(pattern); i++)
+        pattern[i] = 'a' + (i % 23);
+}
+
+/**
+* Append len bytes of src to chain in writes of at most piece bytes, as aesd_write() does
+*/
+static void append(struct aesd_chunk_chain *chain, const char *src, size_t len, size_t piece)
+{
+    size_t done = 0, n, avail, want;
+    char *p;
+
+    while (done < len) {
+        want = (len - done < piece) ? len - done : piece;
+        while (want > 0) {
+            p = aesd_chunk_chain_reserve(chain, &avail);
+            TEST_ASSERT_NOT_NULL(p);
+            TEST_ASSERT_TRUE(avail > 0 && avail <= AESD_CHUNK_DATA_SIZE);
+            n = (want < avail) ? want : avail;
+            memcpy(p, src + done, n);
+            aesd_chunk_chain_commit(chain, n);
+            done += n;
+            want -= n;
+        }
+    }
+}
+
+/**
+* Read a complete write of size bytes back through aesd_chunk_find()
+*/
+static void verify_read(const char *buffptr, size_t size, const char *expect)
+{
+    size_t offset, avail;
+    const char *p;
+
+    for (offset = 0; offset < size; offset += avail) {
+        p = aesd_chunk_find(buffptr, offset, &avail);
+        TEST_ASSERT_TRUE_MESSAGE(avail > 0 && avail <= size - offset, "wrong contiguous length");
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expect + offset, p, avail, "wrong data");
+    }
+}
+
+/**
+* Read a complete write of size bytes from offset on as aesd_read() does: seek to the chunk
+* holding offset once, then follow the chain
+*/
+static void verify_walk(const char *buffptr, size_t size, size_t offset, const char *expect)
+{
+    const struct aesd_chunk *chunk;
+    size_t done = offset, avail;
+
+    chunk = aesd_chunk_seek(buffptr, &offset);
+    while (done < size) {
+        TEST_ASSERT_NOT_NULL_MESSAGE(chunk, "chain ends early");
+        avail = chunk->len - offset;
+        TEST_ASSERT_TRUE_MESSAGE(avail > 0 && avail <= size - done, "wrong contiguous length");
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expect + done, chunk->data + offset, avail, "wrong data");
+        done += avail;
+        chunk = chunk->next;
+        offset = 0;
+    }
+}
+
+/**
+* Writes of every interesting length, appended in pieces crossing the chunk boundaries
+*/
+void test_chunk_chain_append_and_find()
+{
+    const size_t lens[] = { 1, 2, AESD_CHUNK_DATA_SIZE - 1, AESD_CHUNK_DATA_SIZE,
+                            AESD_CHUNK_DATA_SIZE + 1, 2 * AESD_CHUNK_DATA_SIZE, TEST_MAX_LEN };
+    const size_t pieces[] = { 1, 7, AESD_CHUNK_DATA_SIZE, TEST_MAX_LEN };
+    struct aesd_chunk_chain chain;
+    size_t i, j, offset, avail, expect;
+    const char *p;
+
+    fill_pattern();
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        for (j = 0; j < sizeof(pieces) / sizeof(pieces[0]); j++) {
+            aesd_chunk_chain_init(&chain);
+            append(&chain, pattern, lens[i], pieces[j]);
+            TEST_ASSERT_EQUAL_UINT(lens[i], chain.size);
+            TEST_ASSERT_EQUAL_INT(pattern[lens[i] - 1], aesd_chunk_chain_last(&chain));
+
+            verify_read(aesd_chunk_chain_data(&chain), lens[i], pattern);
+
+            /* any byte, contiguous to the end of its chunk */
+            for (offset = 0; offset < lens[i]; offset++) {
+                p = aesd_chunk_find(aesd_chunk_chain_data(&chain), offset, &avail);
+                TEST_ASSERT_EQUAL_INT(pattern[offset], *p);
+                expect = AESD_CHUNK_DATA_SIZE - (offset % AESD_CHUNK_DATA_SIZE);
+                if (expect > lens[i] - offset)
+                    expect = lens[i] - offset;
+                TEST_ASSERT_EQUAL_UINT(expect, avail);
+                verify_walk(aesd_chunk_chain_data(&chain), lens[i], offset, pattern);
+            }
+
+            aesd_chunk_chain_free(&chain);
+            TEST_ASSERT_NULL(chain.head);
+            TEST_ASSERT_EQUAL_UINT(0, chain.size);
+        }
+    }
+}
+
+/**
+* A reservation that gets no bytes, as a faulting copy_from_user() leaves it, changes nothing
+*/
+void test_chunk_chain_empty_commit()
+{
+    struct aesd_chunk_chain chain;
+    size_t avail;
+
+    fill_pattern();
+    aesd_chunk_chain_init(&chain);
+    append(&chain, pattern, AESD_CHUNK_DATA_SIZE, AESD_CHUNK_DATA_SIZE);
+
+    /* links a new chunk which stays empty */
+    TEST_ASSERT_NOT_NULL(aesd_chunk_chain_reserve(&chain, &avail));
+    TEST_ASSERT_EQUAL_UINT(AESD_CHUNK_DATA_SIZE, avail);
+    aesd_chunk_chain_commit(&chain, 0);
+
+    TEST_ASSERT_EQUAL_UINT(AESD_CHUNK_DATA_SIZE, chain.size);
+    TEST_ASSERT_EQUAL_INT(pattern[AESD_CHUNK_DATA_SIZE - 1], aesd_chunk_chain_last(&chain));
+    verify_read(aesd_chunk_chain_data(&chain), chain.size, pattern);
+
+    /* and is filled next */
+    append(&chain, pattern + AESD_CHUNK_DATA_SIZE, 10, 10);
+    TEST_ASSERT_EQUAL_UINT(AESD_CHUNK_DATA_SIZE + 10, chain.size);
+    verify_read(aesd_chunk_chain_data(&chain), chain.size, pattern);
+
+    aesd_chunk_chain_free(&chain);
+}
+
+/**
+* Chains as circular buffer entries: every position of the buffer reads back through
+* the entry found and its chunks, evicted writes are freed whole
+*/
+void test_chunk_chain_in_circular_buffer()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry, *found;
+    struct aesd_chunk_chain chain;
+    const char *rtnptr, *p;
+    char expect[4 * TEST_MAX_LEN];
+    size_t sizes[6], n, i, fpos, offset, avail, total;
+    unsigned int index;
+
+    fill_pattern();
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, NULL, 4, 0));
+
+    for (n = 0; n < 6; n++) {
+        sizes[n] = 1 + ((n * 2 * AESD_CHUNK_DATA_SIZE / 3) % TEST_MAX_LEN);
+        aesd_chunk_chain_init(&chain);
+        append(&chain, pattern + n, sizes[n], 100);
+
+        entry.buffptr = aesd_chunk_chain_data(&chain);
+        entry.size = chain.size;
+        rtnptr = aesd_circular_buffer_add_entry(&buffer, &entry);
+        TEST_ASSERT_TRUE(n < 4 ? rtnptr == NULL : rtnptr != NULL);
+        if (rtnptr != NULL)
+            aesd_chunk_free(rtnptr);
+    }
+
+    /* writes 2..5 concatenated */
+    total = 0;
+    for (n = 2; n < 6; n++) {
+        memcpy(expect + total, pattern + n, sizes[n]);
+        total += sizes[n];
+    }
+    TEST_ASSERT_EQUAL_UINT(total, aesd_circular_buffer_size(&buffer));
+
+    for (fpos = 0; fpos < total; fpos++) {
+        found = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, fpos, &offset);
+        TEST_ASSERT_NOT_NULL(found);
+        p = aesd_chunk_find(found->buffptr, offset, &avail);
+        TEST_ASSERT_EQUAL_INT(expect[fpos], *p);
+        for (i = 0; i < avail; i++)
+            TEST_ASSERT_EQUAL_INT(expect[fpos + i], p[i]);
+    }
+
+    AESD_CIRCULAR_BUFFER_FOREACH(found, &buffer, index) {
+        if (found->buffptr != NULL)
+            aesd_chunk_free(found->buffptr);
+    }
+}
@@ -0,0 +1,214 @@
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+#define TEST_MAX_WRITES     256
+#define TEST_MAX_SIZE       200
+
+static char writes[TEST_MAX_WRITES][TEST_MAX_SIZE];
+
+/**
+* Add write number n of size bytes the way aesd_write() does, then trim.
+* @return the number of entries removed, their buffptr stored in removed
+*/
+static size_t add_write(struct aesd_circular_buffer *buffer, unsigned int n, size_t size,
+                        const char **removed)
+{
+    struct aesd_buffer_entry entry;
+    const char *rtnptr;
+    size_t nremoved = 0;
+
+    memset(writes[n], 'a' + (n % 26), size);
+    writes[n][size - 1] = '\n';
+    entry.buffptr = writes[n];
+    entry.size = size;
+
+    rtnptr = aesd_circular_buffer_add_entry(buffer, &entry);
+    if (rtnptr != NULL)
+        removed[nremoved++] = rtnptr;
+    while ((rtnptr = aesd_circular_buffer_trim_entry(buffer)) != NULL)
+        removed[nremoved++] = rtnptr;
+
+    return nremoved;
+}
+
+/**
+* The entries must be exactly writes first..last, findable at their position
+*/
+static void verify_entries(struct aesd_circular_buffer *buffer, unsigned int first, unsigned int last,
+                           const size_t *sizes)
+{
+    unsigned int n;
+    size_t fpos = 0, offset;
+    struct aesd_buffer_entry *entry;
+
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(last - first + 1, buffer->count, "wrong number of entries");
+    for (n = first; n <= last; n++) {
+        entry = aesd_circular_buffer_get_entry(buffer, n - first);
+        TEST_ASSERT_NOT_NULL(entry);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[n], entry->buffptr, "entries out of order");
+        TEST_ASSERT_EQUAL_UINT(sizes[n], entry->size);
+
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, fpos + sizes[n] - 1, &offset);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[n], entry->buffptr, "wrong entry for position");
+        TEST_ASSERT_EQUAL_UINT(sizes[n] - 1, offset);
+        fpos += sizes[n];
+    }
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(fpos, aesd_circular_buffer_size(buffer), "wrong total size");
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(buffer, fpos, &offset));
+}
+
+void test_circular_buffer_limits_init()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[32];
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, NULL, 10, 100));
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, NULL,
+                                                                AESD_CIRCULAR_BUFFER_INLINE_SLOTS, 0));
+    TEST_ASSERT_NOT_EQUAL(0, aesd_circular_buffer_init_capacity(&buffer, NULL,
+                                                                AESD_CIRCULAR_BUFFER_INLINE_SLOTS + 1, 0));
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, entries, 32, 0));
+    TEST_ASSERT_NOT_EQUAL(0, aesd_circular_buffer_init_capacity(&buffer, entries, 24, 0));
+    TEST_ASSERT_NOT_EQUAL(0, aesd_circular_buffer_init_capacity(&buffer, entries, 0, 0));
+}
+
+/**
+* One large write pushes out as many small ones as the byte limit requires, in order
+*/
+void test_circular_buffer_limits_large_write_evicts_small()
+{
+    struct aesd_circular_buffer buffer;
+    const char *removed[TEST_MAX_WRITES];
+    size_t sizes[TEST_MAX_WRITES];
+    unsigned int n;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, NULL, 10, 50));
+
+    for (n = 0; n < 9; n++) {
+        sizes[n] = 5;
+        TEST_ASSERT_EQUAL_UINT(0, add_write(&buffer, n, sizes[n], removed));
+    }
+    verify_entries(&buffer, 0, 8, sizes);
+
+    /* 45 + 40 bytes, the seven oldest must go */
+    sizes[9] = 40;
+    TEST_ASSERT_EQUAL_UINT(7, add_write(&buffer, 9, sizes[9], removed));
+    for (n = 0; n < 7; n++)
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[n], removed[n], "removed out of order");
+    verify_entries(&buffer, 7, 9, sizes);
+}
+
+/**
+* A write larger than the byte limit is kept, alone
+*/
+void test_circular_buffer_limits_oversize_write_kept()
+{
+    struct aesd_circular_buffer buffer;
+    const char *removed[TEST_MAX_WRITES];
+    size_t sizes[TEST_MAX_WRITES];
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, NULL, 10, 50));
+
+    sizes[0] = 20;
+    sizes[1] = 20;
+    sizes[2] = 120;
+    sizes[3] = 10;
+    TEST_ASSERT_EQUAL_UINT(0, add_write(&buffer, 0, sizes[0], removed));
+    TEST_ASSERT_EQUAL_UINT(0, add_write(&buffer, 1, sizes[1], removed));
+    TEST_ASSERT_EQUAL_UINT(2, add_write(&buffer, 2, sizes[2], removed));
+    verify_entries(&buffer, 2, 2, sizes);
+
+    /* and goes as soon as anything else is written */
+    TEST_ASSERT_EQUAL_UINT(1, add_write(&buffer, 3, sizes[3], removed));
+    TEST_ASSERT_EQUAL_PTR(writes[2], removed[0]);
+    verify_entries(&buffer, 3, 3, sizes);
+}
+
+/**
+* Tiny writes are bounded by the entry limit, a byte limit of 0 never trims
+*/
+void test_circular_buffer_limits_entry_limit_first()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[4];
+    const char *removed[TEST_MAX_WRITES];
+    size_t sizes[TEST_MAX_WRITES];
+    unsigned int n;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, entries, 4, 1000));
+    for (n = 0; n < 10; n++) {
+        sizes[n] = 2;
+        TEST_ASSERT_EQUAL_UINT(n < 4 ? 0 : 1, add_write(&buffer, n, sizes[n], removed));
+    }
+    verify_entries(&buffer, 6, 9, sizes);
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, entries, 4, 0));
+    for (n = 0; n < 4; n++) {
+        sizes[n] = TEST_MAX_SIZE;
+        TEST_ASSERT_EQUAL_UINT(0, add_write(&buffer, n, sizes[n], removed));
+    }
+    verify_entries(&buffer, 0, 3, sizes);
+}
+
+/**
+* Random mix of small and large writes against both limits
+*/
+void test_circular_buffer_limits_mixed_sizes()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[16];
+    const char *removed[TEST_MAX_WRITES];
+    size_t sizes[TEST_MAX_WRITES], nremoved, i, total;
+    unsigned int n, first = 0;
+
+    srand(9);
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, entries, 16, 500));
+
+    for (n = 0; n < TEST_MAX_WRITES; n++) {
+        sizes[n] = (rand() % 4 == 0) ? 1 + (rand() % TEST_MAX_SIZE) : 1 + (rand() % 10);
+        nremoved = add_write(&buffer, n, sizes[n], removed);
+
+        /* the oldest writes go first, until both limits hold */
+        for (i = 0; i < nremoved; i++)
+            TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[first + i], removed[i], "removed out of order");
+        first += nremoved;
+
+        for (total = 0, i = first; i <= n; i++)
+            total += sizes[i];
+        TEST_ASSERT_TRUE(n - first + 1 <= 16);
+        TEST_ASSERT_TRUE(total <= 500 || first == n);
+        /* and no more than needed */
+        if (first > 0 && n - first + 1 < 16)
+            TEST_ASSERT_TRUE(total + sizes[first - 1] > 500);
+
+        verify_entries(&buffer, first, n, sizes);
+    }
+}
+
+/**
+* A lookup racing an add, as a lockless reader does, sees the fields torn apart; it must
+* return without leaving the slots, aesd_circular_buffer_read_retry() rejecting the result
+*/
+void test_circular_buffer_limits_torn_lookup()
+{
+    struct aesd_circular_buffer buffer;
+    const char *removed[TEST_MAX_WRITES];
+    size_t sizes[TEST_MAX_WRITES], offset;
+    struct aesd_buffer_entry *entry;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, NULL, 4, 0));
+    sizes[0] = 4;
+    add_write(&buffer, 0, sizes[0], removed);
+
+    /* size raised by the first add, count not yet */
+    buffer.count = 0;
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 1, &offset));
+
+    /* count beyond the slots */
+    buffer.count = UINT32_MAX;
+    buffer.size = 1000;
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 999, &offset);
+    TEST_ASSERT_TRUE(entry >= buffer.entry && entry <= &buffer.entry[buffer.mask]);
+}
@@ -0,0 +1,103 @@
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/command.h"
+
+/**
+* Parse a NUL terminated packet, which command_parse() must not rely on
+*/
+static enum command_id parse(const char *pkt, struct command *cmd)
+{
+    return command_parse(pkt, strlen(pkt), cmd);
+}
+
+void test_command_seekto()
+{
+    struct command cmd;
+
+    TEST_ASSERT_EQUAL_INT(CMD_SEEKTO, parse("AESDCHAR_IOCSEEKTO:3,7\n", &cmd));
+    TEST_ASSERT_EQUAL_UINT32(3, cmd.args[0]);
+    TEST_ASSERT_EQUAL_UINT32(7, cmd.args[1]);
+
+    TEST_ASSERT_EQUAL_INT(CMD_SEEKTO, parse("AESDCHAR_IOCSEEKTO:0,4294967295\n", &cmd));
+    TEST_ASSERT_EQUAL_UINT32(0, cmd.args[0]);
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, cmd.args[1]);
+}
+
+void test_command_subscribe()
+{
+    struct command cmd;
+
+    TEST_ASSERT_EQUAL_INT(CMD_SUBSCRIBE, parse("AESDSOCKET_SUBSCRIBE\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDSOCKET_SUBSCRIBE now\n", &cmd));
+}
+
+void test_command_log_data()
+{
+    struct command cmd;
+
+    TEST_ASSERT_EQUAL_INT(CMD_NONE, parse("hello world\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_NONE, parse("\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_NONE, parse("AESD\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_NONE, parse("AESDCHAR_IOCSEEKTO\n", &cmd));
+    /* the old regex matched anywhere in the line, commands are prefixes now */
+    TEST_ASSERT_EQUAL_INT(CMD_NONE, parse("x AESDCHAR_IOCSEEKTO:1,1\n", &cmd));
+}
+
+void test_command_malformed_arguments()
+{
+    struct command cmd;
+
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:1\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:1,\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:,1\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:-1,1\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:1,2,3\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:1,2 \n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:4294967296,0\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(CMD_INVALID, parse("AESDCHAR_IOCSEEKTO:99999999999999999999,0\n", &cmd));
+}
+
+/**
+* Every truncation of a valid command must be rejected without reading past len
+*/
+void test_command_truncated_packet()
+{
+    const char *pkt = "AESDCHAR_IOCSEEKTO:12,34\n";
+    struct command cmd;
+    size_t len;
+    char *copy;
+
+    for (len = 0; len < strlen(pkt); len++) {
+        copy = malloc(len + 1);
+        TEST_ASSERT_NOT_NULL(copy);
+        memcpy(copy, pkt, len);
+        TEST_ASSERT_NOT_EQUAL(CMD_SEEKTO, command_parse(copy, len, &cmd));
+        free(copy);
+    }
+}
+
+/**
+* Seek commands, malformed or not, are never logged by a backend resolving them, as the
+* regex path did, and are logged as data by one that cannot
+*/
+void test_command_is_data()
+{
+    struct command cmd;
+
+    parse("AESDCHAR_IOCSEEKTO:1,\n", &cmd);
+    TEST_ASSERT_EQUAL_INT(0, command_is_data(&cmd, 1));
+    TEST_ASSERT_EQUAL_INT(1, command_is_data(&cmd, 0));
+
+    parse("AESDCHAR_IOCSEEKTO:1,2\n", &cmd);
+    TEST_ASSERT_EQUAL_INT(0, command_is_data(&cmd, 1));
+    TEST_ASSERT_EQUAL_INT(1, command_is_data(&cmd, 0));
+
+    parse("AESDSOCKET_SUBSCRIBE\n", &cmd);
+    TEST_ASSERT_EQUAL_INT(0, command_is_data(&cmd, 1));
+    TEST_ASSERT_EQUAL_INT(0, command_is_data(&cmd, 0));
+
+    parse("hello world\n", &cmd);
+    TEST_ASSERT_EQUAL_INT(1, command_is_data(&cmd, 1));
+}
@@ -0,0 +1,153 @@
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/delim.h"
+
+#define TEST_BUF_LEN    200
+
+static const enum delim_impl impls[] = {
+    DELIM_IMPL_GENERIC,
+    DELIM_IMPL_SSE2,
+    DELIM_IMPL_AVX2,
+};
+
+/**
+* Reference implementation, a byte at a time.
+*/
+static size_t naive_scan(const char *buf, size_t len, char delim,
+                         size_t *pos, size_t max, size_t *scanned)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == delim) {
+            pos[n++] = i;
+            if (n == max) {
+                *scanned = i + 1;
+                return n;
+            }
+        }
+    }
+    *scanned = len;
+
+    return n;
+}
+
+/**
+* Compare delim_scan() against naive_scan() with every implementation supported by this CPU
+*/
+static void verify_scan(const char *buf, size_t len, char delim, size_t max)
+{
+    size_t pos[TEST_BUF_LEN], expect_pos[TEST_BUF_LEN];
+    size_t n, expect_n, scanned, expect_scanned;
+    size_t i;
+
+    expect_n = naive_scan(buf, len, delim, expect_pos, max, &expect_scanned);
+
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (delim_set_impl(impls[i]) != 0)
+            continue;
+
+        memset(pos, 0xa5, sizeof(pos));
+        n = delim_scan(buf, len, delim, pos, max, &scanned);
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(expect_n, n, "wrong number of delimiters");
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(expect_scanned, scanned, "wrong number of bytes scanned");
+        if (n != 0)
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expect_pos, pos, n * sizeof(size_t), "wrong delimiter offsets");
+    }
+
+    delim_set_impl(DELIM_IMPL_AUTO);
+}
+
+void test_delim_empty_buffer()
+{
+    char buf[1] = { '\n' };
+
+    verify_scan(buf, 0, '\n', 1);
+}
+
+void test_delim_no_delimiter()
+{
+    char buf[TEST_BUF_LEN];
+    size_t len;
+
+    memset(buf, 'a', sizeof(buf));
+    for (len = 1; len <= TEST_BUF_LEN; len++)
+        verify_scan(buf, len, '\n', TEST_BUF_LEN);
+}
+
+/**
+* A single delimiter at every offset, covering vector boundaries and the scalar tail
+*/
+void test_delim_single_delimiter_every_offset()
+{
+    char buf[TEST_BUF_LEN];
+    size_t len, i;
+
+    for (len = 1; len <= 100; len++) {
+        for (i = 0; i < len; i++) {
+            memset(buf, 'a', sizeof(buf));
+            buf[i] = '\n';
+            verify_scan(buf, len, '\n', TEST_BUF_LEN);
+        }
+    }
+}
+
+void test_delim_every_byte_is_delimiter()
+{
+    char buf[TEST_BUF_LEN];
+
+    memset(buf, '\n', sizeof(buf));
+    verify_scan(buf, TEST_BUF_LEN, '\n', TEST_BUF_LEN);
+}
+
+/**
+* Stop at max offsets and report where the next scan must resume
+*/
+void test_delim_max_offsets()
+{
+    char buf[TEST_BUF_LEN];
+    size_t max;
+
+    memset(buf, '\n', sizeof(buf));
+    for (max = 1; max < 70; max++)
+        verify_scan(buf, TEST_BUF_LEN, '\n', max);
+
+    memset(buf, 'a', sizeof(buf));
+    buf[3] = buf[31] = buf[32] = buf[33] = buf[150] = '\n';
+    for (max = 1; max <= 5; max++)
+        verify_scan(buf, TEST_BUF_LEN, '\n', max);
+}
+
+void test_delim_embedded_nul()
+{
+    char buf[TEST_BUF_LEN];
+
+    memset(buf, '\0', sizeof(buf));
+    buf[5] = buf[40] = buf[199] = '\n';
+    verify_scan(buf, TEST_BUF_LEN, '\n', TEST_BUF_LEN);
+}
+
+void test_delim_unaligned_buffer()
+{
+    char buf[TEST_BUF_LEN];
+    size_t off, i;
+
+    for (i = 0; i < TEST_BUF_LEN; i++)
+        buf[i] = ((i % 7) == 0) ? '\n' : 'a';
+
+    for (off = 0; off < 32; off++)
+        verify_scan(buf + off, TEST_BUF_LEN - off - 1, '\n', TEST_BUF_LEN);
+}
+
+void test_delim_high_bit_delimiter()
+{
+    char buf[TEST_BUF_LEN];
+    size_t i;
+
+    for (i = 0; i < TEST_BUF_LEN; i++)
+        buf[i] = (char) i;
+
+    verify_scan(buf, TEST_BUF_LEN, (char) 0xff, TEST_BUF_LEN);
+    verify_scan(buf, TEST_BUF_LEN, (char) 0x80, TEST_BUF_LEN);
+}